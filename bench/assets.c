@@ -0,0 +1,109 @@
+#include "bench.h"
+#include "../src/game.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// Asset loading at startup, from the loose files and from the pack built by
+// make assets, with the SDL dummy drivers and the software renderer. The cold
+// run first drops the files from the page cache, which only works on Linux,
+// elsewhere every run is warm. Run from bin/ so the paths resolve.
+
+#define PACK_FILE "assets.pak"
+
+static const int runs = 20;
+
+static TextureSource t_src[] = {
+  {"ingame", "gfx/ingame.png"},
+};
+static SpriteSource s_src[] = {
+  {"coin", "ingame", {48, 0, 16, 16}},
+};
+static FontSource f_src[] = {
+  {"font0", "font/noto_serif.ttf", 28, 1},
+};
+static AudioSource a_src[] = {
+  {"explosion", "sfx/explosion.wav"},
+};
+
+static void
+bench_drop_cache(const char *file)
+{
+#ifdef POSIX_FADV_DONTNEED
+  int fd = open(file, O_RDONLY);
+  if (fd >= 0)
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#endif
+}
+
+// Time from opening the pack to the last asset loaded
+static uint64_t
+bench_start(int packed, int cold, size_t *faults)
+{
+  if (cold)
+  {
+    bench_drop_cache(t_src[0].file);
+    bench_drop_cache(f_src[0].file);
+    bench_drop_cache(a_src[0].file);
+    bench_drop_cache(PACK_FILE);
+  }
+
+  game_init_system(640, 480, 320, 240, "bench");
+  size_t f0 = bench_page_faults();
+  uint64_t t0 = bench_now_ns();
+  if (packed)
+  {
+    game_open_asset_pack(PACK_FILE);
+  }
+  game_init_assets(t_src, sizeof(t_src), s_src, sizeof(s_src), f_src, sizeof(f_src), a_src, sizeof(a_src));
+  uint64_t ns = bench_now_ns() - t0;
+  *faults = bench_page_faults() - f0;
+  game_free();
+  return ns;
+}
+
+static void
+bench_mode(int packed)
+{
+  const char *name = packed ? "pack" : "files";
+  size_t faults;
+  uint64_t cold = bench_start(packed, 1, &faults);
+  printf("%-8s %-6s %12.3f %10zu\n", name, "cold", cold / 1e6, faults);
+
+  uint64_t warm = 0;
+  size_t warm_faults = 0;
+  for (int i = 0; i < runs; i++)
+  {
+    warm += bench_start(packed, 0, &faults);
+    warm_faults += faults;
+  }
+  printf("%-8s %-6s %12.3f %10zu\n", name, "warm", warm / 1e6 / runs, warm_faults / runs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+  SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+  SDL_setenv("SDL_RENDER_DRIVER", "software", 1);
+
+  printf("%-8s %-6s %12s %10s\n", "source", "cache", "ms", "faults");
+  bench_mode(0);
+
+  FILE *f = fopen(PACK_FILE, "rb");
+  if (f == NULL)
+  {
+    printf("no %s, build it with make assets\n", PACK_FILE);
+    return 0;
+  }
+  fclose(f);
+  bench_mode(1);
+  return 0;
+}
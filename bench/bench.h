@@ -0,0 +1,101 @@
+#pragma once
+
+// Shared helpers for the benchmarks in this directory, kept free of SDL so the
+// ECS benchmarks can run without a window or audio device
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <time.h>
+  #include <sys/resource.h>
+#endif
+
+static inline uint64_t
+bench_now_ns()
+{
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return (uint64_t)((double)c.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// CPU time used by the whole process, worker threads included
+static inline uint64_t
+bench_cpu_ns()
+{
+#ifdef _WIN32
+  FILETIME c, e, k, u;
+  GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u);
+  uint64_t t = ((uint64_t)k.dwHighDateTime << 32 | k.dwLowDateTime) +
+               ((uint64_t)u.dwHighDateTime << 32 | u.dwLowDateTime);
+  return t * 100;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Largest resident set of the process so far, in KiB
+static inline size_t
+bench_peak_rss_kb()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+  return pmc.PeakWorkingSetSize / 1024;
+#else
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  return (size_t)ru.ru_maxrss / 1024;
+#else
+  return (size_t)ru.ru_maxrss;
+#endif
+#endif
+}
+
+// Page faults of the process so far, soft ones included
+static inline size_t
+bench_page_faults()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+  return pmc.PageFaultCount;
+#else
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (size_t)(ru.ru_minflt + ru.ru_majflt);
+#endif
+}
+
+// Cheap deterministic generator so runs are comparable between builds
+static inline uint32_t
+bench_rand(uint32_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static inline void
+bench_report(const char *name, size_t ops, uint64_t ns)
+{
+  printf("%-32s %10zu ops %10.2f ms %8.2f ns/op\n", name, ops, ns / 1e6, (double)ns / ops);
+}
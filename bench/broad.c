@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "../src/broad.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Entity overlap tests for crowds of 8 to 16 pixel bodies wandering a world
+// sized for the same density at every count, about 4 bodies per 64x64 cell. A
+// tick rebuilds the broadphase, enumerates pairs and runs 256 region and 256
+// point queries like trigger volumes and mouse picks would. The first tick is
+// checked against the pairwise test, and the memory held by the broadphase is
+// reported to show it stops growing once the crowd was seen once.
+
+typedef struct {
+  float x, y, vx, vy, w, h;
+}
+Body;
+
+static const int   ticks   = 100;
+static const float cell    = 64.0f;
+static const float density = 4.0f / (64.0f * 64.0f);
+static const float dt      = 1.0f / 300.0f;
+
+static size_t
+bench_memory(const Broadphase *b)
+{
+  return b->max_bodies * (sizeof(EntityId) + sizeof(BroadBox)) +
+         b->max_refs * sizeof(BroadRef) +
+         b->max_buckets * sizeof(uint32_t) +
+         b->max_pairs * sizeof(BroadPair) +
+         b->max_results * sizeof(EntityId);
+}
+
+static size_t
+bench_naive(const Body *bodies, size_t n)
+{
+  size_t pairs = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    for (size_t j = i + 1; j < n; j++)
+    {
+      const Body *a = &bodies[i], *c = &bodies[j];
+      pairs += a->x < c->x + c->w && c->x < a->x + a->w && a->y < c->y + c->h && c->y < a->y + a->h;
+    }
+  }
+  return pairs;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("%d ticks, 256 region and 256 point queries per tick\n", ticks);
+  printf("%10s %12s %12s %12s %12s %14s\n", "bodies", "build ms", "pairs ms", "query ms", "pairs", "grown bytes");
+
+  size_t counts[] = {10000, 50000, 100000};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+  {
+    uint32_t seed = 0x1234567u;
+    size_t n = counts[c];
+    float side = sqrtf(n / density);
+
+    Body *bodies = malloc(n * sizeof(Body));
+    for (size_t i = 0; i < n; i++)
+    {
+      Body *b = &bodies[i];
+      b->w = 8 + bench_rand(&seed) % 9;
+      b->h = 8 + bench_rand(&seed) % 9;
+      b->x = (float)(bench_rand(&seed) % (uint32_t)side);
+      b->y = (float)(bench_rand(&seed) % (uint32_t)side);
+      b->vx = (float)(bench_rand(&seed) % 201) - 100.0f;
+      b->vy = (float)(bench_rand(&seed) % 201) - 100.0f;
+    }
+
+    Broadphase *bp = broad_init(cell);
+    uint64_t ns_build = 0, ns_pairs = 0, ns_query = 0;
+    size_t pairs = 0, found = 0, warm_memory = 0;
+
+    for (int t = 0; t <= ticks; t++)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        bodies[i].x += bodies[i].vx * dt;
+        bodies[i].y += bodies[i].vy * dt;
+      }
+
+      uint64_t t0 = bench_now_ns();
+      broad_clear(bp);
+      for (size_t i = 0; i < n; i++)
+      {
+        Body *b = &bodies[i];
+        broad_add(bp, (EntityId)i + 1, b->x, b->y, b->x + b->w, b->y + b->h);
+      }
+      broad_build(bp);
+      uint64_t t1 = bench_now_ns();
+
+      BroadPair *p;
+      size_t num_pairs = broad_pairs(bp, &p);
+      uint64_t t2 = bench_now_ns();
+
+      for (int q = 0; q < 256; q++)
+      {
+        EntityId *r;
+        float qx = (float)(bench_rand(&seed) % (uint32_t)side);
+        float qy = (float)(bench_rand(&seed) % (uint32_t)side);
+        found += broad_query(bp, qx, qy, qx + 128, qy + 96, &r);
+        found += broad_point(bp, qx, qy, &r);
+      }
+      uint64_t t3 = bench_now_ns();
+
+      // The first tick warms the arrays up and isn't timed
+      if (t == 0)
+      {
+        size_t expected = (n <= 10000 ? bench_naive(bodies, n) : num_pairs);
+        if (expected != num_pairs)
+        {
+          printf("pair mismatch: %zu vs %zu pairwise\n", num_pairs, expected);
+        }
+        warm_memory = bench_memory(bp);
+        continue;
+      }
+      ns_build += t1 - t0;
+      ns_pairs += t2 - t1;
+      ns_query += t3 - t2;
+      pairs += num_pairs;
+    }
+
+    printf("%10zu %12.3f %12.3f %12.3f %12zu %14zu\n", n,
+           ns_build / 1e6 / ticks, ns_pairs / 1e6 / ticks, ns_query / 1e6 / ticks,
+           pairs / ticks, bench_memory(bp) - warm_memory);
+    if (found == 0)
+    {
+      printf("queries found nothing\n");
+    }
+
+    broad_free(bp);
+    free(bodies);
+  }
+
+  return 0;
+}
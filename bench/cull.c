@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "../src/ecs.h"
+#include "../src/spatial.h"
+
+#include <stdlib.h>
+
+// Sprite culling for a fixed 320x240 view in the middle of levels of growing
+// width, with the same sprite density everywhere. The scan tests every sprite
+// against the view like scene_render did without an index, the spatial query
+// only visits the cells around the view. Both collect the sprites to draw, the
+// cost of submitting them is covered by the render benchmark.
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+enum {
+  BC_Pos,
+  BC_Spr,
+  BC_Count
+};
+
+static const int   frames  = 200;
+static const float view_w  = 320.0f;
+static const float view_h  = 240.0f;
+static const float margin  = 32.0f;
+static const int   density = 64;
+
+static ECS *
+bench_level(size_t screens, SpatialHash *sh, uint32_t *seed)
+{
+  size_t cs[BC_Count] = {sizeof(Vec2), sizeof(int)};
+  ECS *ecs = ecs_init(BC_Count, cs, screens * density);
+
+  for (size_t i = 0; i < screens * density; i++)
+  {
+    EntityId e = ecs_create_entity(ecs);
+    Vec2 *p = ecs_add_component(ecs, e, BC_Pos);
+    p->x = (float)(bench_rand(seed) % (uint32_t)(screens * view_w));
+    p->y = (float)(bench_rand(seed) % (uint32_t)view_h);
+    ecs_add_component(ecs, e, BC_Spr);
+    spatial_update(sh, e, p->x, p->y);
+  }
+  return ecs;
+}
+
+static size_t
+bench_scan(ECS *ecs, const Signature *mask, float vx, float vy, Vec2 *out)
+{
+  size_t n = 0;
+  ECSQuery q = ecs_query(ecs, mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    Vec2 *p = ecs_query_column(&q, BC_Pos);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      if (p[i].x >= vx - margin && p[i].x <= vx + view_w + margin &&
+          p[i].y >= vy - margin && p[i].y <= vy + view_h + margin)
+      {
+        out[n++] = p[i];
+      }
+    }
+  }
+  return n;
+}
+
+static size_t
+bench_index(ECS *ecs, SpatialHash *sh, float vx, float vy, Vec2 *out)
+{
+  EntityId *visible;
+  size_t num_visible = spatial_query(sh, vx - margin, vy - margin, vx + view_w + margin, vy + view_h + margin, &visible);
+
+  size_t n = 0;
+  for (size_t i = 0; i < num_visible; i++)
+  {
+    if (ecs_alive(ecs, visible[i]))
+    {
+      out[n++] = *(Vec2 *)ecs_get_component(ecs, visible[i], BC_Pos);
+    }
+  }
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  Signature mask = {{0}};
+  signature_set(&mask, BC_Pos);
+  signature_set(&mask, BC_Spr);
+
+  Vec2 *out = malloc(4096 * sizeof(Vec2));
+
+  printf("%d sprites per screen, %d frames\n", density, frames);
+  printf("%10s %10s %10s %16s %16s\n", "screens", "sprites", "drawn", "scan us/frame", "index us/frame");
+
+  size_t widths[] = {1, 10, 100, 500, 2000};
+  for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+  {
+    uint32_t seed = 0x1234567u;
+    SpatialHash *sh = spatial_init(128.0f);
+    ECS *ecs = bench_level(widths[w], sh, &seed);
+
+    // The view pans a little every frame so the index isn't hitting one set of cells
+    float vx = (widths[w] - 1) * view_w / 2;
+    size_t drawn_scan = 0, drawn_index = 0;
+
+    uint64_t t0 = bench_now_ns();
+    for (int i = 0; i < frames; i++)
+    {
+      drawn_scan += bench_scan(ecs, &mask, vx + i, 0, out);
+    }
+    uint64_t t1 = bench_now_ns();
+    for (int i = 0; i < frames; i++)
+    {
+      drawn_index += bench_index(ecs, sh, vx + i, 0, out);
+    }
+    uint64_t t2 = bench_now_ns();
+
+    if (drawn_scan > drawn_index)
+    {
+      printf("index missed sprites: %zu vs %zu\n", drawn_index, drawn_scan);
+    }
+
+    printf("%10zu %10zu %10zu %16.2f %16.2f\n", widths[w], widths[w] * density, drawn_scan / frames,
+           (t1 - t0) / 1e3 / frames, (t2 - t1) / 1e3 / frames);
+    ecs_free(ecs);
+    spatial_free(sh);
+  }
+
+  free(out);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include "bench.h"
+#include "../src/ecs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Create/destroy churn, comparing the free-list allocator in ecs.c with the
+// linear probe it replaced. Both run the same sequence: fill the table, punch
+// holes into it, then repeatedly destroy a random live entity and spawn a new one.
+
+typedef struct {
+  size_t num_entities, max_entities, next_index;
+  uint8_t *entities;
+}
+ProbeECS;
+
+static size_t
+probe_create(ProbeECS *p)
+{
+  if (p->num_entities >= p->max_entities)
+  {
+    uint8_t *new_entities = calloc(p->max_entities * 2, 1);
+    memcpy(new_entities, p->entities, p->max_entities);
+    free(p->entities);
+    p->entities = new_entities;
+    p->max_entities *= 2;
+  }
+  while (p->entities[p->next_index])
+  {
+    p->next_index = (p->next_index + 1) % p->max_entities;
+  }
+  p->num_entities++;
+  p->entities[p->next_index] = 1;
+  return p->next_index;
+}
+
+static void
+probe_destroy(ProbeECS *p, size_t e)
+{
+  p->entities[e] = 0;
+  p->num_entities--;
+}
+
+static void
+bench_probe(size_t live, size_t churn)
+{
+  ProbeECS p = {0, 32, 0, calloc(32, 1)};
+  size_t *ids = malloc(live * sizeof(size_t));
+  uint32_t seed = 0x1234567;
+
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < live; i++)
+  {
+    ids[i] = probe_create(&p);
+  }
+  for (size_t i = 0; i < live; i += 2)
+  {
+    probe_destroy(&p, ids[i]);
+    ids[i] = probe_create(&p);
+  }
+  for (size_t i = 0; i < churn; i++)
+  {
+    size_t k = bench_rand(&seed) % live;
+    probe_destroy(&p, ids[k]);
+    ids[k] = probe_create(&p);
+  }
+  bench_report("probe create/destroy", live + live / 2 + churn, bench_now_ns() - t0);
+
+  free(ids);
+  free(p.entities);
+}
+
+static void
+bench_free_list(size_t live, size_t churn)
+{
+  size_t cs[2] = {8, 8};
+  ECS *ecs = ecs_init(2, cs, live);
+  EntityId *ids = malloc(live * sizeof(EntityId));
+  uint32_t seed = 0x1234567;
+  size_t stale_accepted = 0;
+
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < live; i++)
+  {
+    ids[i] = ecs_create_entity(ecs);
+  }
+  for (size_t i = 0; i < live; i += 2)
+  {
+    ecs_destroy_entity(ecs, ids[i]);
+    ids[i] = ecs_create_entity(ecs);
+  }
+  for (size_t i = 0; i < churn; i++)
+  {
+    size_t k = bench_rand(&seed) % live;
+    EntityId old = ids[k];
+    ecs_destroy_entity(ecs, old);
+    ids[k] = ecs_create_entity(ecs);
+    stale_accepted += ecs_alive(ecs, old);
+  }
+  bench_report("free list create/destroy", live + live / 2 + churn, bench_now_ns() - t0);
+  printf("stale handles accepted: %zu\n", stale_accepted);
+
+  free(ids);
+  ecs_free(ecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t sizes[] = {1000, 10000, 100000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    printf("-- %zu live entities\n", sizes[i]);
+    bench_probe(sizes[i], 1000000);
+    bench_free_list(sizes[i], 1000000);
+  }
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include "bench.h"
+#include "../src/ecs.h"
+
+#include <stdlib.h>
+
+// Per-tick velocity integration over a level with a fixed number of movers and
+// a growing number of static entities. The slot scan is what scene_update used
+// to do, the query only visits archetypes that have both Pos and Vel.
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+enum {
+  BC_Pos,
+  BC_Vel,
+  BC_Static,
+  BC_Count
+};
+
+static const size_t movers = 500;
+static const int    ticks  = 200;
+static const float  dt     = 1.0f / 300.0f;
+
+static ECS *
+bench_level(size_t total)
+{
+  size_t cs[BC_Count] = {sizeof(Vec2), sizeof(Vec2), sizeof(Vec2)};
+  ECS *ecs = ecs_init(BC_Count, cs, total);
+
+  for (size_t i = 0; i < total; i++)
+  {
+    EntityId e = ecs_create_entity(ecs);
+    Vec2 *p = ecs_add_component(ecs, e, BC_Pos);
+    p->x = (float)i;
+    if (i % (total / movers) == 0)
+    {
+      Vec2 *v = ecs_add_component(ecs, e, BC_Vel);
+      v->x = 1.0f;
+      v->y = -1.0f;
+    }
+    else
+    {
+      ecs_add_component(ecs, e, BC_Static);
+    }
+  }
+  return ecs;
+}
+
+static void
+bench_scan(ECS *ecs, const Signature *mask)
+{
+  size_t num_e = 0, max_e = 0;
+  ecs_get_entities(ecs, &num_e, &max_e);
+
+  for (size_t i = 0, num_iter = 0; i < max_e && num_iter < num_e; i++)
+  {
+    EntityId e = ecs_entity_at(ecs, i);
+    if (e == ECS_NULL_ENTITY)
+    {
+      continue;
+    }
+    num_iter++;
+
+    if (ecs_has_components(ecs, e, mask))
+    {
+      Vec2 *p = ecs_get_component(ecs, e, BC_Pos);
+      Vec2 *v = ecs_get_component(ecs, e, BC_Vel);
+      p->x += v->x * dt;
+      p->y += v->y * dt;
+    }
+  }
+}
+
+static void
+bench_query(ECS *ecs, const Signature *mask)
+{
+  ECSQuery q = ecs_query(ecs, mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    Vec2 *p = ecs_query_column(&q, BC_Pos);
+    Vec2 *v = ecs_query_column(&q, BC_Vel);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      p[i].x += v[i].x * dt;
+      p[i].y += v[i].y * dt;
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  Signature mask = {{0}};
+  signature_set(&mask, BC_Pos);
+  signature_set(&mask, BC_Vel);
+
+  printf("%zu movers, %d ticks\n", movers, ticks);
+  printf("%10s %16s %16s\n", "entities", "scan us/tick", "query us/tick");
+
+  size_t totals[] = {1000, 10000, 50000, 200000, 1000000};
+  for (size_t t = 0; t < sizeof(totals) / sizeof(totals[0]); t++)
+  {
+    ECS *ecs = bench_level(totals[t]);
+
+    uint64_t t0 = bench_now_ns();
+    for (int i = 0; i < ticks; i++)
+    {
+      bench_scan(ecs, &mask);
+    }
+    uint64_t t1 = bench_now_ns();
+    for (int i = 0; i < ticks; i++)
+    {
+      bench_query(ecs, &mask);
+    }
+    uint64_t t2 = bench_now_ns();
+
+    printf("%10zu %16.2f %16.2f\n", totals[t], (t1 - t0) / 1e3 / ticks, (t2 - t1) / 1e3 / ticks);
+    ecs_free(ecs);
+  }
+  return 0;
+}
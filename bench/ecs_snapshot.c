@@ -0,0 +1,207 @@
+#include "bench.h"
+#include "../src/ecs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Snapshot save, restore and delta costs, and rolling back a few ticks from a
+// ring of deltas. The world is a mix of movers, static sprites and bodies with
+// a few components more, spread over a handful of archetypes.
+
+#define ROLLBACK_TICKS 8
+
+// Snapshots only restore into an ECS with the same entity limit, the largest
+// world is as big as it gets
+#define MAX_ENTITIES 100000
+
+typedef enum {
+  C_Pos,
+  C_Vel,
+  C_Size,
+  C_Spr,
+  C_Tag,
+  C_Count
+}
+BenchComponent;
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+static ECS *
+bench_world(size_t n)
+{
+  size_t cs[C_Count] = {
+    [C_Pos]  = sizeof(Vec2),
+    [C_Vel]  = sizeof(Vec2),
+    [C_Size] = 4 * sizeof(float),
+    [C_Spr]  = 4 * sizeof(float),
+    [C_Tag]  = sizeof(uint64_t),
+  };
+  ECS *ecs = ecs_init(C_Count, cs, MAX_ENTITIES);
+  uint32_t seed = 0x1234567;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    EntityId e = ecs_create_entity(ecs);
+    Vec2 *p = ecs_add_component(ecs, e, C_Pos);
+    p->x = (float)(bench_rand(&seed) % 4096);
+    p->y = (float)(bench_rand(&seed) % 4096);
+    ecs_add_component(ecs, e, C_Spr);
+
+    // Half of them move, a quarter of those also collide
+    if (i % 2 == 0)
+    {
+      Vec2 *v = ecs_add_component(ecs, e, C_Vel);
+      v->x = (float)(bench_rand(&seed) % 64) - 32;
+      v->y = (float)(bench_rand(&seed) % 64) - 32;
+    }
+    if (i % 8 == 0)
+    {
+      ecs_add_component(ecs, e, C_Size);
+      ecs_add_component(ecs, e, C_Tag);
+    }
+  }
+  return ecs;
+}
+
+static void
+bench_tick(ECS *ecs)
+{
+  Signature mask = {{0}};
+  signature_set(&mask, C_Pos);
+  signature_set(&mask, C_Vel);
+
+  ECSQuery q = ecs_query(ecs, &mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    Vec2 *p = ecs_query_column(&q, C_Pos);
+    Vec2 *v = ecs_query_column(&q, C_Vel);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      p[i].x += v[i].x / 60;
+      p[i].y += v[i].y / 60;
+    }
+  }
+}
+
+static void
+bench_snapshots(size_t n, size_t runs)
+{
+  ECS *ecs = bench_world(n);
+  ECSSnapshot snap = {0}, base = {0}, delta = {0}, out = {0};
+
+  // Buffers grow on the first save only
+  ecs_snapshot(ecs, &snap);
+  uint64_t t0 = bench_now_ns();
+  for (size_t i = 0; i < runs; i++)
+  {
+    ecs_snapshot(ecs, &snap);
+  }
+  bench_report("save", runs, bench_now_ns() - t0);
+  printf("snapshot %zu bytes, %.1f bytes/entity\n", snap.size, (double)snap.size / n);
+
+  uint64_t hash = ecs_hash(ecs);
+  t0 = bench_now_ns();
+  for (size_t i = 0; i < runs; i++)
+  {
+    ecs_restore(ecs, &snap);
+  }
+  bench_report("restore", runs, bench_now_ns() - t0);
+  printf("restore keeps hash: %s\n", ecs_hash(ecs) == hash ? "yes" : "NO");
+
+  // Same state in a fresh ECS, archetypes are created as the snapshot goes
+  ECS *fresh = bench_world(0);
+  ecs_restore(fresh, &snap);
+  printf("restore into fresh ECS keeps hash: %s\n", ecs_hash(fresh) == hash ? "yes" : "NO");
+  ecs_free(fresh);
+
+  // Delta of one tick against the previous one
+  ecs_snapshot(ecs, &base);
+  bench_tick(ecs);
+  ecs_snapshot(ecs, &snap);
+  t0 = bench_now_ns();
+  for (size_t i = 0; i < runs; i++)
+  {
+    ecs_snapshot_delta(&base, &snap, &delta);
+  }
+  bench_report("delta", runs, bench_now_ns() - t0);
+  printf("delta after one tick %zu bytes, %.1f%% of a snapshot\n", delta.size, 100.0 * delta.size / snap.size);
+
+  t0 = bench_now_ns();
+  for (size_t i = 0; i < runs; i++)
+  {
+    ecs_snapshot_apply(&base, &delta, &out);
+  }
+  bench_report("apply", runs, bench_now_ns() - t0);
+  printf("apply rebuilds snapshot: %s\n", out.size == snap.size && memcmp(out.data, snap.data, snap.size) == 0 ? "yes" : "NO");
+
+  ecs_snapshot_free(&snap);
+  ecs_snapshot_free(&base);
+  ecs_snapshot_free(&delta);
+  ecs_snapshot_free(&out);
+  ecs_free(ecs);
+}
+
+// One full snapshot as the base, then a delta per tick against it, each tick
+// is restored from the base and its delta
+static void
+bench_rollback(size_t n)
+{
+  ECS *ecs = bench_world(n);
+  ECSSnapshot base = {0}, snap = {0}, out = {0};
+  ECSSnapshot deltas[ROLLBACK_TICKS] = {{0}};
+  uint64_t hashes[ROLLBACK_TICKS];
+
+  ecs_snapshot(ecs, &base);
+  size_t delta_bytes = 0;
+  uint64_t t0 = bench_now_ns();
+  for (int t = 0; t < ROLLBACK_TICKS; t++)
+  {
+    bench_tick(ecs);
+    ecs_snapshot(ecs, &snap);
+    ecs_snapshot_delta(&base, &snap, &deltas[t]);
+    hashes[t] = ecs_hash(ecs);
+    delta_bytes += deltas[t].size;
+  }
+  uint64_t save_ns = bench_now_ns() - t0;
+
+  // Back to the oldest tick, then every tick up to the newest
+  size_t matched = 0;
+  t0 = bench_now_ns();
+  for (int t = 0; t < ROLLBACK_TICKS; t++)
+  {
+    ecs_snapshot_apply(&base, &deltas[t], &out);
+    ecs_restore(ecs, &out);
+    matched += ecs_hash(ecs) == hashes[t];
+  }
+  uint64_t load_ns = bench_now_ns() - t0;
+
+  bench_report("rollback tick save", ROLLBACK_TICKS, save_ns);
+  bench_report("rollback tick load", ROLLBACK_TICKS, load_ns);
+  printf("%d ticks in %zu bytes of deltas plus a %zu byte base, %zu/%d restored exactly\n", ROLLBACK_TICKS,
+         delta_bytes, base.size, matched, ROLLBACK_TICKS);
+
+  for (int t = 0; t < ROLLBACK_TICKS; t++)
+  {
+    ecs_snapshot_free(&deltas[t]);
+  }
+  ecs_snapshot_free(&base);
+  ecs_snapshot_free(&snap);
+  ecs_snapshot_free(&out);
+  ecs_free(ecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t sizes[] = {1000, 10000, 100000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    printf("-- %zu entities\n", sizes[i]);
+    bench_snapshots(sizes[i], sizes[i] >= 100000 ? 100 : 1000);
+    bench_rollback(sizes[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include "bench.h"
+#include "../src/level.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// Load throughput and size of 4k x 4k levels in the old raw format (fread of
+// the whole grid), the chunked format with raw chunks and with compressed
+// chunks. Loading means getting every tile into memory, so the chunked files
+// read and decode every chunk. Cold runs drop the file from the page cache
+// first, where the platform allows it.
+
+static const char *files[3] = {"bench_level_old.tmp", "bench_level_raw.tmp", "bench_level_packed.tmp"};
+static const char *names[3] = {"old", "chunked", "packed"};
+static const size_t size   = 4096;
+static const int    runs   = 10;
+
+typedef enum {
+  Pattern_Platforms,
+  Pattern_Terrain,
+  Pattern_Noise,
+  Pattern_Count
+}
+Pattern;
+
+static const char *pattern_names[Pattern_Count] = {"platforms", "terrain", "noise"};
+
+static void
+bench_generate(Pattern p, uint8_t *tiles)
+{
+  uint32_t seed = 0x1234567u;
+  memset(tiles, 0, size * size);
+
+  switch (p)
+  {
+  case Pattern_Platforms:
+    // Short floating platforms, the usual case
+    for (size_t i = 0; i < size * size / 128; i++)
+    {
+      size_t x = bench_rand(&seed) % (size - 8), y = bench_rand(&seed) % size;
+      memset(tiles + y * size + x, 1, 8);
+    }
+    break;
+  case Pattern_Terrain:
+    // Solid ground under a rolling surface, caves make it less regular
+    for (size_t x = 0, ground = size / 2; x < size; x++)
+    {
+      ground = ground + (bench_rand(&seed) % 3) - 1;
+      for (size_t y = ground; y < size; y++)
+      {
+        tiles[y * size + x] = (bench_rand(&seed) % 16) != 0;
+      }
+    }
+    break;
+  case Pattern_Noise:
+    // One in eight tiles set at random, about the worst case for runs
+    for (size_t i = 0; i < size * size; i++)
+    {
+      tiles[i] = (bench_rand(&seed) & 7) == 0;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void
+bench_write_old(const char *file, const uint8_t *tiles)
+{
+  size_t w = size, h = size;
+  FILE *f = fopen(file, "wb");
+  fwrite(&w, sizeof(size_t), 1, f);
+  fwrite(&h, sizeof(size_t), 1, f);
+  fwrite(tiles, 1, w * h, f);
+  fclose(f);
+}
+
+static size_t
+bench_file_size(const char *file)
+{
+  FILE *f = fopen(file, "rb");
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  fclose(f);
+  return (size_t)n;
+}
+
+static void
+bench_drop_cache(const char *file)
+{
+#ifndef _WIN32
+  int fd = open(file, O_RDONLY);
+  if (fd >= 0)
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#endif
+}
+
+static uint64_t
+bench_load(int kind, uint8_t *out)
+{
+  if (kind == 0)
+  {
+    size_t w, h;
+    FILE *f = fopen(files[0], "rb");
+    fread(&w, sizeof(size_t), 1, f);
+    fread(&h, sizeof(size_t), 1, f);
+    fread(out, 1, w * h, f);
+    fclose(f);
+    return out[w * h / 2];
+  }
+
+  Level *l = level_load(files[kind]);
+  uint8_t chunk[LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES];
+  for (uint32_t cy = 0; cy < l->chunks_h; cy++)
+  {
+    for (uint32_t cx = 0; cx < l->chunks_w; cx++)
+    {
+      level_read_chunk(l, cx, cy, chunk);
+      for (uint32_t y = 0; y < LEVEL_CHUNK_TILES; y++)
+      {
+        memcpy(out + ((size_t)cy * LEVEL_CHUNK_TILES + y) * size + cx * LEVEL_CHUNK_TILES,
+               chunk + y * LEVEL_CHUNK_TILES, LEVEL_CHUNK_TILES);
+      }
+    }
+  }
+  level_free(l);
+  return out[size * size / 2];
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint8_t *tiles = malloc(size * size);
+  uint8_t *out = malloc(size * size);
+  uint64_t sum = 0;
+
+  printf("%zux%zu tiles, %.1f MB\n", size, size, size * size / 1e6);
+  printf("%-10s %-8s %10s %14s %14s\n", "pattern", "format", "file KB", "warm MB/s", "cold MB/s");
+
+  for (int p = 0; p < Pattern_Count; p++)
+  {
+    bench_generate(p, tiles);
+    bench_write_old(files[0], tiles);
+    level_write(files[1], size, size, tiles, NULL, 0, NULL, 0);
+    level_write(files[2], size, size, tiles, NULL, 0, NULL, 1);
+
+    for (int k = 0; k < 3; k++)
+    {
+      sum += bench_load(k, out);
+      if (memcmp(out, tiles, size * size) != 0)
+      {
+        printf("%s %s doesn't round trip\n", pattern_names[p], names[k]);
+      }
+
+      uint64_t t0 = bench_now_ns();
+      for (int i = 0; i < runs; i++)
+      {
+        sum += bench_load(k, out);
+      }
+      uint64_t t1 = bench_now_ns();
+
+      uint64_t cold = 0;
+      for (int i = 0; i < runs; i++)
+      {
+        bench_drop_cache(files[k]);
+        uint64_t t2 = bench_now_ns();
+        sum += bench_load(k, out);
+        cold += bench_now_ns() - t2;
+      }
+
+      double mb = size * size / 1e6;
+      printf("%-10s %-8s %10zu %14.0f %14.0f\n", pattern_names[p], names[k], bench_file_size(files[k]) / 1024,
+             mb / ((t1 - t0) / 1e9 / runs), mb / (cold / 1e9 / runs));
+    }
+  }
+
+  if (sum == UINT64_MAX)
+  {
+    puts("");
+  }
+
+  for (int k = 0; k < 3; k++)
+  {
+    remove(files[k]);
+  }
+  free(tiles);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include "bench.h"
+#include "../src/ecs.h"
+#include "../src/mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Growing a column in reserved memory versus the realloc doubling it replaced,
+// many small allocations from an arena versus malloc, and ECS setup and
+// teardown, with the page faults each costs.
+
+typedef struct {
+  float x, y, w, h;
+}
+Row;
+
+typedef enum {
+  C_Pos,
+  C_Vel,
+  C_Size,
+  C_Life,
+  C_Count
+}
+BenchComponent;
+
+static void
+bench_faults(const char *name, size_t ops, uint64_t ns, size_t faults)
+{
+  bench_report(name, ops, ns);
+  printf("%-32s %10zu page faults\n", "", faults);
+}
+
+// One column grown to rows, each row written as it's added like
+// archetype_push does. Moves counts the times realloc handed back a new
+// address, every pointer into the column would have gone stale.
+static void
+bench_grow_realloc(size_t rows)
+{
+  size_t f0 = bench_page_faults(), moves = 0;
+  uint64_t t0 = bench_now_ns();
+  size_t capacity = 16;
+  Row *column = malloc(capacity * sizeof(Row));
+  for (size_t i = 0; i < rows; i++)
+  {
+    if (i >= capacity)
+    {
+      capacity *= 2;
+      Row *grown = realloc(column, capacity * sizeof(Row));
+      moves += grown != column;
+      column = grown;
+    }
+    column[i] = (Row){(float)i, 0, 1, 1};
+  }
+  free(column);
+  bench_faults("column realloc", rows, bench_now_ns() - t0, bench_page_faults() - f0);
+  printf("%-32s %10zu moves\n", "", moves);
+}
+
+static void
+bench_grow_vmem(size_t rows)
+{
+  size_t f0 = bench_page_faults();
+  uint64_t t0 = bench_now_ns();
+  VMem v;
+  vmem_reserve(&v, rows * sizeof(Row));
+  Row *column = (Row *)v.base;
+  size_t capacity = 16;
+  vmem_commit(&v, capacity * sizeof(Row));
+  for (size_t i = 0; i < rows; i++)
+  {
+    if (i >= capacity)
+    {
+      capacity *= 2;
+      vmem_commit(&v, (capacity < rows ? capacity : rows) * sizeof(Row));
+    }
+    column[i] = (Row){(float)i, 0, 1, 1};
+  }
+  vmem_release(&v);
+  bench_faults("column reserved", rows, bench_now_ns() - t0, bench_page_faults() - f0);
+}
+
+// The scene's fixed tables, a few dozen allocations of assorted sizes made
+// at setup and freed at teardown
+static void
+bench_tables_malloc(size_t tables, size_t runs)
+{
+  void **p = malloc(tables * sizeof(void *));
+  size_t f0 = bench_page_faults();
+  uint64_t t0 = bench_now_ns();
+  for (size_t r = 0; r < runs; r++)
+  {
+    for (size_t i = 0; i < tables; i++)
+    {
+      p[i] = calloc(1, 64 << (i % 12));
+    }
+    for (size_t i = 0; i < tables; i++)
+    {
+      free(p[i]);
+    }
+  }
+  bench_faults("tables malloc", tables * runs, bench_now_ns() - t0, (bench_page_faults() - f0) / runs);
+  free(p);
+}
+
+static void
+bench_tables_arena(size_t tables, size_t runs)
+{
+  size_t f0 = bench_page_faults();
+  uint64_t t0 = bench_now_ns();
+  for (size_t r = 0; r < runs; r++)
+  {
+    Arena a;
+    arena_init(&a, (size_t)64 << 20);
+    for (size_t i = 0; i < tables; i++)
+    {
+      arena_calloc(&a, 1, 64 << (i % 12));
+    }
+    arena_free(&a);
+  }
+  bench_faults("tables arena", tables * runs, bench_now_ns() - t0, (bench_page_faults() - f0) / runs);
+}
+
+static void
+bench_ecs_setup(size_t n, size_t runs)
+{
+  size_t cs[C_Count] = {
+    [C_Pos]  = 2 * sizeof(float),
+    [C_Vel]  = 2 * sizeof(float),
+    [C_Size] = sizeof(Row),
+    [C_Life] = sizeof(float),
+  };
+
+  size_t f0 = bench_page_faults();
+  uint64_t t0 = bench_now_ns();
+  for (size_t r = 0; r < runs; r++)
+  {
+    ECS *ecs = ecs_init(C_Count, cs, n);
+    for (size_t i = 0; i < n; i++)
+    {
+      EntityId e = ecs_create_entity(ecs);
+      ecs_add_component(ecs, e, C_Pos);
+      if (i % 2 == 0)
+      {
+        ecs_add_component(ecs, e, C_Vel);
+      }
+      if (i % 4 == 0)
+      {
+        ecs_add_component(ecs, e, C_Size);
+      }
+      ecs_add_component(ecs, e, C_Life);
+    }
+    ecs_free(ecs);
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "ecs setup/teardown %zu", n);
+  bench_faults(name, runs, bench_now_ns() - t0, (bench_page_faults() - f0) / runs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("-- column of %zu byte rows\n", sizeof(Row));
+  size_t sizes[] = {1000, 100000, 1000000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    bench_grow_vmem(sizes[i]);
+    bench_grow_realloc(sizes[i]);
+  }
+
+  printf("-- scene tables\n");
+  bench_tables_malloc(48, 1000);
+  bench_tables_arena(48, 1000);
+
+  printf("-- ecs\n");
+  bench_ecs_setup(1000, 200);
+  bench_ecs_setup(10000, 50);
+  bench_ecs_setup(100000, 10);
+
+  MemStats stats;
+  mem_get_stats(&stats);
+  printf("-- reserved %zu MB, committed %zu KB, cached %zu KB, %zu commits\n", stats.reserved >> 20,
+         stats.committed >> 10, stats.cached >> 10, stats.commits);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "../src/game.h"
+
+#include <stdlib.h>
+
+// Draws N rotated sprites per frame with the SDL dummy video driver and the
+// software renderer, once through the sprite batch and once with a
+// SDL_RenderCopyEx per sprite. Run from bin/ so the texture path resolves.
+
+static const int frames = 60;
+
+static void
+bench_frames(SpriteId *ids, size_t num_ids, size_t n, int batched)
+{
+  uint32_t seed = 0xbadcafe;
+  game_set_sprite_batching(batched);
+
+  uint64_t t0 = bench_now_ns();
+  size_t draws = 0;
+  for (int f = 0; f < frames; f++)
+  {
+    game_begin_frame();
+    for (size_t i = 0; i < n; i++)
+    {
+      float x = bench_rand(&seed) % 320;
+      float y = bench_rand(&seed) % 240;
+      float a = bench_rand(&seed) % 360;
+      game_draw_sprite(ids[i % num_ids], x, y, 1, 1, a);
+    }
+    game_end_frame();
+    draws += game_get_draw_calls();
+  }
+  uint64_t ns = bench_now_ns() - t0;
+
+  printf("%8zu %8s %14.1f %12.3f\n", n, batched ? "batch" : "copyex", (double)draws / frames, ns / 1e6 / frames);
+}
+
+int
+main(int argc, char *argv[])
+{
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+  SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+  SDL_setenv("SDL_RENDER_DRIVER", "software", 1);
+
+  TextureSource t_src[] = {
+    {"ingame", "gfx/ingame.png"},
+  };
+  SpriteSource s_src[] = {
+    {"brick_c", "ingame", {16, 16, 16, 16}},
+    {"coin",    "ingame", {48, 0,  16, 16}},
+    {"plr_s",   "ingame", {0,  0,  16, 16}},
+  };
+
+  game_init_system(640, 480, 320, 240, "bench");
+  game_init_assets(t_src, sizeof(t_src), s_src, sizeof(s_src), NULL, 0, NULL, 0);
+
+  SpriteId ids[] = {game_sprite_id("brick_c"), game_sprite_id("coin"), game_sprite_id("plr_s")};
+
+  printf("%8s %8s %14s %12s\n", "sprites", "path", "draws/frame", "ms/frame");
+
+  size_t counts[] = {1000, 5000, 20000};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+  {
+    bench_frames(ids, 3, counts[i], 0);
+    bench_frames(ids, 3, counts[i], 1);
+  }
+
+  game_free();
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include "bench.h"
+#include "../src/ecs.h"
+#include "../src/sched.h"
+
+#include <math.h>
+#include <string.h>
+
+// Headless scheduler scaling: 100k entities and four systems, run with 1, 2, 4
+// and 8 threads. gravity -> move form a chain through Vel, age and spin touch
+// their own components and can overlap with them. The state hash has to be the
+// same for every thread count.
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+enum {
+  BC_Pos,
+  BC_Vel,
+  BC_Life,
+  BC_Rot,
+  BC_Count
+};
+
+typedef struct {
+  ECS *ecs;
+  Scheduler *sched;
+}
+World;
+
+typedef struct {
+  void *a, *b;
+  float dt;
+}
+Job;
+
+static const size_t entities = 100000;
+static const int    ticks    = 300;
+
+static void
+range_gravity(void *data, size_t begin, size_t end)
+{
+  Job *j = data;
+  Vec2 *v = j->a;
+  for (size_t i = begin; i < end; i++)
+  {
+    v[i].y += 980.0f * j->dt;
+    v[i].x *= 0.999f;
+  }
+}
+
+static void
+range_move(void *data, size_t begin, size_t end)
+{
+  Job *j = data;
+  Vec2 *p = j->a, *v = j->b;
+  for (size_t i = begin; i < end; i++)
+  {
+    p[i].x += v[i].x * j->dt;
+    p[i].y += v[i].y * j->dt;
+  }
+}
+
+static void
+range_age(void *data, size_t begin, size_t end)
+{
+  Job *j = data;
+  float *life = j->a;
+  for (size_t i = begin; i < end; i++)
+  {
+    life[i] = fmodf(life[i] + j->dt, 5.0f);
+  }
+}
+
+static void
+range_spin(void *data, size_t begin, size_t end)
+{
+  Job *j = data;
+  Vec2 *r = j->a;
+  for (size_t i = begin; i < end; i++)
+  {
+    float c = cosf(0.01f), s = sinf(0.01f);
+    Vec2 o = r[i];
+    r[i].x = o.x * c - o.y * s;
+    r[i].y = o.x * s + o.y * c;
+  }
+}
+
+static void
+system_run(World *w, float dt, size_t c0, size_t c1, RangeFunc fn)
+{
+  Signature mask = {{0}};
+  signature_set(&mask, c0);
+  if (c1 != c0)
+  {
+    signature_set(&mask, c1);
+  }
+
+  ECSQuery q = ecs_query(w->ecs, &mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    Job j = {ecs_query_column(&q, c0), ecs_query_column(&q, c1), dt};
+    sched_parallel_for(w->sched, q.count, 2048, fn, &j);
+  }
+}
+
+static void system_gravity(void *w, float dt) { system_run(w, dt, BC_Vel, BC_Vel, range_gravity); }
+static void system_move(void *w, float dt)    { system_run(w, dt, BC_Pos, BC_Vel, range_move); }
+static void system_age(void *w, float dt)     { system_run(w, dt, BC_Life, BC_Life, range_age); }
+static void system_spin(void *w, float dt)    { system_run(w, dt, BC_Rot, BC_Rot, range_spin); }
+
+static uint64_t
+world_hash(ECS *ecs)
+{
+  // FNV-1a over every component column, in archetype order
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t a = 0; a < ecs->num_archetypes; a++)
+  {
+    Archetype *arch = ecs->archetypes[a];
+    for (size_t c = 0; c < BC_Count; c++)
+    {
+      const uint8_t *bytes = arch->columns[c];
+      for (size_t i = 0; bytes != NULL && i < arch->count * ecs->component_sizes[c]; i++)
+      {
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+      }
+    }
+  }
+  return h;
+}
+
+static void
+bench_threads(int threads)
+{
+  size_t cs[BC_Count] = {sizeof(Vec2), sizeof(Vec2), sizeof(float), sizeof(Vec2)};
+  World w = {ecs_init(BC_Count, cs, entities), sched_init(threads)};
+  ECSCommandBuffer *cb = ecs_cmd_init(w.ecs);
+
+  for (size_t i = 0; i < entities; i++)
+  {
+    Vec2 p = {(float)(i % 1000), (float)(i / 1000)}, v = {(float)(i % 7), 0}, r = {1, 0};
+    float life = (float)(i % 50) / 10.0f;
+
+    EntityId e = ecs_cmd_create(cb);
+    ecs_cmd_add(cb, e, BC_Pos, &p);
+    ecs_cmd_add(cb, e, BC_Vel, &v);
+    if (i % 2 == 0)
+    {
+      ecs_cmd_add(cb, e, BC_Life, &life);
+    }
+    if (i % 3 == 0)
+    {
+      ecs_cmd_add(cb, e, BC_Rot, &r);
+    }
+  }
+  ecs_cmd_flush(cb);
+
+  Signature vel = {{0}}, pos = {{0}}, life = {{0}}, rot = {{0}};
+  signature_set(&vel, BC_Vel);
+  signature_set(&pos, BC_Pos);
+  signature_set(&life, BC_Life);
+  signature_set(&rot, BC_Rot);
+  sched_add_system(w.sched, "gravity", system_gravity, &w, NULL, &vel);
+  sched_add_system(w.sched, "move", system_move, &w, &vel, &pos);
+  sched_add_system(w.sched, "age", system_age, &w, NULL, &life);
+  sched_add_system(w.sched, "spin", system_spin, &w, NULL, &rot);
+
+  uint64_t t0 = bench_now_ns();
+  for (int t = 0; t < ticks; t++)
+  {
+    sched_run(w.sched, 1.0f / 300.0f);
+  }
+  uint64_t ns = bench_now_ns() - t0;
+
+  printf("%8d %14.3f %10.2f %016llx\n", threads, ns / 1e6 / ticks, (double)ns / ticks / entities,
+         (unsigned long long)world_hash(w.ecs));
+
+  ecs_cmd_free(cb);
+  sched_free(w.sched);
+  ecs_free(w.ecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("%zu entities, %d ticks, %d CPUs\n", entities, ticks, SDL_GetCPUCount());
+  printf("%8s %14s %10s %16s\n", "threads", "ms/tick", "ns/entity", "state hash");
+
+  int threads[] = {1, 2, 4, 8};
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+  {
+    bench_threads(threads[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "../src/ecs.h"
+#include "../src/simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Gravity and velocity integration the way the accel and move systems run it,
+// one simd_madd per archetype column, Vel += Acc * dt then Pos += Vel * dt.
+// 10k bodies stay in cache and show the arithmetic, 1M bodies are bound by
+// memory bandwidth. Each supported path runs from the same start state and has
+// to end bit identical to the scalar one.
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+enum {
+  BC_Pos,
+  BC_Vel,
+  BC_Acc,
+  BC_Count
+};
+
+static const float dt = 1.0f / 300.0f;
+
+static ECS *
+bench_level(size_t bodies)
+{
+  size_t cs[BC_Count] = {sizeof(Vec2), sizeof(Vec2), sizeof(Vec2)};
+  ECS *ecs = ecs_init(BC_Count, cs, bodies);
+
+  uint32_t seed = 0x1234567u;
+  for (size_t i = 0; i < bodies; i++)
+  {
+    EntityId e = ecs_create_entity(ecs);
+    Vec2 *p = ecs_add_component(ecs, e, BC_Pos);
+    Vec2 *v = ecs_add_component(ecs, e, BC_Vel);
+    Vec2 *a = ecs_add_component(ecs, e, BC_Acc);
+    p->x = (float)(bench_rand(&seed) % 100000);
+    p->y = (float)(bench_rand(&seed) % 100000);
+    v->x = (float)(bench_rand(&seed) % 401) - 200.0f;
+    v->y = (float)(bench_rand(&seed) % 401) - 200.0f;
+    a->y = 980.0f;
+  }
+  return ecs;
+}
+
+static void
+bench_columns(ECS *ecs, float **pos, float **vel, float **acc)
+{
+  Signature mask = {{0}};
+  signature_set(&mask, BC_Pos);
+  signature_set(&mask, BC_Vel);
+  signature_set(&mask, BC_Acc);
+
+  ECSQuery q = ecs_query(ecs, &mask, NULL);
+  ecs_query_next(&q);
+  *pos = ecs_query_column(&q, BC_Pos);
+  *vel = ecs_query_column(&q, BC_Vel);
+  *acc = ecs_query_column(&q, BC_Acc);
+}
+
+static void
+bench_paths(size_t bodies, int ticks)
+{
+  ECS *ecs = bench_level(bodies);
+  float *pos, *vel, *acc;
+  bench_columns(ecs, &pos, &vel, &acc);
+
+  size_t n = bodies * 2;
+  float *pos0 = malloc(n * sizeof(float)), *vel0 = malloc(n * sizeof(float));
+  float *pos_ref = malloc(n * sizeof(float)), *vel_ref = malloc(n * sizeof(float));
+  memcpy(pos0, pos, n * sizeof(float));
+  memcpy(vel0, vel, n * sizeof(float));
+
+  for (int p = SimdPath_Scalar; p < SimdPath_Count; p++)
+  {
+    if (simd_supported(p) == 0)
+    {
+      printf("%10zu %10s %14s\n", bodies, simd_path_name(p), "unsupported");
+      continue;
+    }
+    simd_set_path(p);
+    memcpy(pos, pos0, n * sizeof(float));
+    memcpy(vel, vel0, n * sizeof(float));
+
+    uint64_t t0 = bench_now_ns();
+    for (int t = 0; t < ticks; t++)
+    {
+      simd_madd(vel, acc, n, dt);
+      simd_madd(pos, vel, n, dt);
+    }
+    uint64_t ns = bench_now_ns() - t0;
+
+    if (p == SimdPath_Scalar)
+    {
+      memcpy(pos_ref, pos, n * sizeof(float));
+      memcpy(vel_ref, vel, n * sizeof(float));
+    }
+    int matches = memcmp(pos, pos_ref, n * sizeof(float)) == 0 && memcmp(vel, vel_ref, n * sizeof(float)) == 0;
+
+    printf("%10zu %10s %14.3f %14.3f %10s\n", bodies, simd_path_name(p), ns / 1e6 / ticks,
+           (double)ns / ticks / bodies, matches ? "yes" : "no");
+  }
+
+  free(pos0);
+  free(vel0);
+  free(pos_ref);
+  free(vel_ref);
+  ecs_free(ecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("%10s %10s %14s %14s %10s\n", "bodies", "path", "ms/tick", "ns/entity", "matches");
+  bench_paths(10000, 10000);
+  bench_paths(1000000, 100);
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "../src/tilemap.h"
+
+#include <stdlib.h>
+
+// Traverses a 10k x 10k tile world diagonally at 60 frames per second with a
+// 320x240 view and the camera far faster than the player can run. Reports the
+// main thread time tilemap_stream takes per frame, how often a chunk in view
+// wasn't loaded yet, and how many chunks were in memory at most.
+
+static const char *lvl_file = "bench_stream.tmp";
+static const size_t size    = 10000;
+static const float  view_w  = 320.0f;
+static const float  view_h  = 240.0f;
+static const float  speed   = 12000.0f;
+static const float  fps     = 60.0f;
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+  // Platforms of a few bricks scattered over the world, most chunks have some
+  uint8_t *tiles = calloc(size, size);
+  uint32_t seed = 0x1234567u;
+  for (size_t i = 0; i < size * size / 64; i++)
+  {
+    size_t x = bench_rand(&seed) % (size - 8), y = bench_rand(&seed) % size;
+    for (size_t k = 0; k < 8; k++)
+    {
+      tiles[y * size + x + k] = LevelElement_Brick;
+    }
+  }
+  LevelSpawn spawn = {LevelSpawn_Player, 0, 80, 80};
+  uint64_t tw = bench_now_ns();
+  level_write(lvl_file, size, size, tiles, &spawn, 1, NULL, 1);
+  printf("wrote %zux%zu level in %.0f ms\n", size, size, (bench_now_ns() - tw) / 1e6);
+  free(tiles);
+
+  uint64_t t0 = bench_now_ns();
+  Level *level = level_load(lvl_file);
+  Arena arena;
+  arena_init(&arena, (size_t)64 << 20);
+  Tilemap *t = tilemap_init(level, &arena);
+  tilemap_stream(t, 0, 0, view_w, view_h, 1);
+  printf("load and first chunks in %.2f ms\n", (bench_now_ns() - t0) / 1e6);
+
+  float world = size * TILE_SIZE;
+  size_t frames = (size_t)((world - view_w) / (speed / fps));
+  uint64_t *times = malloc(frames * sizeof(uint64_t));
+  size_t late = 0, max_resident = 0;
+
+  uint64_t next = bench_now_ns();
+  for (size_t f = 0; f < frames; f++)
+  {
+    float p = f * speed / fps;
+    float vx = p, vy = p * (world - view_h) / (world - view_w);
+
+    uint64_t a = bench_now_ns();
+    tilemap_stream(t, vx, vy, view_w, view_h, 0);
+    times[f] = bench_now_ns() - a;
+
+    // A frame is late when a chunk it has to draw or collide with is missing
+    for (int cy = (int)(vy / TILEMAP_CHUNK_PX); cy <= (int)((vy + view_h) / TILEMAP_CHUNK_PX); cy++)
+    {
+      for (int cx = (int)(vx / TILEMAP_CHUNK_PX); cx <= (int)((vx + view_w) / TILEMAP_CHUNK_PX); cx++)
+      {
+        if ((size_t)cx < t->chunks_w && (size_t)cy < t->chunks_h && t->tiles[cy * t->chunks_w + cx] == NULL)
+        {
+          late++;
+        }
+      }
+    }
+    max_resident = t->num_resident > max_resident ? t->num_resident : max_resident;
+
+    // Frames are paced like the game would be, the loader runs in between
+    next += (uint64_t)(1e9 / fps);
+    while (bench_now_ns() < next)
+    {
+      SDL_Delay(1);
+    }
+  }
+
+  qsort(times, frames, sizeof(uint64_t), bench_cmp);
+  uint64_t total = 0;
+  for (size_t f = 0; f < frames; f++)
+  {
+    total += times[f];
+  }
+
+  printf("%zu frames at %.0f px/s, %zu chunks\n", frames, speed, t->chunks_w * t->chunks_h);
+  printf("stream us/frame  mean %.2f  p99 %.2f  max %.2f\n",
+         total / 1e3 / frames, times[frames * 99 / 100] / 1e3, times[frames - 1] / 1e3);
+  printf("late chunks %zu, peak resident chunks %zu (%zu KB of tiles)\n",
+         late, max_resident, max_resident * TILEMAP_CHUNK_TILES * TILEMAP_CHUNK_TILES / 1024);
+
+  free(times);
+  tilemap_free(t);
+  arena_free(&arena);
+  level_free(level);
+  remove(lvl_file);
+  return 0;
+}
@@ -0,0 +1,402 @@
+#include "bench.h"
+#include "../src/ecs.h"
+#include "../src/game.h"
+#include "../src/level.h"
+#include "../src/scene.h"
+#include "../src/snapshot.h"
+#include "../src/tilemap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Headless regression suite. Generates sparse, dense and huge levels with
+// level_write, then for each one measures level load plus scene init, ticks of
+// scene_update driven by scripted input, and frames rendered into a texture,
+// plus a standalone ECS churn run. Runs on the SDL dummy video driver with the
+// software renderer, from bin/ so assets resolve.
+//
+// Every result goes to stdout as a table and, when a file is given, is
+// appended to it as one JSON object per line, tagged with the commit, so runs
+// of different commits can be compared:
+//
+//   cd bin && ./bench_suite results.jsonl
+//
+// Allocations count malloc, calloc and realloc calls made by the game code
+// while a case runs, the Makefile links the suite with those wrapped. Peak RSS
+// is for the whole process up to the end of the case.
+
+#ifndef BENCH_COMMIT
+  #define BENCH_COMMIT "unknown"
+#endif
+
+typedef struct {
+  const char *name;
+  uint32_t w, h;
+  size_t platforms, coins, crates;
+}
+LevelProfile;
+
+static const LevelProfile profiles[] = {
+  {"sparse", 512,  128,  300,    200,   1000},
+  {"dense",  512,  128,  6000,   5000,  20000},
+  {"huge",   8192, 8192, 200000, 50000, 100000},
+};
+
+static const int   ticks  = 600;
+static const int   frames = 120;
+static const float dt     = 1.0f / 60.0f;
+
+typedef struct {
+  uint64_t ns;
+  size_t   allocs, alloc_bytes;
+}
+Measure;
+
+static FILE *results;
+
+// Allocation counters
+
+static SDL_SpinLock alloc_lock;
+static size_t       alloc_count, alloc_bytes;
+
+#ifdef BENCH_WRAP_ALLOC
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static void
+bench_count_alloc(size_t size)
+{
+  SDL_AtomicLock(&alloc_lock);
+  alloc_count++;
+  alloc_bytes += size;
+  SDL_AtomicUnlock(&alloc_lock);
+}
+
+void *
+__wrap_malloc(size_t size)
+{
+  bench_count_alloc(size);
+  return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+  bench_count_alloc(n * size);
+  return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+  bench_count_alloc(size);
+  return __real_realloc(ptr, size);
+}
+
+#endif
+
+static void
+bench_begin(Measure *m)
+{
+  SDL_AtomicLock(&alloc_lock);
+  m->allocs = alloc_count;
+  m->alloc_bytes = alloc_bytes;
+  SDL_AtomicUnlock(&alloc_lock);
+  m->ns = bench_now_ns();
+}
+
+static void
+bench_end(Measure *m)
+{
+  m->ns = bench_now_ns() - m->ns;
+  SDL_AtomicLock(&alloc_lock);
+  m->allocs = alloc_count - m->allocs;
+  m->alloc_bytes = alloc_bytes - m->alloc_bytes;
+  SDL_AtomicUnlock(&alloc_lock);
+}
+
+// ops are ticks, frames or ECS operations, entities is what each op touched
+static void
+bench_result(const char *name, const char *level, const Measure *m, size_t ops, size_t entities)
+{
+  double secs = m->ns / 1e9;
+  double ops_per_sec = secs > 0 ? ops / secs : 0;
+  double ns_per_entity = ops * entities > 0 ? (double)m->ns / ((double)ops * entities) : 0;
+  size_t rss = bench_peak_rss_kb();
+
+  printf("%-10s %-8s %10zu %10zu %12.1f %12.2f %10.3f %10zu %12zu %10zu\n", name, level, ops, entities,
+         ops_per_sec, ns_per_entity, m->ns / 1e6, m->allocs, m->alloc_bytes, rss);
+
+  if (results != NULL)
+  {
+    fprintf(results, "{\"commit\":\"%s\",\"case\":\"%s\",\"level\":\"%s\",\"ops\":%zu,\"entities\":%zu,"
+            "\"ops_per_sec\":%.3f,\"ns_per_entity\":%.3f,\"ms\":%.3f,\"allocs\":%zu,\"alloc_bytes\":%zu,"
+            "\"peak_rss_kb\":%zu}\n", BENCH_COMMIT, name, level, ops, entities, ops_per_sec, ns_per_entity,
+            m->ns / 1e6, m->allocs, m->alloc_bytes, rss);
+  }
+}
+
+// Level generation
+
+static int
+bench_free_tile(const uint8_t *tiles, uint32_t w, uint32_t x, uint32_t y)
+{
+  return tiles[y * w + x] == 0 && tiles[(y - 1) * w + x] == 0;
+}
+
+static void
+bench_spawn(LevelSpawn *sp, uint32_t type, const uint8_t *tiles, uint32_t w, uint32_t h, uint32_t *seed)
+{
+  uint32_t x, y;
+  do
+  {
+    x = 1 + bench_rand(seed) % (w - 2);
+    y = 1 + bench_rand(seed) % (h - 2);
+  }
+  while (bench_free_tile(tiles, w, x, y) == 0);
+
+  sp->type = type;
+  sp->flags = 0;
+  sp->x = (int32_t)(x * TILE_SIZE + TILE_SIZE / 2);
+  sp->y = (int32_t)(y * TILE_SIZE + TILE_SIZE / 2);
+}
+
+static int
+bench_generate(const LevelProfile *p, const char *file)
+{
+  uint32_t seed = 0x1234567u;
+  size_t num_tiles = (size_t)p->w * p->h;
+  uint8_t *tiles = calloc(num_tiles, 1);
+  size_t num_spawns = 1 + p->coins + p->crates;
+  LevelSpawn *spawns = malloc(num_spawns * sizeof(LevelSpawn));
+  if (tiles == NULL || spawns == NULL)
+  {
+    free(tiles);
+    free(spawns);
+    return -1;
+  }
+
+  // Floor, walls and platforms of 2 to 13 bricks
+  for (uint32_t x = 0; x < p->w; x++)
+  {
+    tiles[(size_t)(p->h - 1) * p->w + x] = LevelElement_Brick;
+  }
+  for (uint32_t y = 0; y < p->h; y++)
+  {
+    tiles[(size_t)y * p->w] = LevelElement_Brick;
+    tiles[(size_t)y * p->w + p->w - 1] = LevelElement_Brick;
+  }
+  for (size_t i = 0; i < p->platforms; i++)
+  {
+    uint32_t x = bench_rand(&seed) % p->w, y = 4 + bench_rand(&seed) % (p->h - 8);
+    uint32_t len = 2 + bench_rand(&seed) % 12;
+    for (uint32_t j = 0; j < len && x + j < p->w; j++)
+    {
+      tiles[(size_t)y * p->w + x + j] = LevelElement_Brick;
+    }
+  }
+
+  // Player in the bottom left corner, the script runs it along the floor
+  spawns[0] = (LevelSpawn){LevelSpawn_Player, 0, 2 * TILE_SIZE, (int32_t)(p->h - 3) * TILE_SIZE};
+  for (size_t i = 0; i < p->coins; i++)
+  {
+    bench_spawn(&spawns[1 + i], LevelSpawn_Coin, tiles, p->w, p->h, &seed);
+  }
+  for (size_t i = 0; i < p->crates; i++)
+  {
+    bench_spawn(&spawns[1 + p->coins + i], LevelSpawn_Crate, tiles, p->w, p->h, &seed);
+  }
+
+  int r = level_write(file, p->w, p->h, tiles, spawns, num_spawns, "name=bench", 1);
+  free(tiles);
+  free(spawns);
+  return r;
+}
+
+// Runs right for most of every 10 seconds and left for the rest, jumping
+// twice a second
+static void
+bench_script(Scene *s, int tick)
+{
+  int phase = tick % 600;
+  scene_input_key(s, SDLK_RIGHT, phase < 450);
+  scene_input_key(s, SDLK_LEFT, phase >= 450);
+  scene_input_key(s, SDLK_UP, tick % 30 < 10);
+}
+
+static size_t
+bench_entities(Scene *s)
+{
+  size_t num, max;
+  ecs_get_entities(s->ecs, &num, &max);
+  return num;
+}
+
+static void
+bench_level(const LevelProfile *p)
+{
+  char file[64];
+  snprintf(file, sizeof(file), "bench_suite_%s.tmp", p->name);
+  if (bench_generate(p, file) != 0)
+  {
+    printf("can't generate level %s\n", p->name);
+    return;
+  }
+
+  // Load: mapping the file, spawning everything and streaming the first chunks
+  Measure m;
+  bench_begin(&m);
+  Level *level = level_load(file);
+  Scene *s = level != NULL ? scene_init(level) : NULL;
+  bench_end(&m);
+  if (s == NULL)
+  {
+    printf("can't load level %s\n", p->name);
+    if (level != NULL)
+    {
+      level_free(level);
+    }
+    remove(file);
+    return;
+  }
+  s->stream_wait = 1;
+  bench_result("load", p->name, &m, 1, bench_entities(s));
+
+  // Physics and everything else scene_update does
+  size_t entity_ticks = 0;
+  bench_begin(&m);
+  for (int t = 0; t < ticks; t++)
+  {
+    bench_script(s, t);
+    scene_update(s, dt, t);
+    entity_ticks += bench_entities(s);
+  }
+  bench_end(&m);
+  bench_result("update", p->name, &m, ticks, entity_ticks / ticks);
+
+  // Snapshot and draw into a view sized target, ticks in between aren't counted
+  int vw, vh;
+  game_get_view_size(&vw, &vh);
+  SDL_Texture *target = game_create_target(vw, vh);
+  SnapshotBuffer snapshots;
+  snapshot_buffer_init(&snapshots);
+  size_t sprites = 0;
+  Measure render = {0};
+  for (int f = 0; f < frames; f++)
+  {
+    bench_script(s, ticks + f);
+    scene_update(s, dt, ticks + f);
+
+    bench_begin(&m);
+    RenderSnapshot *snap = snapshot_begin_write(&snapshots);
+    scene_snapshot(s, snap);
+    game_begin_frame();
+    game_begin_target(target);
+    scene_render(s, snap, 0.5f);
+    game_end_target();
+    game_end_frame();
+    bench_end(&m);
+
+    render.ns += m.ns;
+    render.allocs += m.allocs;
+    render.alloc_bytes += m.alloc_bytes;
+    sprites += snap->num_sprites;
+  }
+  bench_result("render", p->name, &render, frames, sprites / frames);
+  snapshot_buffer_free(&snapshots);
+  SDL_DestroyTexture(target);
+
+  printf("%-10s %-8s coins collected %d\n", "", p->name, s->coins);
+  scene_free(s);
+  level_free(level);
+  remove(file);
+}
+
+// Spawning and despawning bodies with the components of a scene crate, the
+// way gameplay churns entities
+static void
+bench_churn()
+{
+  enum { C_Pos, C_Vel, C_Size, C_Spr, C_Count };
+  size_t cs[C_Count] = {8, 8, 16, 16};
+  const size_t live = 100000, churn = 1000000;
+
+  Measure m;
+  bench_begin(&m);
+  ECS *ecs = ecs_init(C_Count, cs, live);
+  EntityId *ids = malloc(live * sizeof(EntityId));
+  uint32_t seed = 0x1234567u;
+  for (size_t i = 0; i < live + churn; i++)
+  {
+    size_t k = i < live ? i : bench_rand(&seed) % live;
+    if (i >= live)
+    {
+      ecs_destroy_entity(ecs, ids[k]);
+    }
+    ids[k] = ecs_create_entity(ecs);
+    for (size_t c = 0; c < C_Count; c++)
+    {
+      ecs_add_component(ecs, ids[k], c);
+    }
+  }
+  bench_end(&m);
+  bench_result("ecs_churn", "-", &m, live + churn, 1);
+
+  free(ids);
+  ecs_free(ecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+  SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+  SDL_setenv("SDL_RENDER_DRIVER", "software", 1);
+
+  if (argc > 1)
+  {
+    results = fopen(argv[1], "a");
+    if (results == NULL)
+    {
+      printf("can't open %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  // The assets scenes look up
+  TextureSource t_src[] = {
+    {"ingame", "gfx/ingame.png"},
+  };
+  SpriteSource s_src[] = {
+    {"brick_c", "ingame", {16, 16, 16, 16}},
+    {"brick_l", "ingame", {0,  16, 16, 16}},
+    {"brick_r", "ingame", {32, 16, 16, 16}},
+    {"coin",    "ingame", {48, 0,  16, 16}},
+    {"plr_s",   "ingame", {0,  0,  16, 16}},
+  };
+  FontSource f_src[] = {
+    {"font0", "font/noto_serif.ttf", 28, 1},
+  };
+
+  game_init_system(640, 480, 320, 240, "bench");
+  game_init_assets(t_src, sizeof(t_src), s_src, sizeof(s_src), f_src, sizeof(f_src), NULL, 0);
+
+  printf("commit %s\n", BENCH_COMMIT);
+  printf("%-10s %-8s %10s %10s %12s %12s %10s %10s %12s %10s\n", "case", "level", "ops", "entities",
+         "ops/sec", "ns/entity", "ms", "allocs", "alloc bytes", "peak kb");
+
+  bench_churn();
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+  {
+    bench_level(&profiles[i]);
+  }
+
+  if (results != NULL)
+  {
+    fclose(results);
+  }
+  game_free();
+  return 0;
+}
@@ -0,0 +1,188 @@
+#include "bench.h"
+#include "../src/broad.h"
+#include "../src/collide.h"
+#include "../src/simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CPU time spent simulating one second of gameplay at different tick rates.
+// A tick does what the scene systems do for every body: store the previous
+// position, apply gravity, sweep against the tile grid and rebuild the
+// broadphase. The jitter columns show why the rate can drop: a thrown body
+// drawn at 144 Hz moves evenly with interpolation at any rate, and stutters
+// without it.
+
+typedef struct {
+  float x, y;
+}
+Vec2;
+
+typedef struct {
+  size_t n;
+  Vec2 *pos, *prev, *vel, *acc;
+}
+World;
+
+static const size_t bodies  = 10000;
+static const size_t grid_w  = 1024;
+static const size_t grid_h  = 1024;
+static const float  tile    = 16.0f;
+static const float  body_w  = 10.0f;
+static const float  body_h  = 14.0f;
+static const float  gravity = 980.0f;
+
+static void
+bench_world(World *w, SolidGrid *g, uint32_t *seed)
+{
+  for (size_t x = 0; x < grid_w; x++)
+  {
+    solid_set(g, x, grid_h - 1, 1);
+  }
+  for (int i = 0; i < 20000; i++)
+  {
+    int x = bench_rand(seed) % grid_w, y = bench_rand(seed) % grid_h;
+    int len = 2 + bench_rand(seed) % 12;
+    for (int j = 0; j < len; j++)
+    {
+      solid_set(g, x + j, y, 1);
+    }
+  }
+
+  w->n = bodies;
+  w->pos = malloc(bodies * sizeof(Vec2));
+  w->prev = malloc(bodies * sizeof(Vec2));
+  w->vel = malloc(bodies * sizeof(Vec2));
+  w->acc = malloc(bodies * sizeof(Vec2));
+  for (size_t i = 0; i < bodies; i++)
+  {
+    w->pos[i].x = (float)(bench_rand(seed) % ((grid_w - 2) * (uint32_t)tile)) + tile;
+    w->pos[i].y = (float)(bench_rand(seed) % ((grid_h - 2) * (uint32_t)tile)) + tile;
+    w->vel[i].x = (float)(bench_rand(seed) % 321) - 160.0f;
+    w->vel[i].y = 0;
+    w->acc[i].x = 0;
+    w->acc[i].y = gravity;
+  }
+}
+
+static void
+bench_tick(World *w, SolidGrid *g, Broadphase *bp, float dt)
+{
+  memcpy(w->prev, w->pos, w->n * sizeof(Vec2));
+  simd_madd((float *)w->vel, (const float *)w->acc, w->n * 2, dt);
+
+  broad_clear(bp);
+  for (size_t i = 0; i < w->n; i++)
+  {
+    float bx = w->pos[i].x - body_w / 2, by = w->pos[i].y - body_h / 2;
+    uint32_t hits = collide_sweep(g, &bx, &by, body_w, body_h, w->vel[i].x * dt, w->vel[i].y * dt);
+    w->pos[i].x = bx + body_w / 2;
+    w->pos[i].y = by + body_h / 2;
+    if (hits & (COLLIDE_LEFT | COLLIDE_RIGHT))
+    {
+      w->vel[i].x = -w->vel[i].x;
+    }
+    if (hits & (COLLIDE_UP | COLLIDE_DOWN))
+    {
+      w->vel[i].y = 0;
+    }
+    broad_add(bp, (EntityId)i + 1, bx, by, bx + body_w, by + body_h);
+  }
+  broad_build(bp);
+
+  BroadPair *pairs;
+  broad_pairs(bp, &pairs);
+}
+
+// Largest change in per frame motion of a thrown body drawn at 144 Hz display
+// frames over one second, with and without interpolation. Smooth motion only
+// changes by gravity, about 0.05 px per frame.
+static void
+bench_jitter(int rate, float *interpolated, float *snapped)
+{
+  float dt = 1.0f / rate;
+  Vec2 pos = {0, 0}, prev = pos, vel = {150, -400}, acc = {0, gravity};
+  Vec2 drawn[2][144];
+
+  int tick = 0;
+  for (int f = 0; f < 144; f++)
+  {
+    // Ticks due by the frame time, like the game_run accumulator
+    double t = (double)f / 144;
+    while ((tick + 1) * (double)dt <= t)
+    {
+      prev = pos;
+      simd_madd(&vel.x, &acc.x, 2, dt);
+      simd_madd(&pos.x, &vel.x, 2, dt);
+      tick++;
+    }
+    float alpha = (float)((t - tick * (double)dt) / dt);
+    drawn[0][f].x = prev.x + (pos.x - prev.x) * alpha;
+    drawn[0][f].y = prev.y + (pos.y - prev.y) * alpha;
+    drawn[1][f] = pos;
+  }
+
+  // Skipped until there are two ticks to blend between, the body is at rest
+  // before the first one
+  int first = (int)ceil(2 * dt * 144) + 2;
+  float worst[2] = {0, 0};
+  for (int k = 0; k < 2; k++)
+  {
+    for (int f = first; f < 144; f++)
+    {
+      float ax = drawn[k][f].x - 2 * drawn[k][f - 1].x + drawn[k][f - 2].x;
+      float ay = drawn[k][f].y - 2 * drawn[k][f - 1].y + drawn[k][f - 2].y;
+      float d = hypotf(ax, ay);
+      worst[k] = d > worst[k] ? d : worst[k];
+    }
+  }
+  *interpolated = worst[0];
+  *snapped = worst[1];
+}
+
+int
+main(int argc, char *argv[])
+{
+  simd_init();
+
+  printf("%zu bodies, one second of gameplay per rate\n", bodies);
+  printf("%10s %16s %14s %16s %16s\n", "tick rate", "cpu ms/second", "cpu ms/tick",
+         "jitter px", "no interp px");
+
+  int rates[] = {300, 120, 60, 30};
+  for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+  {
+    uint32_t seed = 0x1234567u;
+    SolidGrid *g = solid_init(grid_w, grid_h, tile);
+    Broadphase *bp = broad_init(64.0f);
+    World w;
+    bench_world(&w, g, &seed);
+
+    // One warm up second, then one measured second of game time
+    float dt = 1.0f / rates[r];
+    for (int t = 0; t < rates[r]; t++)
+    {
+      bench_tick(&w, g, bp, dt);
+    }
+    uint64_t t0 = bench_cpu_ns();
+    for (int t = 0; t < rates[r]; t++)
+    {
+      bench_tick(&w, g, bp, dt);
+    }
+    uint64_t ns = bench_cpu_ns() - t0;
+
+    float jitter, snapped;
+    bench_jitter(rates[r], &jitter, &snapped);
+    printf("%10d %16.2f %14.3f %16.3f %16.3f\n", rates[r], ns / 1e6, ns / 1e6 / rates[r], jitter, snapped);
+
+    free(w.pos);
+    free(w.prev);
+    free(w.vel);
+    free(w.acc);
+    broad_free(bp);
+    solid_free(g);
+  }
+
+  return 0;
+}
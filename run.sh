@@ -1,6 +1,6 @@
 #!/bin/sh
 
-make all
+make all assets
 cd bin
 ./game
 cd ..
@@ -0,0 +1,292 @@
+#include "broad.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t init_bodies  = 256;
+static const size_t min_buckets  = 64;
+
+static int      broad_cell(const Broadphase *b, float v);
+static uint32_t broad_bucket(const Broadphase *b, int cx, int cy);
+static int      broad_overlap(const BroadBox *a, const BroadBox *c);
+static void     *broad_grow(void *ptr, size_t *max, size_t need, size_t size);
+static void     broad_result(Broadphase *b, EntityId e);
+
+Broadphase *
+broad_init(float cell_size)
+{
+  Broadphase *b = calloc(1, sizeof(Broadphase));
+  DEBUG_ASSERT(b, "Can't allocate space for broadphase");
+
+  b->cell_size = cell_size;
+  b->max_bodies = init_bodies;
+  b->ids = malloc(b->max_bodies * sizeof(EntityId));
+  b->boxes = malloc(b->max_bodies * sizeof(BroadBox));
+  DEBUG_ASSERT(b->ids && b->boxes, "Can't allocate space for broadphase bodies");
+
+  return b;
+}
+
+void
+broad_free(Broadphase *b)
+{
+  free(b->ids);
+  free(b->boxes);
+  free(b->refs);
+  free(b->starts);
+  free(b->pairs);
+  free(b->results);
+  free(b);
+}
+
+void
+broad_clear(Broadphase *b)
+{
+  b->num_bodies = 0;
+  b->num_refs = 0;
+  b->num_buckets = 0;
+}
+
+void
+broad_add(Broadphase *b, EntityId e, float x0, float y0, float x1, float y1)
+{
+  if (b->num_bodies >= b->max_bodies)
+  {
+    size_t max = b->max_bodies;
+    b->ids = broad_grow(b->ids, &max, b->num_bodies + 1, sizeof(EntityId));
+    max = b->max_bodies;
+    b->boxes = broad_grow(b->boxes, &max, b->num_bodies + 1, sizeof(BroadBox));
+    b->max_bodies = max;
+  }
+
+  b->ids[b->num_bodies] = e;
+  b->boxes[b->num_bodies] = (BroadBox){x0, y0, x1, y1};
+  b->num_bodies++;
+}
+
+void
+broad_build(Broadphase *b)
+{
+  // About one body per bucket, distinct cells sharing a bucket are told apart
+  // by the cell stored in each reference
+  size_t num_buckets = min_buckets;
+  while (num_buckets < b->num_bodies)
+  {
+    num_buckets *= 2;
+  }
+  if (num_buckets + 1 > b->max_buckets)
+  {
+    b->starts = broad_grow(b->starts, &b->max_buckets, num_buckets + 1, sizeof(uint32_t));
+  }
+  b->num_buckets = num_buckets;
+  memset(b->starts, 0, (num_buckets + 1) * sizeof(uint32_t));
+
+  // Counting sort straight from the bodies, bodies bigger than a cell are
+  // referenced from every cell they touch
+  size_t num_refs = 0;
+  for (size_t i = 0; i < b->num_bodies; i++)
+  {
+    const BroadBox *box = &b->boxes[i];
+    int cx0 = broad_cell(b, box->x0), cx1 = broad_cell(b, box->x1);
+    int cy0 = broad_cell(b, box->y0), cy1 = broad_cell(b, box->y1);
+    for (int cy = cy0; cy <= cy1; cy++)
+    {
+      for (int cx = cx0; cx <= cx1; cx++)
+      {
+        b->starts[broad_bucket(b, cx, cy) + 1]++;
+        num_refs++;
+      }
+    }
+  }
+
+  if (num_refs > b->max_refs)
+  {
+    b->refs = broad_grow(b->refs, &b->max_refs, num_refs, sizeof(BroadRef));
+  }
+  b->num_refs = num_refs;
+
+  for (size_t i = 0; i < num_buckets; i++)
+  {
+    b->starts[i + 1] += b->starts[i];
+  }
+  for (size_t i = 0; i < b->num_bodies; i++)
+  {
+    const BroadBox *box = &b->boxes[i];
+    int cx0 = broad_cell(b, box->x0), cx1 = broad_cell(b, box->x1);
+    int cy0 = broad_cell(b, box->y0), cy1 = broad_cell(b, box->y1);
+    for (int cy = cy0; cy <= cy1; cy++)
+    {
+      for (int cx = cx0; cx <= cx1; cx++)
+      {
+        b->refs[b->starts[broad_bucket(b, cx, cy)]++] = (BroadRef){(uint32_t)i, cx, cy, *box};
+      }
+    }
+  }
+  // Placing advanced every start to the next bucket's, shift them back
+  memmove(b->starts + 1, b->starts, num_buckets * sizeof(uint32_t));
+  b->starts[0] = 0;
+}
+
+size_t
+broad_pairs(Broadphase *b, BroadPair **out)
+{
+  b->num_pairs = 0;
+  for (size_t k = 0; k < b->num_buckets; k++)
+  {
+    for (uint32_t i = b->starts[k]; i < b->starts[k + 1]; i++)
+    {
+      const BroadRef *ri = &b->refs[i];
+      for (uint32_t j = i + 1; j < b->starts[k + 1]; j++)
+      {
+        const BroadRef *rj = &b->refs[j];
+        const BroadBox *a = &ri->box, *c = &rj->box;
+        if (((ri->cx == rj->cx) & (ri->cy == rj->cy) & broad_overlap(a, c)) == 0)
+        {
+          continue;
+        }
+
+        // Bodies sharing several cells are paired in the cell holding the top
+        // left corner of their overlap only
+        if (broad_cell(b, a->x0 > c->x0 ? a->x0 : c->x0) != ri->cx ||
+            broad_cell(b, a->y0 > c->y0 ? a->y0 : c->y0) != ri->cy)
+        {
+          continue;
+        }
+
+        if (b->num_pairs >= b->max_pairs)
+        {
+          b->pairs = broad_grow(b->pairs, &b->max_pairs, b->num_pairs + 1, sizeof(BroadPair));
+        }
+        uint32_t lo = ri->body < rj->body ? ri->body : rj->body;
+        uint32_t hi = ri->body < rj->body ? rj->body : ri->body;
+        b->pairs[b->num_pairs++] = (BroadPair){b->ids[lo], b->ids[hi]};
+      }
+    }
+  }
+
+  *out = b->pairs;
+  return b->num_pairs;
+}
+
+size_t
+broad_query(Broadphase *b, float x0, float y0, float x1, float y1, EntityId **out)
+{
+  BroadBox q = {x0, y0, x1, y1};
+  int cx0 = broad_cell(b, x0), cx1 = broad_cell(b, x1);
+  int cy0 = broad_cell(b, y0), cy1 = broad_cell(b, y1);
+
+  b->num_results = 0;
+  if ((size_t)(cx1 - cx0 + 1) * (size_t)(cy1 - cy0 + 1) > b->num_refs)
+  {
+    // More cells than references, checking every body is cheaper
+    for (size_t i = 0; i < b->num_bodies; i++)
+    {
+      if (broad_overlap(&q, &b->boxes[i]))
+      {
+        broad_result(b, b->ids[i]);
+      }
+    }
+  }
+  else
+  {
+    for (int cy = cy0; cy <= cy1; cy++)
+    {
+      for (int cx = cx0; cx <= cx1; cx++)
+      {
+        uint32_t k = broad_bucket(b, cx, cy);
+        for (uint32_t i = b->starts[k]; i < b->starts[k + 1]; i++)
+        {
+          const BroadRef *r = &b->refs[i];
+          const BroadBox *box = &r->box;
+          if (r->cx != cx || r->cy != cy || broad_overlap(&q, box) == 0)
+          {
+            continue;
+          }
+          // Same rule as pairs, a body spanning several cells is reported once
+          if (broad_cell(b, x0 > box->x0 ? x0 : box->x0) == cx &&
+              broad_cell(b, y0 > box->y0 ? y0 : box->y0) == cy)
+          {
+            broad_result(b, b->ids[r->body]);
+          }
+        }
+      }
+    }
+  }
+
+  *out = b->results;
+  return b->num_results;
+}
+
+size_t
+broad_point(Broadphase *b, float x, float y, EntityId **out)
+{
+  int cx = broad_cell(b, x), cy = broad_cell(b, y);
+
+  b->num_results = 0;
+  if (b->num_buckets > 0)
+  {
+    uint32_t k = broad_bucket(b, cx, cy);
+    for (uint32_t i = b->starts[k]; i < b->starts[k + 1]; i++)
+    {
+      const BroadRef *r = &b->refs[i];
+      const BroadBox *box = &r->box;
+      if (r->cx == cx && r->cy == cy &&
+          x >= box->x0 && x < box->x1 && y >= box->y0 && y < box->y1)
+      {
+        broad_result(b, b->ids[r->body]);
+      }
+    }
+  }
+
+  *out = b->results;
+  return b->num_results;
+}
+
+static int
+broad_cell(const Broadphase *b, float v)
+{
+  // Not floorf, which is a libm call on plain x86-64 builds
+  float f = v / b->cell_size;
+  int i = (int)f;
+  return i - (f < i);
+}
+
+static uint32_t
+broad_bucket(const Broadphase *b, int cx, int cy)
+{
+  uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+  return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (uint32_t)(b->num_buckets - 1);
+}
+
+static int
+broad_overlap(const BroadBox *a, const BroadBox *c)
+{
+  // No early out, the branches are as likely to go either way
+  return (a->x0 < c->x1) & (c->x0 < a->x1) & (a->y0 < c->y1) & (c->y0 < a->y1);
+}
+
+static void *
+broad_grow(void *ptr, size_t *max, size_t need, size_t size)
+{
+  size_t capacity = *max ? *max : init_bodies;
+  while (capacity < need)
+  {
+    capacity *= 2;
+  }
+
+  void *new_ptr = realloc(ptr, capacity * size);
+  DEBUG_ASSERT(new_ptr, "Can't reallocate space for broadphase");
+  *max = capacity;
+  return new_ptr;
+}
+
+static void
+broad_result(Broadphase *b, EntityId e)
+{
+  if (b->num_results >= b->max_results)
+  {
+    b->results = broad_grow(b->results, &b->max_results, b->num_results + 1, sizeof(EntityId));
+  }
+  b->results[b->num_results++] = e;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ecs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Entity vs entity broadphase, rebuilt every tick. Bodies are added as boxes,
+// broad_build sorts their cell references into hashed buckets with a counting
+// sort, then pairs and region queries only look at bodies sharing a cell.
+// Arrays only grow to the largest tick seen, so a steady scene allocates
+// nothing per tick.
+typedef struct {
+  float x0, y0, x1, y1;
+}
+BroadBox;
+
+typedef struct {
+  EntityId a, b;
+}
+BroadPair;
+
+// The box is copied in so pairs and queries only walk the sorted references
+typedef struct {
+  uint32_t body;
+  int32_t  cx, cy;
+  BroadBox box;
+}
+BroadRef;
+
+typedef struct {
+  float cell_size;
+
+  size_t   num_bodies, max_bodies;
+  EntityId *ids;
+  BroadBox *boxes;
+
+  // Cell references grouped by bucket, bucket i holds refs [starts[i], starts[i + 1])
+  size_t   num_refs, max_refs;
+  BroadRef *refs;
+  size_t   num_buckets, max_buckets;
+  uint32_t *starts;
+
+  size_t    num_pairs, max_pairs;
+  BroadPair *pairs;
+
+  size_t   num_results, max_results;
+  EntityId *results;
+}
+Broadphase;
+
+Broadphase *broad_init(float cell_size);
+void broad_free(Broadphase *b);
+
+// Forgets every body, call before adding the bodies of a new tick
+void broad_clear(Broadphase *b);
+void broad_add(Broadphase *b, EntityId e, float x0, float y0, float x1, float y1);
+void broad_build(Broadphase *b);
+
+// Each overlapping pair once, a is the body added first. The arrays are owned
+// by the broadphase and valid until the next call of the same function.
+size_t broad_pairs(Broadphase *b, BroadPair **out);
+size_t broad_query(Broadphase *b, float x0, float y0, float x1, float y1, EntityId **out);
+size_t broad_point(Broadphase *b, float x, float y, EntityId **out);
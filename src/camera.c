@@ -0,0 +1,65 @@
+#include "camera.h"
+
+#include <math.h>
+
+static float camera_clamp(float v, float view, float bound);
+
+void
+camera_init(Camera *c, float x, float y, float zoom)
+{
+  c->x = x;
+  c->y = y;
+  c->prev_x = x;
+  c->prev_y = y;
+  c->zoom = zoom;
+  c->follow = 8.0f;
+  c->bound_w = 0;
+  c->bound_h = 0;
+  c->target = ECS_NULL_ENTITY;
+}
+
+void
+camera_follow(Camera *c, float tx, float ty, float dt)
+{
+  // Framerate independent easing, the same fraction of the distance per second
+  float t = 1.0f - expf(-c->follow * dt);
+  c->prev_x = c->x;
+  c->prev_y = c->y;
+  c->x += (tx - c->x) * t;
+  c->y += (ty - c->y) * t;
+}
+
+void
+camera_blend(const Camera *c, float alpha, Camera *out)
+{
+  *out = *c;
+  out->x = c->prev_x + (c->x - c->prev_x) * alpha;
+  out->y = c->prev_y + (c->y - c->prev_y) * alpha;
+}
+
+void
+camera_get_view(const Camera *c, int vw, int vh, float *x, float *y, float *w, float *h)
+{
+  *w = vw / c->zoom;
+  *h = vh / c->zoom;
+  *x = camera_clamp(c->x - *w / 2, *w, c->bound_w);
+  *y = camera_clamp(c->y - *h / 2, *h, c->bound_h);
+
+  // Snap to whole screen pixels so baked chunks don't shimmer while scrolling
+  *x = floorf(*x * c->zoom) / c->zoom;
+  *y = floorf(*y * c->zoom) / c->zoom;
+}
+
+static float
+camera_clamp(float v, float view, float bound)
+{
+  if (bound <= 0)
+  {
+    return v;
+  }
+  if (view >= bound)
+  {
+    return (bound - view) / 2;
+  }
+  return v < 0 ? 0 : (v + view > bound ? bound - view : v);
+}
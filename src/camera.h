@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ecs.h"
+
+// View into the world, x and y are the center in world pixels. When a target
+// is set the camera eases towards it, follow is the rate per second. A non
+// zero bound keeps the view inside [0, bound_w] x [0, bound_h]. prev_x and
+// prev_y are where the camera was before the last follow step.
+typedef struct {
+  float x, y, zoom;
+  float prev_x, prev_y;
+  float follow;
+  float bound_w, bound_h;
+  EntityId target;
+}
+Camera;
+
+void camera_init(Camera *c, float x, float y, float zoom);
+void camera_follow(Camera *c, float tx, float ty, float dt);
+// Copy of the camera placed alpha of the way from the previous position
+void camera_blend(const Camera *c, float alpha, Camera *out);
+
+// Top left and size of the visible world rectangle for a view of vw x vh pixels
+void camera_get_view(const Camera *c, int vw, int vh, float *x, float *y, float *w, float *h);
@@ -0,0 +1,201 @@
+#include "collide.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// In tiles, boxes closer than this to a tile only touch it. Has to stay above
+// the float resolution of positions far from the origin.
+#define COLLIDE_EPS 0.01
+
+// Each step crosses one tile boundary, motion left after this many is dropped
+#define COLLIDE_MAX_STEPS 1024
+
+static int solid_column(const SolidGrid *g, int x, int y0, int y1);
+
+SolidGrid *
+solid_init(size_t w, size_t h, float tile_size)
+{
+  SolidGrid *g = calloc(1, sizeof(SolidGrid));
+  DEBUG_ASSERT(g, "Can't allocate space for solid grid");
+
+  g->w = w;
+  g->h = h;
+  g->tile_size = tile_size;
+  g->row_words = (w + 63) / 64;
+  g->bits = calloc(g->row_words * h, sizeof(uint64_t));
+  DEBUG_ASSERT(g->bits, "Can't allocate space for solid bits");
+
+  return g;
+}
+
+void
+solid_free(SolidGrid *g)
+{
+  free(g->bits);
+  free(g);
+}
+
+void
+solid_set(SolidGrid *g, int x, int y, int solid)
+{
+  if (x < 0 || y < 0 || (size_t)x >= g->w || (size_t)y >= g->h)
+  {
+    return;
+  }
+
+  uint64_t *word = &g->bits[y * g->row_words + x / 64];
+  uint64_t bit = 1ull << (x % 64);
+  *word = solid ? (*word | bit) : (*word & ~bit);
+}
+
+int
+solid_get(const SolidGrid *g, int x, int y)
+{
+  if (x < 0 || y < 0 || (size_t)x >= g->w || (size_t)y >= g->h)
+  {
+    return 1;
+  }
+  return (g->bits[y * g->row_words + x / 64] >> (x % 64)) & 1;
+}
+
+int
+solid_span(const SolidGrid *g, int x0, int x1, int y)
+{
+  if (x0 < 0 || y < 0 || (size_t)x1 >= g->w || (size_t)y >= g->h)
+  {
+    return 1;
+  }
+
+  const uint64_t *row = &g->bits[y * g->row_words];
+  size_t w0 = x0 / 64, w1 = x1 / 64;
+  uint64_t first = ~0ull << (x0 % 64);
+  uint64_t last = ~0ull >> (63 - x1 % 64);
+
+  if (w0 == w1)
+  {
+    return (row[w0] & first & last) != 0;
+  }
+  if (row[w0] & first)
+  {
+    return 1;
+  }
+  for (size_t i = w0 + 1; i < w1; i++)
+  {
+    if (row[i])
+    {
+      return 1;
+    }
+  }
+  return (row[w1] & last) != 0;
+}
+
+uint32_t
+collide_sweep(const SolidGrid *g, float *px, float *py, float w, float h, float dx, float dy)
+{
+  // Tile units and doubles, boundaries are hit exactly even far from the origin
+  double ts = g->tile_size;
+  double x = *px / ts, y = *py / ts, bw = w / ts, bh = h / ts;
+  double mx = dx / ts, my = dy / ts;
+  uint32_t hits = 0;
+
+  // Last column and row the leading edges overlap, advanced as boundaries are crossed
+  int ex = mx > 0 ? (int)ceil(x + bw - COLLIDE_EPS) - 1 : (int)floor(x + COLLIDE_EPS);
+  int ey = my > 0 ? (int)ceil(y + bh - COLLIDE_EPS) - 1 : (int)floor(y + COLLIDE_EPS);
+
+  // Fraction of the motion still to do
+  double rem = 1;
+  for (int step = 0; step < COLLIDE_MAX_STEPS && rem > 0 && (mx != 0 || my != 0); step++)
+  {
+    double tx = INFINITY, ty = INFINITY;
+    if (mx != 0)
+    {
+      tx = mx > 0 ? (ex + 1 - (x + bw)) / mx : (ex - x) / mx;
+    }
+    if (my != 0)
+    {
+      ty = my > 0 ? (ey + 1 - (y + bh)) / my : (ey - y) / my;
+    }
+
+    double t = tx < ty ? tx : ty;
+    if (t >= rem)
+    {
+      x += mx * rem;
+      y += my * rem;
+      break;
+    }
+    t = t < 0 ? 0 : t;
+    x += mx * t;
+    y += my * t;
+    rem -= t;
+
+    int cross_x = tx <= t, cross_y = ty <= t;
+    if (cross_x)
+    {
+      int col = mx > 0 ? ex + 1 : ex - 1;
+      int r0 = (int)floor(y + COLLIDE_EPS), r1 = (int)ceil(y + bh - COLLIDE_EPS) - 1;
+      // The leading row is the one last entered, not what rounding says
+      if (my > 0)
+      {
+        r1 = ey;
+      }
+      else if (my < 0)
+      {
+        r0 = ey;
+      }
+      if (solid_column(g, col, r0, r1))
+      {
+        hits |= mx > 0 ? COLLIDE_RIGHT : COLLIDE_LEFT;
+        x = mx > 0 ? ex + 1 - bw : ex;
+        mx = 0;
+      }
+      else
+      {
+        ex = col;
+      }
+    }
+    if (cross_y)
+    {
+      int row = my > 0 ? ey + 1 : ey - 1;
+      int c0 = (int)floor(x + COLLIDE_EPS), c1 = (int)ceil(x + bw - COLLIDE_EPS) - 1;
+      if (mx > 0 && cross_x == 0)
+      {
+        c1 = ex;
+      }
+      else if (mx < 0 && cross_x == 0)
+      {
+        c0 = ex;
+      }
+
+      // Crossing both at once also enters the diagonal tile, which neither span covers
+      int corner = cross_x && mx != 0 && solid_get(g, ex, row);
+      if (corner || solid_span(g, c0, c1, row))
+      {
+        hits |= my > 0 ? COLLIDE_DOWN : COLLIDE_UP;
+        y = my > 0 ? ey + 1 - bh : ey;
+        my = 0;
+      }
+      else
+      {
+        ey = row;
+      }
+    }
+  }
+
+  *px = (float)(x * ts);
+  *py = (float)(y * ts);
+  return hits;
+}
+
+static int
+solid_column(const SolidGrid *g, int x, int y0, int y1)
+{
+  for (int y = y0; y <= y1; y++)
+  {
+    if (solid_get(g, x, y))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Contact flags from collide_sweep, the sides of the box that hit something
+#define COLLIDE_LEFT  (1u << 0)
+#define COLLIDE_RIGHT (1u << 1)
+#define COLLIDE_UP    (1u << 2)
+#define COLLIDE_DOWN  (1u << 3)
+
+// One bit per tile, set for solid tiles. Rows are padded to whole 64 bit words
+// so a horizontal span is tested 64 tiles at a time. Everything outside the
+// grid counts as solid.
+typedef struct {
+  size_t w, h;
+  size_t row_words;
+  float tile_size;
+  uint64_t *bits;
+}
+SolidGrid;
+
+SolidGrid *solid_init(size_t w, size_t h, float tile_size);
+void solid_free(SolidGrid *g);
+
+void solid_set(SolidGrid *g, int x, int y, int solid);
+int  solid_get(const SolidGrid *g, int x, int y);
+// Any solid tile in columns [x0, x1] of row y
+int  solid_span(const SolidGrid *g, int x0, int x1, int y);
+
+// Moves the box with top left (x, y) and size w x h by (dx, dy), all in world
+// pixels, stopping each axis at the first solid tile along the way. Crossing
+// tile boundaries in order of time makes fast boxes unable to tunnel, and the
+// free axis keeps moving after the other one hits. Returns COLLIDE_* flags.
+uint32_t collide_sweep(const SolidGrid *g, float *x, float *y, float w, float h, float dx, float dy);
@@ -5,31 +5,134 @@
 #include <stdint.h>
 #include <string.h>
 
-static const size_t init_entities = 32;
+static const size_t init_entities   = 32;
+static const size_t init_rows       = 16;
+static const size_t init_archetypes = 8;
+static const uint32_t free_end      = UINT32_MAX;
+static const uint32_t no_edge       = UINT32_MAX;
+static const size_t init_snapshot   = 4096;
+
+// Snapshot archetype sections are padded to a multiple of this many rows, so
+// they only move when an archetype crosses a multiple, and deltas are
+// computed in blocks of this many bytes
+static const size_t snapshot_rows  = 64;
+static const size_t snapshot_block = 64;
+
+typedef enum {
+  CMD_Create,
+  CMD_Destroy,
+  CMD_Add,
+  CMD_Remove,
+}
+CommandType;
+
+// Payload follows the header, padded to the arena's 16 byte alignment so
+// commands stay back to back
+typedef struct {
+  uint32_t type, component, size;
+  EntityId e;
+}
+Command;
+
+typedef struct {
+  size_t end;
+  int created, destroyed;
+  Signature signature;
+}
+CommandRun;
+
+// Snapshot layout, every section 8 byte aligned: the header, generations and
+// next_free of max_entities slots, then per archetype in index order its
+// header, entities and the columns of its components in component order.
+// Padding rows are zero so equal states give equal bytes.
+typedef struct {
+  uint64_t num_components, num_entities, max_entities, num_archetypes;
+  uint32_t free_head, free_tail;
+  uint64_t component_sizes[ECS_MAX_COMPONENTS];
+}
+SnapshotHeader;
+
+typedef struct {
+  Signature signature;
+  uint64_t count;
+}
+SnapshotArchetype;
+
+// Delta layout: the header, then runs of changed blocks, each a SnapshotRun
+// followed by count blocks of snapshot_block bytes
+typedef struct {
+  uint64_t size, base_size;
+}
+SnapshotDelta;
+
+typedef struct {
+  uint32_t first, count;
+}
+SnapshotRun;
+
+static void     ecs_link_free(ECS *ecs, size_t first, size_t last);
+static void     ecs_grow_entities(ECS *ecs, size_t capacity);
+static void     *ecs_reserve_table(VMem *v, size_t size);
+static EntityId ecs_reserve_slot(ECS *ecs);
+static void     ecs_release_slot(ECS *ecs, uint32_t i);
+static uint32_t ecs_find_archetype(ECS *ecs, const Signature *sig);
+static void     ecs_move_entity(ECS *ecs, uint32_t i, uint32_t dest);
+static void     *ecs_cmd_push(ECSCommandBuffer *cb, CommandType type, EntityId e, size_t c, size_t size);
+static size_t   ecs_cmd_size(size_t payload);
+static void     ecs_cmd_run(ECSCommandBuffer *cb, size_t offset, CommandRun *run);
+static uint32_t ecs_cmd_archetype(ECSCommandBuffer *cb, const Signature *sig);
+static size_t   ecs_snapshot_check(ECS *ecs, const ECSSnapshot *snap);
+static size_t   snapshot_archetype_size(ECS *ecs, const Signature *sig, size_t count);
+static void     snapshot_resize(ECSSnapshot *snap, size_t size);
+static uint8_t  *snapshot_put(uint8_t *p, const void *src, size_t used, size_t total);
+static const uint8_t *snapshot_get(const uint8_t *p, void *dst, size_t used, size_t total);
+static void     archetype_free(Archetype *a);
+static void     archetype_grow(ECS *ecs, Archetype *a, size_t capacity);
+static uint32_t archetype_push(ECS *ecs, Archetype *a, EntityId e);
+static void     archetype_remove_row(ECS *ecs, Archetype *a, uint32_t row);
 
 ECS *
-ecs_init(size_t num_c, size_t *size_c)
+ecs_init(size_t num_c, size_t *size_c, size_t max_entities)
 {
   ECS *ecs = malloc(sizeof(ECS));
 
   DEBUG_TRACE("ECS init begin");
-  DEBUG_ASSERT(num_c < sizeof(Entity) * 8, "Too many components to init");
+  DEBUG_ASSERT(num_c <= ECS_MAX_COMPONENTS, "Too many components to init, raise ECS_SIGNATURE_BITS");
 
   ecs->num_components = num_c;
 
-  ecs->max_entities = init_entities;
+  ecs->max_entities = 0;
   ecs->num_entities = 0;
-  ecs->next_index = 0;
 
   for (int i = 0; i < ecs->num_components; i++)
   {
     ecs->component_sizes[i] = size_c[i];
-
-    ecs->components[i] = calloc(ecs->max_entities, ecs->component_sizes[i]);
-    DEBUG_ASSERT(ecs->components[i], "Can't allocate space for components");
   }
-  ecs->entities = calloc(ecs->max_entities, sizeof(Entity));
-  DEBUG_ASSERT(ecs->entities, "Can't allocate space for entities");
+
+  size_t max_slots = (size_t)ECS_INDEX_MASK + 1;
+  max_slots = max_entities < max_slots ? max_entities : max_slots;
+  max_slots = max_slots > init_entities ? max_slots : init_entities;
+  ecs->entity_limit = max_slots;
+  ecs->alive = ecs_reserve_table(&ecs->alive_mem, max_slots * sizeof(uint8_t));
+  ecs->archetype_ids = ecs_reserve_table(&ecs->archetype_ids_mem, max_slots * sizeof(uint32_t));
+  ecs->rows = ecs_reserve_table(&ecs->rows_mem, max_slots * sizeof(uint32_t));
+  ecs->generations = ecs_reserve_table(&ecs->generations_mem, max_slots * sizeof(uint32_t));
+  ecs->next_free = ecs_reserve_table(&ecs->next_free_mem, max_slots * sizeof(uint32_t));
+  DEBUG_ASSERT(ecs->alive && ecs->archetype_ids && ecs->rows && ecs->generations && ecs->next_free,
+               "Can't reserve space for entities");
+
+  ecs->free_head = free_end;
+  ecs->free_tail = free_end;
+  ecs_grow_entities(ecs, init_entities);
+
+  // Archetype 0 holds entities without components
+  ecs->num_archetypes = 0;
+  ecs->max_archetypes = init_archetypes;
+  ecs->archetypes = malloc(ecs->max_archetypes * sizeof(Archetype *));
+  DEBUG_ASSERT(ecs->archetypes, "Can't allocate space for archetypes");
+
+  Signature empty = {{0}};
+  ecs_find_archetype(ecs, &empty);
 
   DEBUG_TRACE("ECS init end");
 
@@ -41,98 +144,1013 @@ ecs_free(ECS *ecs)
 {
   DEBUG_TRACE("ECS free");
 
-  for (int i = 0; i < ecs->num_components; i++)
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
   {
-    free(ecs->components[i]);
-    ecs->component_sizes[i] = 0;
+    archetype_free(ecs->archetypes[i]);
   }
-  free(ecs->entities);
+  free(ecs->archetypes);
+
+  vmem_release(&ecs->alive_mem);
+  vmem_release(&ecs->archetype_ids_mem);
+  vmem_release(&ecs->rows_mem);
+  vmem_release(&ecs->generations_mem);
+  vmem_release(&ecs->next_free_mem);
 
   free(ecs);
 }
 
-size_t
+EntityId
 ecs_create_entity(ECS *ecs)
 {
-  if (ecs->num_entities >= ecs->max_entities)
+  EntityId e = ecs_reserve_slot(ecs);
+  if (e == ECS_NULL_ENTITY)
+  {
+    return e;
+  }
+
+  uint32_t i = ECS_INDEX(e);
+  ecs->num_entities++;
+  ecs->alive[i] = 1;
+  ecs->archetype_ids[i] = 0;
+  ecs->rows[i] = archetype_push(ecs, ecs->archetypes[0], e);
+
+  return e;
+}
+
+void
+ecs_get_entities(ECS *ecs, size_t *num_e, size_t *max_e)
+{
+  *num_e = ecs->num_entities;
+  *max_e = ecs->max_entities;
+}
+
+uint64_t
+ecs_hash(ECS *ecs)
+{
+  uint64_t h = hash_bytes(&ecs->num_entities, sizeof(size_t));
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
   {
-    for (int i = 0; i < ecs->num_components; i++)
+    Archetype *a = ecs->archetypes[i];
+    if (a->count == 0)
     {
-      void *new_component = calloc(ecs->max_entities * 2, ecs->component_sizes[i]);
-      DEBUG_ASSERT(new_component, "Can't reallocate space for components");
+      continue;
+    }
+
+    // Rows past count are stale and left out
+    h = h * 0x100000001b3ull ^ hash_bytes(&a->signature, sizeof(Signature));
+    h = h * 0x100000001b3ull ^ hash_bytes(a->entities, a->count * sizeof(EntityId));
+    for (size_t c = 0; c < ecs->num_components; c++)
+    {
+      if (a->columns[c] != NULL && ecs->component_sizes[c] > 0)
+      {
+        h = h * 0x100000001b3ull ^ hash_bytes(a->columns[c], a->count * ecs->component_sizes[c]);
+      }
+    }
+  }
+  return h;
+}
+
+void
+ecs_snapshot(ECS *ecs, ECSSnapshot *out)
+{
+  // Sized up front so the buffer grows at most once
+  size_t table = (ecs->max_entities * sizeof(uint32_t) + 7) & ~(size_t)7;
+  size_t size = sizeof(SnapshotHeader) + 2 * table;
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
+  {
+    size += snapshot_archetype_size(ecs, &ecs->archetypes[i]->signature, ecs->archetypes[i]->count);
+  }
+  snapshot_resize(out, size);
+
+  SnapshotHeader h = {0};
+  h.num_components = ecs->num_components;
+  h.num_entities = ecs->num_entities;
+  h.max_entities = ecs->max_entities;
+  h.num_archetypes = ecs->num_archetypes;
+  h.free_head = ecs->free_head;
+  h.free_tail = ecs->free_tail;
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    h.component_sizes[c] = ecs->component_sizes[c];
+  }
 
-      memcpy(new_component, ecs->components[i], ecs->max_entities * ecs->component_sizes[i]);
-      free(ecs->components[i]);
-      ecs->components[i] = new_component;
+  uint8_t *p = snapshot_put(out->data, &h, sizeof(h), sizeof(h));
+  p = snapshot_put(p, ecs->generations, ecs->max_entities * sizeof(uint32_t), table);
+  p = snapshot_put(p, ecs->next_free, ecs->max_entities * sizeof(uint32_t), table);
+
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
+  {
+    Archetype *a = ecs->archetypes[i];
+    SnapshotArchetype sa = {a->signature, a->count};
+    size_t rows = (a->count + snapshot_rows - 1) / snapshot_rows * snapshot_rows;
+
+    p = snapshot_put(p, &sa, sizeof(sa), sizeof(sa));
+    p = snapshot_put(p, a->entities, a->count * sizeof(EntityId), rows * sizeof(EntityId));
+    for (size_t c = 0; c < ecs->num_components; c++)
+    {
+      size_t cs = ecs->component_sizes[c];
+      if (signature_test(&a->signature, c) && cs > 0)
+      {
+        p = snapshot_put(p, a->columns[c], a->count * cs, rows * cs);
+      }
     }
-    void *new_entities = calloc(ecs->max_entities * 2, sizeof(Entity));
-    DEBUG_ASSERT(new_entities, "Can't reallocate space for entities");
+  }
+  DEBUG_ASSERT(p == out->data + out->size, "Snapshot size doesn't match its layout");
+}
 
-    memcpy(new_entities, ecs->entities, ecs->max_entities * sizeof(Entity));
-    free(ecs->entities);
-    ecs->entities = new_entities;
+int
+ecs_restore(ECS *ecs, const ECSSnapshot *snap)
+{
+  size_t size = ecs_snapshot_check(ecs, snap);
+  if (size == 0 || size != snap->size)
+  {
+    ERROR_RETURN(-1, "Snapshot doesn't match this ECS");
+  }
 
-    ecs->max_entities *= 2;
+  SnapshotHeader h;
+  const uint8_t *p = snapshot_get(snap->data, &h, sizeof(h), sizeof(h));
+  size_t max = (size_t)h.max_entities;
+  if (max > ecs->max_entities)
+  {
+    ecs_grow_entities(ecs, max);
   }
 
-  while (ecs->entities[ecs->next_index])
+  p = snapshot_get(p, ecs->generations, max * sizeof(uint32_t), max * sizeof(uint32_t));
+  p = snapshot_get(p, ecs->next_free, max * sizeof(uint32_t), max * sizeof(uint32_t));
+  ecs->free_head = h.free_head;
+  ecs->free_tail = h.free_tail;
+  // Slots the table grew by since the snapshot are free, and at the back of
+  // the list as if the table had grown later
+  ecs_link_free(ecs, max, ecs->max_entities);
+
+  memset(ecs->alive, 0, ecs->max_entities * sizeof(uint8_t));
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
   {
-    ecs->next_index = (ecs->next_index + 1) % ecs->max_entities;
+    ecs->archetypes[i]->count = 0;
   }
-  ecs->num_entities++;
 
-  ecs->entities[ecs->next_index] = 1;
-  return ecs->next_index;
+  // Archetypes are never removed, so when rolling back they're still at the
+  // same index, a fresh ECS gets the missing ones created in snapshot order
+  for (size_t k = 0; k < h.num_archetypes; k++)
+  {
+    SnapshotArchetype sa;
+    p = snapshot_get(p, &sa, sizeof(sa), sizeof(sa));
+    uint32_t id = (uint32_t)k;
+    if (k >= ecs->num_archetypes || signature_equal(&ecs->archetypes[k]->signature, &sa.signature) == 0)
+    {
+      id = ecs_find_archetype(ecs, &sa.signature);
+    }
+
+    Archetype *a = ecs->archetypes[id];
+    size_t count = (size_t)sa.count;
+    size_t rows = (count + snapshot_rows - 1) / snapshot_rows * snapshot_rows;
+    if (count > a->capacity)
+    {
+      archetype_grow(ecs, a, count);
+    }
+
+    p = snapshot_get(p, a->entities, count * sizeof(EntityId), rows * sizeof(EntityId));
+    for (size_t c = 0; c < ecs->num_components; c++)
+    {
+      size_t cs = ecs->component_sizes[c];
+      if (signature_test(&a->signature, c) && cs > 0)
+      {
+        p = snapshot_get(p, a->columns[c], count * cs, rows * cs);
+      }
+    }
+
+    a->count = count;
+    for (size_t r = 0; r < count; r++)
+    {
+      uint32_t i = ECS_INDEX(a->entities[r]);
+      ecs->alive[i] = 1;
+      ecs->archetype_ids[i] = id;
+      ecs->rows[i] = (uint32_t)r;
+    }
+  }
+  ecs->num_entities = (size_t)h.num_entities;
+
+  return 0;
 }
 
 void
-ecs_get_entities(ECS *ecs, size_t *num_e, size_t *max_e)
+ecs_snapshot_free(ECSSnapshot *snap)
 {
-  *num_e = ecs->num_entities;
-  *max_e = ecs->max_entities;
+  free(snap->data);
+  memset(snap, 0, sizeof(ECSSnapshot));
 }
 
 void
-ecs_destroy_entity(ECS *ecs, size_t e)
+ecs_snapshot_delta(const ECSSnapshot *base, const ECSSnapshot *snap, ECSSnapshot *delta)
 {
-  if (ecs->entities[e] == 0)
+  // Sized for the worst case, every block changed
+  size_t num_blocks = (snap->size + snapshot_block - 1) / snapshot_block;
+  snapshot_resize(delta, sizeof(SnapshotDelta) + num_blocks * (sizeof(SnapshotRun) + snapshot_block));
+
+  SnapshotDelta h = {snap->size, base->size};
+  uint8_t *p = snapshot_put(delta->data, &h, sizeof(h), sizeof(h));
+  SnapshotRun *run = NULL;
+  for (size_t b = 0; b < num_blocks; b++)
   {
-    ERROR_RETURN(, "No entity to destroy at index %ld", e);
+    size_t at = b * snapshot_block;
+    size_t n = snap->size - at < snapshot_block ? snap->size - at : snapshot_block;
+    if (at + n <= base->size && memcmp(snap->data + at, base->data + at, n) == 0)
+    {
+      run = NULL;
+      continue;
+    }
+
+    if (run == NULL)
+    {
+      run = (SnapshotRun *)p;
+      run->first = (uint32_t)b;
+      run->count = 0;
+      p += sizeof(SnapshotRun);
+    }
+    p = snapshot_put(p, snap->data + at, n, snapshot_block);
+    run->count++;
+  }
+  delta->size = (size_t)(p - delta->data);
+}
+
+int
+ecs_snapshot_apply(const ECSSnapshot *base, const ECSSnapshot *delta, ECSSnapshot *out)
+{
+  SnapshotDelta h;
+  if (delta->size < sizeof(h))
+  {
+    ERROR_RETURN(-1, "Broken snapshot delta");
+  }
+  const uint8_t *p = snapshot_get(delta->data, &h, sizeof(h), sizeof(h));
+  const uint8_t *end = delta->data + delta->size;
+  if (h.base_size != base->size)
+  {
+    ERROR_RETURN(-1, "Snapshot delta was made against another base");
+  }
+
+  // Applying in place leaves the unchanged blocks where they are
+  size_t size = (size_t)h.size;
+  size_t kept = base->size < size ? base->size : size;
+  snapshot_resize(out, size);
+  if (out != base)
+  {
+    memcpy(out->data, base->data, kept);
   }
 
-  ecs->entities[e] = 0;
+  size_t num_blocks = (size + snapshot_block - 1) / snapshot_block;
+  while (p < end)
+  {
+    SnapshotRun run;
+    p = snapshot_get(p, &run, sizeof(run), sizeof(run));
+    if ((size_t)run.first + run.count > num_blocks || (size_t)(end - p) < run.count * snapshot_block)
+    {
+      ERROR_RETURN(-1, "Broken snapshot delta");
+    }
+    for (size_t b = run.first; b < (size_t)run.first + run.count; b++)
+    {
+      size_t at = b * snapshot_block;
+      p = snapshot_get(p, out->data + at, size - at < snapshot_block ? size - at : snapshot_block, snapshot_block);
+    }
+  }
+
+  return 0;
+}
+
+EntityId
+ecs_entity_at(ECS *ecs, size_t i)
+{
+  if (ecs->alive[i] == 0)
+  {
+    return ECS_NULL_ENTITY;
+  }
+  return (ecs->generations[i] << ECS_INDEX_BITS) | (uint32_t)i;
+}
+
+void
+ecs_destroy_entity(ECS *ecs, EntityId e)
+{
+  if (ecs_alive(ecs, e) == 0)
+  {
+    ERROR_RETURN(, "No entity to destroy with handle %08x", e);
+  }
+
+  uint32_t i = ECS_INDEX(e);
+  archetype_remove_row(ecs, ecs->archetypes[ecs->archetype_ids[i]], ecs->rows[i]);
+
+  ecs->alive[i] = 0;
   ecs->num_entities--;
+  ecs_release_slot(ecs, i);
 }
 
 int
-ecs_alive(ECS *ecs, size_t e)
+ecs_alive(ECS *ecs, EntityId e)
 {
-  return ecs->entities[e] != 0;
+  uint32_t i = ECS_INDEX(e);
+  return i < ecs->max_entities && ecs->alive[i] != 0 && ecs->generations[i] == ECS_GEN(e);
 }
 
 int
-ecs_has_component(ECS *ecs, size_t e, size_t c)
+ecs_has_component(ECS *ecs, EntityId e, size_t c)
 {
-  return (ecs->entities[e] & (2 << c)) != 0;
+  return signature_test(&ecs->archetypes[ecs->archetype_ids[ECS_INDEX(e)]]->signature, c);
+}
+
+int
+ecs_has_components(ECS *ecs, EntityId e, const Signature *mask)
+{
+  return signature_contains(&ecs->archetypes[ecs->archetype_ids[ECS_INDEX(e)]]->signature, mask);
 }
 
 void *
-ecs_add_component(ECS *ecs, size_t e, size_t c)
+ecs_add_component(ECS *ecs, EntityId e, size_t c)
 {
-  // First bit is for checking if alive
-  // Maybe redundant, but technically an entity can have no components
-  ecs->entities[e] |= (2 << c);
-  return (int8_t *)ecs->components[c] + e * ecs->component_sizes[c];
+  DEBUG_ASSERT(ecs_alive(ecs, e), "Adding component to dead entity %08x", e);
+
+  uint32_t i = ECS_INDEX(e);
+  Archetype *a = ecs->archetypes[ecs->archetype_ids[i]];
+
+  if (signature_test(&a->signature, c) == 0)
+  {
+    if (a->edge_add[c] == no_edge)
+    {
+      Signature sig = a->signature;
+      signature_set(&sig, c);
+      a->edge_add[c] = ecs_find_archetype(ecs, &sig);
+    }
+    ecs_move_entity(ecs, i, a->edge_add[c]);
+    a = ecs->archetypes[ecs->archetype_ids[i]];
+
+    // Rows are reused, so clear whatever the previous owner left behind
+    memset((int8_t *)a->columns[c] + ecs->rows[i] * ecs->component_sizes[c], 0, ecs->component_sizes[c]);
+  }
+
+  return (int8_t *)a->columns[c] + ecs->rows[i] * ecs->component_sizes[c];
 }
 
 void
-ecs_remove_component(ECS *ecs, size_t e, size_t c)
+ecs_remove_component(ECS *ecs, EntityId e, size_t c)
 {
-  ecs->entities[e] &= ~(2 << c);
+  uint32_t i = ECS_INDEX(e);
+  Archetype *a = ecs->archetypes[ecs->archetype_ids[i]];
+
+  if (signature_test(&a->signature, c) == 0)
+  {
+    return;
+  }
+  if (a->edge_remove[c] == no_edge)
+  {
+    Signature sig = a->signature;
+    signature_clear(&sig, c);
+    a->edge_remove[c] = ecs_find_archetype(ecs, &sig);
+  }
+  ecs_move_entity(ecs, i, a->edge_remove[c]);
 }
 
 void *
-ecs_get_component(ECS *ecs, size_t e, size_t c)
+ecs_get_component(ECS *ecs, EntityId e, size_t c)
+{
+  uint32_t i = ECS_INDEX(e);
+  Archetype *a = ecs->archetypes[ecs->archetype_ids[i]];
+
+  if (a->columns[c] == NULL)
+  {
+    ERROR_RETURN(NULL, "Entity %08x has no component %ld", e, c);
+  }
+  return (int8_t *)a->columns[c] + ecs->rows[i] * ecs->component_sizes[c];
+}
+
+ECSQuery
+ecs_query(ECS *ecs, const Signature *required, const Signature *excluded)
+{
+  ECSQuery q = {0};
+  q.ecs = ecs;
+  if (required != NULL)
+  {
+    q.required = *required;
+  }
+  if (excluded != NULL)
+  {
+    q.excluded = *excluded;
+  }
+  return q;
+}
+
+int
+ecs_query_next(ECSQuery *q)
+{
+  while (q->next_archetype < q->ecs->num_archetypes)
+  {
+    Archetype *a = q->ecs->archetypes[q->next_archetype++];
+    if (a->count == 0 ||
+        signature_contains(&a->signature, &q->required) == 0 ||
+        signature_intersects(&a->signature, &q->excluded))
+    {
+      continue;
+    }
+
+    q->archetype = a;
+    q->count = a->count;
+    q->entities = a->entities;
+    return 1;
+  }
+
+  q->archetype = NULL;
+  q->count = 0;
+  q->entities = NULL;
+  return 0;
+}
+
+void *
+ecs_query_column(ECSQuery *q, size_t c)
+{
+  return q->archetype->columns[c];
+}
+
+ECSCommandBuffer *
+ecs_cmd_init(ECS *ecs)
+{
+  ECSCommandBuffer *cb = calloc(1, sizeof(ECSCommandBuffer));
+  DEBUG_ASSERT(cb, "Can't allocate space for command buffer");
+
+  cb->ecs = ecs;
+  cb->last_archetype = no_edge;
+
+  // Address space for the commands between flushes, enough for a create, a
+  // destroy and an add of every component for each entity of the limit
+  size_t per_entity = 2 * ecs_cmd_size(0);
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    per_entity += ecs_cmd_size(ecs->component_sizes[c]);
+  }
+  arena_init(&cb->commands, ecs->entity_limit * per_entity);
+
+  return cb;
+}
+
+void
+ecs_cmd_free(ECSCommandBuffer *cb)
+{
+  arena_free(&cb->commands);
+  free(cb->pending_rows);
+  free(cb);
+}
+
+EntityId
+ecs_cmd_create(ECSCommandBuffer *cb)
+{
+  EntityId e = ecs_reserve_slot(cb->ecs);
+  if (e != ECS_NULL_ENTITY)
+  {
+    ecs_cmd_push(cb, CMD_Create, e, 0, 0);
+  }
+  return e;
+}
+
+void
+ecs_cmd_destroy(ECSCommandBuffer *cb, EntityId e)
+{
+  ecs_cmd_push(cb, CMD_Destroy, e, 0, 0);
+}
+
+void
+ecs_cmd_add(ECSCommandBuffer *cb, EntityId e, size_t c, const void *data)
+{
+  // Adds without data carry no payload, flush zeroes the component only when
+  // the entity didn't have it
+  size_t size = data != NULL ? cb->ecs->component_sizes[c] : 0;
+  void *payload = ecs_cmd_push(cb, CMD_Add, e, c, size);
+  if (data != NULL)
+  {
+    memcpy(payload, data, size);
+  }
+}
+
+void
+ecs_cmd_remove(ECSCommandBuffer *cb, EntityId e, size_t c)
+{
+  ecs_cmd_push(cb, CMD_Remove, e, c, 0);
+}
+
+void
+ecs_cmd_flush(ECSCommandBuffer *cb)
+{
+  ECS *ecs = cb->ecs;
+  CommandRun run;
+
+  // Consecutive commands for one entity form a run, which is applied as a
+  // single archetype move. First pass counts the rows every archetype gains
+  // so each one grows at most once for the whole batch.
+  for (size_t offset = 0; offset < cb->commands.used; offset = run.end)
+  {
+    Command *cmd = (Command *)(cb->commands.mem.base + offset);
+    ecs_cmd_run(cb, offset, &run);
+
+    if (run.destroyed || (run.created == 0 && ecs_alive(ecs, cmd->e) == 0))
+    {
+      continue;
+    }
+
+    uint32_t dest = ecs_cmd_archetype(cb, &run.signature);
+    if (dest >= cb->num_pending)
+    {
+      size_t *new_pending = realloc(cb->pending_rows, ecs->max_archetypes * sizeof(size_t));
+      DEBUG_ASSERT(new_pending, "Can't reallocate space for command scratch");
+
+      memset(new_pending + cb->num_pending, 0, (ecs->max_archetypes - cb->num_pending) * sizeof(size_t));
+      cb->pending_rows = new_pending;
+      cb->num_pending = ecs->max_archetypes;
+    }
+    if (run.created || dest != ecs->archetype_ids[ECS_INDEX(cmd->e)])
+    {
+      cb->pending_rows[dest]++;
+    }
+  }
+
+  for (size_t i = 0; i < cb->num_pending && i < ecs->num_archetypes; i++)
+  {
+    Archetype *a = ecs->archetypes[i];
+    if (a->count + cb->pending_rows[i] > a->capacity)
+    {
+      size_t capacity = a->capacity * 2;
+      archetype_grow(ecs, a, capacity > a->count + cb->pending_rows[i] ? capacity : a->count + cb->pending_rows[i]);
+    }
+    cb->pending_rows[i] = 0;
+  }
+
+  // Second pass applies the runs in recording order
+  for (size_t offset = 0; offset < cb->commands.used; offset = run.end)
+  {
+    Command *cmd = (Command *)(cb->commands.mem.base + offset);
+    EntityId e = cmd->e;
+    uint32_t i = ECS_INDEX(e);
+    ecs_cmd_run(cb, offset, &run);
+
+    // Components the entity had before the run, or got data for earlier in
+    // it, are left alone by adds without data
+    Signature had = {{0}};
+
+    if (run.created)
+    {
+      if (run.destroyed)
+      {
+        ecs_release_slot(ecs, i);
+        continue;
+      }
+      ecs->num_entities++;
+      ecs->alive[i] = 1;
+      ecs->archetype_ids[i] = ecs_cmd_archetype(cb, &run.signature);
+      ecs->rows[i] = archetype_push(ecs, ecs->archetypes[ecs->archetype_ids[i]], e);
+    }
+    else if (ecs_alive(ecs, e) == 0)
+    {
+      // Stale handle or a destroy that was already applied
+      continue;
+    }
+    else if (run.destroyed)
+    {
+      ecs_destroy_entity(ecs, e);
+      continue;
+    }
+    else
+    {
+      had = ecs->archetypes[ecs->archetype_ids[i]]->signature;
+      uint32_t dest = ecs_cmd_archetype(cb, &run.signature);
+      if (dest != ecs->archetype_ids[i])
+      {
+        ecs_move_entity(ecs, i, dest);
+      }
+    }
+
+    Archetype *a = ecs->archetypes[ecs->archetype_ids[i]];
+    for (size_t at = offset; at < run.end; )
+    {
+      Command *c = (Command *)(cb->commands.mem.base + at);
+      if (c->type == CMD_Add && a->columns[c->component] != NULL)
+      {
+        size_t size = ecs->component_sizes[c->component];
+        int8_t *dst = (int8_t *)a->columns[c->component] + ecs->rows[i] * size;
+        if (c->size > 0)
+        {
+          memcpy(dst, c + 1, size);
+          signature_set(&had, c->component);
+        }
+        else if (signature_test(&had, c->component) == 0)
+        {
+          memset(dst, 0, size);
+        }
+      }
+      at += ecs_cmd_size(c->size);
+    }
+  }
+
+  arena_reset(&cb->commands);
+}
+
+static void
+ecs_link_free(ECS *ecs, size_t first, size_t last)
+{
+  // Appends slots [first, last) to the tail of the free list
+  for (size_t i = first; i < last; i++)
+  {
+    ecs->generations[i] = 1;
+    ecs->next_free[i] = (i + 1 < last) ? (uint32_t)(i + 1) : free_end;
+  }
+  if (first == last)
+  {
+    return;
+  }
+
+  if (ecs->free_tail == free_end)
+  {
+    ecs->free_head = (uint32_t)first;
+  }
+  else
+  {
+    ecs->next_free[ecs->free_tail] = (uint32_t)first;
+  }
+  ecs->free_tail = (uint32_t)(last - 1);
+}
+
+static EntityId
+ecs_reserve_slot(ECS *ecs)
+{
+  if (ecs->free_head == free_end)
+  {
+    if (ecs->max_entities >= ecs->entity_limit)
+    {
+      ERROR_RETURN(ECS_NULL_ENTITY, "Entity limit of %zu reached", ecs->entity_limit);
+    }
+    size_t capacity = ecs->max_entities * 2;
+    ecs_grow_entities(ecs, capacity < ecs->entity_limit ? capacity : ecs->entity_limit);
+  }
+
+  uint32_t i = ecs->free_head;
+  ecs->free_head = ecs->next_free[i];
+  if (ecs->free_head == free_end)
+  {
+    ecs->free_tail = free_end;
+  }
+
+  return (ecs->generations[i] << ECS_INDEX_BITS) | i;
+}
+
+static void
+ecs_grow_entities(ECS *ecs, size_t capacity)
+{
+  // Tables grow in place, slots past the old end were never written and read
+  // as zero, so they start out dead
+  int ok = vmem_commit(&ecs->alive_mem, capacity * sizeof(uint8_t)) == 0;
+  ok = ok && vmem_commit(&ecs->archetype_ids_mem, capacity * sizeof(uint32_t)) == 0;
+  ok = ok && vmem_commit(&ecs->rows_mem, capacity * sizeof(uint32_t)) == 0;
+  ok = ok && vmem_commit(&ecs->generations_mem, capacity * sizeof(uint32_t)) == 0;
+  ok = ok && vmem_commit(&ecs->next_free_mem, capacity * sizeof(uint32_t)) == 0;
+  DEBUG_ASSERT(ok, "Can't commit space for entities");
+
+  ecs_link_free(ecs, ecs->max_entities, capacity);
+  ecs->max_entities = capacity;
+}
+
+static void *
+ecs_reserve_table(VMem *v, size_t size)
+{
+  return vmem_reserve(v, size) == 0 ? v->base : NULL;
+}
+
+static void
+ecs_release_slot(ECS *ecs, uint32_t i)
+{
+  // Skip generation 0 on wrap-around so the null handle stays dead
+  ecs->generations[i] = (ecs->generations[i] + 1) & ECS_GEN_MASK;
+  if (ecs->generations[i] == 0)
+  {
+    ecs->generations[i] = 1;
+  }
+
+  ecs->next_free[i] = free_end;
+  if (ecs->free_tail == free_end)
+  {
+    ecs->free_head = i;
+  }
+  else
+  {
+    ecs->next_free[ecs->free_tail] = i;
+  }
+  ecs->free_tail = i;
+}
+
+static uint32_t
+ecs_find_archetype(ECS *ecs, const Signature *sig)
+{
+  for (size_t i = 0; i < ecs->num_archetypes; i++)
+  {
+    if (signature_equal(&ecs->archetypes[i]->signature, sig))
+    {
+      return (uint32_t)i;
+    }
+  }
+
+  if (ecs->num_archetypes >= ecs->max_archetypes)
+  {
+    Archetype **new_archetypes = realloc(ecs->archetypes, ecs->max_archetypes * 2 * sizeof(Archetype *));
+    DEBUG_ASSERT(new_archetypes, "Can't reallocate space for archetypes");
+
+    ecs->archetypes = new_archetypes;
+    ecs->max_archetypes *= 2;
+  }
+
+  Archetype *a = calloc(1, sizeof(Archetype));
+  DEBUG_ASSERT(a, "Can't allocate space for archetype");
+
+  a->signature = *sig;
+  for (size_t c = 0; c < ECS_MAX_COMPONENTS; c++)
+  {
+    a->edge_add[c] = no_edge;
+    a->edge_remove[c] = no_edge;
+  }
+
+  // Only address space, pages are committed as rows are added. Components
+  // without data still get a column so their pointer isn't NULL.
+  size_t max_rows = ecs->entity_limit;
+  a->entities = ecs_reserve_table(&a->entity_mem, max_rows * sizeof(EntityId));
+  DEBUG_ASSERT(a->entities, "Can't reserve space for archetype entities");
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    if (signature_test(sig, c))
+    {
+      size_t size = max_rows * ecs->component_sizes[c];
+      a->columns[c] = ecs_reserve_table(&a->column_mem[c], size > 0 ? size : 1);
+      DEBUG_ASSERT(a->columns[c], "Can't reserve space for components");
+    }
+  }
+  archetype_grow(ecs, a, init_rows);
+
+  ecs->archetypes[ecs->num_archetypes] = a;
+  return (uint32_t)ecs->num_archetypes++;
+}
+
+static void
+ecs_move_entity(ECS *ecs, uint32_t i, uint32_t dest)
 {
-  return (int8_t *)ecs->components[c] + e * ecs->component_sizes[c];
+  Archetype *src = ecs->archetypes[ecs->archetype_ids[i]];
+  Archetype *dst = ecs->archetypes[dest];
+  uint32_t src_row = ecs->rows[i];
+  uint32_t dst_row = archetype_push(ecs, dst, src->entities[src_row]);
+
+  // Copy the components both archetypes share
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    if (src->columns[c] != NULL && dst->columns[c] != NULL)
+    {
+      size_t size = ecs->component_sizes[c];
+      memcpy((int8_t *)dst->columns[c] + dst_row * size, (int8_t *)src->columns[c] + src_row * size, size);
+    }
+  }
+
+  archetype_remove_row(ecs, src, src_row);
+  ecs->archetype_ids[i] = dest;
+  ecs->rows[i] = dst_row;
+}
+
+static void *
+ecs_cmd_push(ECSCommandBuffer *cb, CommandType type, EntityId e, size_t c, size_t size)
+{
+  // Commands are all the arena holds, so each one starts where the last ended
+  Command *cmd = arena_alloc(&cb->commands, ecs_cmd_size(size));
+  DEBUG_ASSERT(cmd, "Can't allocate space for commands");
+
+  cmd->type = type;
+  cmd->component = (uint32_t)c;
+  cmd->size = (uint32_t)size;
+  cmd->e = e;
+
+  return cmd + 1;
+}
+
+static size_t
+ecs_cmd_size(size_t payload)
+{
+  return sizeof(Command) + ((payload + 15) & ~(size_t)15);
+}
+
+static void
+ecs_cmd_run(ECSCommandBuffer *cb, size_t offset, CommandRun *run)
+{
+  ECS *ecs = cb->ecs;
+  EntityId e = ((Command *)(cb->commands.mem.base + offset))->e;
+
+  run->created = 0;
+  run->destroyed = 0;
+  run->signature = (Signature){{0}};
+  if (ecs_alive(ecs, e))
+  {
+    run->signature = ecs->archetypes[ecs->archetype_ids[ECS_INDEX(e)]]->signature;
+  }
+
+  while (offset < cb->commands.used)
+  {
+    Command *cmd = (Command *)(cb->commands.mem.base + offset);
+    if (cmd->e != e)
+    {
+      break;
+    }
+
+    switch (cmd->type)
+    {
+    case CMD_Create:
+      run->created = 1;
+      break;
+    case CMD_Destroy:
+      run->destroyed = 1;
+      break;
+    case CMD_Add:
+      signature_set(&run->signature, cmd->component);
+      break;
+    case CMD_Remove:
+      signature_clear(&run->signature, cmd->component);
+      break;
+    }
+    offset += ecs_cmd_size(cmd->size);
+  }
+  run->end = offset;
+}
+
+static uint32_t
+ecs_cmd_archetype(ECSCommandBuffer *cb, const Signature *sig)
+{
+  // Batches tend to spawn many entities of the same kind in a row
+  if (cb->last_archetype == no_edge || signature_equal(&cb->last_signature, sig) == 0)
+  {
+    cb->last_signature = *sig;
+    cb->last_archetype = ecs_find_archetype(cb->ecs, sig);
+  }
+  return cb->last_archetype;
+}
+
+// Size the snapshot should have, or 0 when it's too short, was taken from an
+// ECS with other components or has a broken layout
+static size_t
+ecs_snapshot_check(ECS *ecs, const ECSSnapshot *snap)
+{
+  SnapshotHeader h;
+  if (snap->size < sizeof(h))
+  {
+    return 0;
+  }
+  memcpy(&h, snap->data, sizeof(h));
+  if (h.num_components != ecs->num_components || h.max_entities > ecs->entity_limit ||
+      h.num_entities > h.max_entities)
+  {
+    return 0;
+  }
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    if (h.component_sizes[c] != ecs->component_sizes[c])
+    {
+      return 0;
+    }
+  }
+
+  // Every archetype header has to be there, and no section may run past the
+  // end, or the next header would be read from beyond it
+  size_t size = sizeof(h) + 2 * (((size_t)h.max_entities * sizeof(uint32_t) + 7) & ~(size_t)7);
+  for (uint64_t k = 0; k < h.num_archetypes; k++)
+  {
+    if (size > snap->size || snap->size - size < sizeof(SnapshotArchetype))
+    {
+      return 0;
+    }
+    SnapshotArchetype sa;
+    memcpy(&sa, snap->data + size, sizeof(sa));
+    if (sa.count > h.num_entities)
+    {
+      return 0;
+    }
+    size += snapshot_archetype_size(ecs, &sa.signature, (size_t)sa.count);
+    if (size > snap->size)
+    {
+      return 0;
+    }
+  }
+  return size;
+}
+
+static size_t
+snapshot_archetype_size(ECS *ecs, const Signature *sig, size_t count)
+{
+  size_t rows = (count + snapshot_rows - 1) / snapshot_rows * snapshot_rows;
+  size_t size = sizeof(SnapshotArchetype) + ((rows * sizeof(EntityId) + 7) & ~(size_t)7);
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    if (signature_test(sig, c) && ecs->component_sizes[c] > 0)
+    {
+      size += (rows * ecs->component_sizes[c] + 7) & ~(size_t)7;
+    }
+  }
+  return size;
+}
+
+static void
+snapshot_resize(ECSSnapshot *snap, size_t size)
+{
+  if (size > snap->capacity)
+  {
+    size_t capacity = snap->capacity ? snap->capacity : init_snapshot;
+    while (capacity < size)
+    {
+      capacity *= 2;
+    }
+
+    uint8_t *new_data = realloc(snap->data, capacity);
+    DEBUG_ASSERT(new_data, "Can't reallocate space for snapshot");
+    snap->data = new_data;
+    snap->capacity = capacity;
+  }
+  snap->size = size;
+}
+
+// Copies used bytes and zero fills up to total rounded up to 8
+static uint8_t *
+snapshot_put(uint8_t *p, const void *src, size_t used, size_t total)
+{
+  size_t padded = (total + 7) & ~(size_t)7;
+  if (used > 0)
+  {
+    memcpy(p, src, used);
+  }
+  memset(p + used, 0, padded - used);
+  return p + padded;
+}
+
+static const uint8_t *
+snapshot_get(const uint8_t *p, void *dst, size_t used, size_t total)
+{
+  if (used > 0)
+  {
+    memcpy(dst, p, used);
+  }
+  return p + ((total + 7) & ~(size_t)7);
+}
+
+static void
+archetype_free(Archetype *a)
+{
+  for (size_t c = 0; c < ECS_MAX_COMPONENTS; c++)
+  {
+    vmem_release(&a->column_mem[c]);
+  }
+  vmem_release(&a->entity_mem);
+  free(a);
+}
+
+static void
+archetype_grow(ECS *ecs, Archetype *a, size_t capacity)
+{
+  // Growing commits pages behind the rows already there, nothing is copied
+  capacity = capacity < ecs->entity_limit ? capacity : ecs->entity_limit;
+
+  int ok = vmem_commit(&a->entity_mem, capacity * sizeof(EntityId)) == 0;
+  for (size_t c = 0; c < ecs->num_components; c++)
+  {
+    if (signature_test(&a->signature, c))
+    {
+      ok = ok && vmem_commit(&a->column_mem[c], capacity * ecs->component_sizes[c]) == 0;
+    }
+  }
+  DEBUG_ASSERT(ok, "Can't commit space for archetype rows");
+  a->capacity = capacity;
+}
+
+static uint32_t
+archetype_push(ECS *ecs, Archetype *a, EntityId e)
+{
+  if (a->count >= a->capacity)
+  {
+    archetype_grow(ecs, a, a->capacity * 2);
+  }
+
+  a->entities[a->count] = e;
+  return (uint32_t)a->count++;
+}
+
+static void
+archetype_remove_row(ECS *ecs, Archetype *a, uint32_t row)
+{
+  // Keep rows packed by moving the last row into the hole
+  uint32_t last = (uint32_t)(a->count - 1);
+  if (row != last)
+  {
+    for (size_t c = 0; c < ecs->num_components; c++)
+    {
+      if (a->columns[c] != NULL)
+      {
+        size_t size = ecs->component_sizes[c];
+        memcpy((int8_t *)a->columns[c] + row * size, (int8_t *)a->columns[c] + last * size, size);
+      }
+    }
+
+    EntityId moved = a->entities[last];
+    a->entities[row] = moved;
+    ecs->rows[ECS_INDEX(moved)] = row;
+  }
+  a->count--;
 }
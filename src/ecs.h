@@ -1,29 +1,225 @@
 #pragma once
 
+#include "mem.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
-typedef uint8_t Entity;
+// Component signatures are ECS_SIGNATURE_BITS wide (64, 128 or 256), build with
+// -DECS_SIGNATURE_BITS=128 to get more component types
+#ifndef ECS_SIGNATURE_BITS
+#define ECS_SIGNATURE_BITS 64
+#endif
+
+#if ECS_SIGNATURE_BITS != 64 && ECS_SIGNATURE_BITS != 128 && ECS_SIGNATURE_BITS != 256
+#error "ECS_SIGNATURE_BITS must be 64, 128 or 256"
+#endif
+
+#define ECS_SIGNATURE_WORDS (ECS_SIGNATURE_BITS / 64)
+#define ECS_MAX_COMPONENTS  ECS_SIGNATURE_BITS
+
+typedef struct {
+  uint64_t w[ECS_SIGNATURE_WORDS];
+}
+Signature;
+
+// Handles pack a slot index and a generation, the generation is bumped on destroy
+// so stale handles to a reused slot are rejected. Generation 0 is never used,
+// which makes 0 a handle that is never alive.
+typedef uint32_t EntityId;
+
+#define ECS_NULL_ENTITY ((EntityId)0)
+#define ECS_INDEX_BITS  22
+#define ECS_INDEX_MASK  ((1u << ECS_INDEX_BITS) - 1)
+#define ECS_GEN_MASK    ((1u << (32 - ECS_INDEX_BITS)) - 1)
+
+#define ECS_INDEX(e) ((e) & ECS_INDEX_MASK)
+#define ECS_GEN(e)   ((e) >> ECS_INDEX_BITS)
+
+// Entities with the same signature share an archetype, which stores their
+// components as packed columns (one array per component, rows are entities).
+// Adding or removing a component moves the entity to another archetype.
+// Columns are reserved for the ECS's entity limit in rows and grow in place,
+// column pointers stay valid for the life of the ECS.
+typedef struct {
+  Signature signature;
+  size_t count, capacity;
+  EntityId *entities;
+  void     *columns[ECS_MAX_COMPONENTS];
+  VMem     entity_mem, column_mem[ECS_MAX_COMPONENTS];
+
+  // Cached archetype transitions, UINT32_MAX until first used
+  uint32_t edge_add[ECS_MAX_COMPONENTS];
+  uint32_t edge_remove[ECS_MAX_COMPONENTS];
+}
+Archetype;
 
 typedef struct {
-  size_t num_components, num_entities, max_entities, next_index;
-  size_t component_sizes[sizeof(Entity) * 8 - 1];
-  void   *components[sizeof(Entity) * 8 - 1];
-  Entity *entities;
+  size_t num_components, num_entities, max_entities, entity_limit;
+  size_t component_sizes[ECS_MAX_COMPONENTS];
+
+  size_t    num_archetypes, max_archetypes;
+  Archetype **archetypes;
+
+  // Per slot: liveness, which archetype and row hold the entity's components
+  uint8_t  *alive;
+  uint32_t *archetype_ids, *rows;
+
+  // Free slots form a FIFO list threaded through next_free, reusing the oldest
+  // slot first spreads generation wrap-around over the whole table
+  uint32_t *generations, *next_free;
+  uint32_t free_head, free_tail;
+
+  // Slot tables are reserved for entity_limit slots like the columns
+  VMem alive_mem, archetype_ids_mem, rows_mem, generations_mem, next_free_mem;
 }
 ECS;
 
-ECS  *ecs_init(size_t num_c, size_t *size_c);
+// Walks every archetype containing all of required and none of excluded.
+// After each successful ecs_query_next, count rows are available through
+// entities and ecs_query_column.
+typedef struct {
+  ECS *ecs;
+  Signature required, excluded;
+  size_t next_archetype;
+
+  Archetype *archetype;
+  size_t    count;
+  EntityId  *entities;
+}
+ECSQuery;
+
+// Flat copy of an ECS in one buffer: the entity handle table, then every
+// archetype's signature, entities and columns. Components are plain data
+// (asset ids, entity handles, no pointers), so a save is a series of memcpy
+// and a restore copies the same bytes back. Buffers are reused between saves
+// and only grow.
+typedef struct {
+  size_t  size, capacity;
+  uint8_t *data;
+}
+ECSSnapshot;
+
+// Records structural changes (create, destroy, add, remove) so systems can
+// request them while iterating, they are applied together by ecs_cmd_flush.
+// Commands are bumped into an arena that every flush resets, add payloads are
+// copied inline.
+typedef struct {
+  ECS *ecs;
+  Arena commands;
+
+  // Scratch for flush, rows each archetype will gain from the batch and the
+  // archetype the previous run ended up in
+  size_t num_pending;
+  size_t *pending_rows;
+  Signature last_signature;
+  uint32_t  last_archetype;
+}
+ECSCommandBuffer;
+
+// At most max_entities entities are alive or reserved at once, creates past
+// that return ECS_NULL_ENTITY. The limit sizes every reservation: each column
+// takes max_entities rows of address space per archetype and each command
+// buffer room for a batch touching every entity. It's clamped to
+// ECS_INDEX_MASK + 1, pick the smallest the game can outgrow.
+ECS  *ecs_init(size_t num_c, size_t *size_c, size_t max_entities);
 void ecs_free(ECS *ecs);
 
-size_t ecs_create_entity(ECS *ecs);
-void   ecs_destroy_entity(ECS *ecs, size_t e);
+EntityId ecs_create_entity(ECS *ecs);
+void     ecs_destroy_entity(ECS *ecs, EntityId e);
+
+void     ecs_get_entities(ECS *ecs, size_t *num_e, size_t *max_e);
+EntityId ecs_entity_at(ECS *ecs, size_t i);
+// Hash of every live entity handle and component, in archetype and row order.
+// Equal for two ECS that went through the same operations.
+uint64_t ecs_hash(ECS *ecs);
+
+// Snapshots are taken and restored with command buffers flushed, restoring
+// drops entities reserved by pending creates. Restore returns -1 when the
+// snapshot comes from an ECS with other components or holds more slots than
+// the entity limit.
+void ecs_snapshot(ECS *ecs, ECSSnapshot *out);
+int  ecs_restore(ECS *ecs, const ECSSnapshot *snap);
+void ecs_snapshot_free(ECSSnapshot *snap);
+// Deltas keep the 64 byte blocks of snap that differ from base, a tick apart
+// that's mostly the columns of moving entities. Apply rebuilds snap into out
+// from the same base, -1 if the delta was made against another base size.
+void ecs_snapshot_delta(const ECSSnapshot *base, const ECSSnapshot *snap, ECSSnapshot *delta);
+int  ecs_snapshot_apply(const ECSSnapshot *base, const ECSSnapshot *delta, ECSSnapshot *out);
+
+int  ecs_alive(ECS *ecs, EntityId e);
+int  ecs_has_component(ECS *ecs, EntityId e, size_t c);
+int  ecs_has_components(ECS *ecs, EntityId e, const Signature *mask);
+void *ecs_add_component(ECS *ecs, EntityId e, size_t c);
+void ecs_remove_component(ECS *ecs, EntityId e, size_t c);
+void *ecs_get_component(ECS *ecs, EntityId e, size_t c);
+
+ECSQuery ecs_query(ECS *ecs, const Signature *required, const Signature *excluded);
+int      ecs_query_next(ECSQuery *q);
+void     *ecs_query_column(ECSQuery *q, size_t c);
+
+// Handles from ecs_cmd_create are reserved right away, but the entity only
+// becomes alive once the buffer is flushed. Adds with NULL data zero the
+// component like ecs_add_component, and leave it as it is when the entity
+// already has it.
+ECSCommandBuffer *ecs_cmd_init(ECS *ecs);
+void ecs_cmd_free(ECSCommandBuffer *cb);
 
-void ecs_get_entities(ECS *ecs, size_t *num_e, size_t *max_e);
+EntityId ecs_cmd_create(ECSCommandBuffer *cb);
+void     ecs_cmd_destroy(ECSCommandBuffer *cb, EntityId e);
+void     ecs_cmd_add(ECSCommandBuffer *cb, EntityId e, size_t c, const void *data);
+void     ecs_cmd_remove(ECSCommandBuffer *cb, EntityId e, size_t c);
+void     ecs_cmd_flush(ECSCommandBuffer *cb);
 
-int  ecs_alive(ECS *ecs, size_t e);
-int  ecs_has_component(ECS *ecs, size_t e, size_t c);
-void *ecs_add_component(ECS *ecs, size_t e, size_t c);
-void ecs_remove_component(ECS *ecs, size_t e, size_t c);
-void *ecs_get_component(ECS *ecs, size_t e, size_t c);
+// Signatures
 
+static inline void
+signature_set(Signature *s, size_t c)
+{
+  s->w[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static inline void
+signature_clear(Signature *s, size_t c)
+{
+  s->w[c >> 6] &= ~((uint64_t)1 << (c & 63));
+}
+
+static inline int
+signature_test(const Signature *s, size_t c)
+{
+  return (s->w[c >> 6] >> (c & 63)) & 1;
+}
+
+static inline int
+signature_contains(const Signature *s, const Signature *mask)
+{
+  uint64_t missing = 0;
+  for (int i = 0; i < ECS_SIGNATURE_WORDS; i++)
+  {
+    missing |= mask->w[i] & ~s->w[i];
+  }
+  return missing == 0;
+}
+
+static inline int
+signature_intersects(const Signature *s, const Signature *mask)
+{
+  uint64_t shared = 0;
+  for (int i = 0; i < ECS_SIGNATURE_WORDS; i++)
+  {
+    shared |= mask->w[i] & s->w[i];
+  }
+  return shared != 0;
+}
+
+static inline int
+signature_equal(const Signature *a, const Signature *b)
+{
+  uint64_t diff = 0;
+  for (int i = 0; i < ECS_SIGNATURE_WORDS; i++)
+  {
+    diff |= a->w[i] ^ b->w[i];
+  }
+  return diff == 0;
+}
@@ -1,35 +1,124 @@
 #include "game.h"
+#include "hud.h"
+#include "mem.h"
+#include "pack.h"
+#include "prof.h"
+#include "replay.h"
 #include "scene.h"
+#include "simd.h"
 #include "util.h"
 
+#include <math.h>
 #include <time.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#define BATCH_QUADS 8192
+
+// Most simulation time caught up on in one frame, in seconds. Time beyond it is
+// dropped so a stall can't make the next frames slower and slower.
+#define GAME_MAX_CATCHUP 0.1
+
+// Key events waiting for the simulation thread
+#define GAME_INPUT_SIZE 256
+
+// Written by F9
+#define GAME_PROFILE_FILE "profile.json"
+
+// Toggles the performance overlay
+#define GAME_HUD_KEY SDLK_F3
+
+// Address space for the asset tables
+#define GAME_ASSET_RESERVE ((size_t)16 << 20)
+
+// Quick save and load of the scene, handled by the simulation thread
+#define GAME_SAVE_KEY SDLK_F5
+#define GAME_LOAD_KEY SDLK_F8
+
+// Ticks between state hashes in recordings
+#define GAME_REPLAY_HASH_INTERVAL 60
+
 static SDL_Window   *window;
 static SDL_Renderer *renderer;
 
+// Sprite batch, quads sharing a texture are submitted with one SDL_RenderGeometry
+static int         batch_enabled = 1;
+static size_t      batch_quads;
+static SDL_Texture *batch_texture;
+static SDL_Vertex  *batch_vertices;
+static int         *batch_indices;
+static size_t      draw_calls, frame_draw_calls;
+
+// World to screen transform applied to every quad, identity inside render targets
+static float       view_x, view_y, view_zoom = 1;
+static float       saved_view_x, saved_view_y, saved_view_zoom;
+static int         clip_w, clip_h, saved_clip_w, saved_clip_h;
+
+// Asset tables, sized once by game_init_assets and freed with the game
+static Arena       asset_arena;
+static Pack        asset_pack;
+
 static size_t      num_textures;
-static const char  **tex_map;
+static HashMap     tex_map;
 static SDL_Texture **textures;
+static SDL_Point   *tex_sizes;
 
 static size_t      num_sprites;
-static const char  **spr_map;
+static HashMap     spr_map;
 static SDL_Rect    *sprites;
 static size_t      *spr_ids;
 
 static size_t      num_fonts;
-static const char  **font_map;
+static HashMap     font_map;
 static SDL_Texture **fonts;
+static SDL_Point   *font_sizes;
 static SDL_Rect    *font_rects;
 
 static size_t     num_audio;
-static const char **audio_map;
+static HashMap    audio_map;
 static Mix_Chunk  **audios;
 
+// Logical size, cached so the simulation thread never calls into the renderer
+static int         logical_w, logical_h;
+
+static Level *current_level;
 static Scene *current_scene;
 
+// The simulation runs on its own thread and hands render snapshots to the main
+// thread, which polls events and draws. Input goes the other way through a
+// single producer, single consumer ring.
+typedef struct {
+  int key, pressed;
+}
+GameInput;
+
+static SDL_Thread     *sim_thread;
+static SDL_atomic_t   sim_quit;
+static int            sim_tick_rate;
+static SnapshotBuffer snapshots;
+static SDL_atomic_t   input_head, input_tail;
+static GameInput      inputs[GAME_INPUT_SIZE];
+
+static Hud hud;
+
+// Set by game_record, filled by the simulation thread
+static const char *record_file;
+static ReplayLog  record;
+
+// Simulation thread only
+static SceneSave quick_save;
+
+static int  game_simulate(void *data);
+static void game_push_input(int key, int pressed);
+
+static SDL_Texture *game_load_texture(const char *file);
+static TTF_Font    *game_open_font(const char *file, int ptsize);
+static Mix_Chunk   *game_load_audio(const char *file);
+
+static void game_batch_quad(SDL_Texture *tex, SDL_Point tex_size, const SDL_Rect *src,
+                            float x, float y, float w, float h, float a, SDL_Color color);
+
 void
 game_init_system(int ww, int wh, int lw, int lh, const char *title)
 {
@@ -39,6 +128,7 @@ game_init_system(int ww, int wh, int lw, int lh, const char *title)
   {
     DEBUG_ASSERT(0, "Can't init SDL! SDL_Error:\n%s", SDL_GetError());
   }
+  simd_init();
   window = SDL_CreateWindow(
     title,
     SDL_WINDOWPOS_CENTERED,
@@ -52,7 +142,8 @@ game_init_system(int ww, int wh, int lw, int lh, const char *title)
     SDL_Quit();
     DEBUG_ASSERT(0, "Can't create window! SDL_Error:\n%s", SDL_GetError());
   }
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  // Waiting for vsync only holds up the main thread, the simulation has its own
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
   if (renderer == NULL)
   {
     DEBUG_WARNING("Switching to software renderer");
@@ -65,6 +156,29 @@ game_init_system(int ww, int wh, int lw, int lh, const char *title)
   }
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
   SDL_RenderSetLogicalSize(renderer, lw, lh);
+  logical_w = lw;
+  logical_h = lh;
+  clip_w = lw;
+  clip_h = lh;
+
+  // Index buffer never changes, two triangles per quad
+  batch_vertices = malloc(BATCH_QUADS * 4 * sizeof(SDL_Vertex));
+  batch_indices  = malloc(BATCH_QUADS * 6 * sizeof(int));
+  if (batch_vertices == NULL || batch_indices == NULL)
+  {
+    SDL_Quit();
+    DEBUG_ASSERT(0, "Can't allocate space for sprite batch!");
+  }
+  for (int i = 0; i < BATCH_QUADS; i++)
+  {
+    int *q = &batch_indices[i * 6];
+    q[0] = i * 4 + 0;
+    q[1] = i * 4 + 1;
+    q[2] = i * 4 + 2;
+    q[3] = i * 4 + 2;
+    q[4] = i * 4 + 3;
+    q[5] = i * 4 + 0;
+  }
 
   if ((IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == 0)
   {
@@ -77,7 +191,7 @@ game_init_system(int ww, int wh, int lw, int lh, const char *title)
     SDL_Quit();
     DEBUG_ASSERT(0, "Can't init SDL_ttf! TTF_Error:\n%s", TTF_GetError());
   }
-  if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0)
+  if (Mix_OpenAudio(GAME_AUDIO_FREQ, MIX_DEFAULT_FORMAT, GAME_AUDIO_CHANNELS, 2048) < 0)
   {
     DEBUG_ERROR("Can't init SDL_mixer! Mix_Error:\n%s", Mix_GetError());
   }
@@ -86,6 +200,18 @@ game_init_system(int ww, int wh, int lw, int lh, const char *title)
   DEBUG_TRACE("System init end");
 }
 
+int
+game_open_asset_pack(const char *file)
+{
+  pack_close(&asset_pack);
+  if (pack_open(&asset_pack, file) != 0)
+  {
+    DEBUG_WARNING("Loading assets from their own files");
+    return -1;
+  }
+  return 0;
+}
+
 void
 game_init_assets(TextureSource *t_src, size_t t_size,
                  SpriteSource  *s_src, size_t s_size,
@@ -93,67 +219,92 @@ game_init_assets(TextureSource *t_src, size_t t_size,
                  AudioSource   *a_src, size_t a_size)
 {
   DEBUG_TRACE("Asset init start");
+  PROF_THREAD("main");
+
+  // Headless runs only need the keys, ids stay the same as with a window
+  int headless = renderer == NULL;
+  PROF_BEGIN("game_init_assets");
+  arena_init(&asset_arena, GAME_ASSET_RESERVE);
 
   // Textures
+  PROF_BEGIN("textures");
   num_textures = t_size / sizeof(TextureSource);
 
-  tex_map  = calloc(num_textures, sizeof(char *));
-  textures = calloc(num_textures, sizeof(SDL_Texture *));
+  hash_map_init(&tex_map, num_textures);
+  textures  = arena_calloc(&asset_arena, num_textures, sizeof(SDL_Texture *));
+  tex_sizes = arena_calloc(&asset_arena, num_textures, sizeof(SDL_Point));
 
-  if (tex_map == NULL || textures == NULL)
+  if (textures == NULL || tex_sizes == NULL)
   {
     game_free();
     DEBUG_ASSERT(0, "Can't allocate space for textures!");
   }
   for (size_t i = 0; i < num_textures; i++)
   {
-    tex_map[i] = t_src[i].key;
-    textures[i] = IMG_LoadTexture(renderer, t_src[i].file);
+    hash_map_put(&tex_map, t_src[i].key, (int)i);
+    if (headless)
+    {
+      continue;
+    }
+    textures[i] = game_load_texture(t_src[i].file);
     if (textures[i] == NULL)
     {
       DEBUG_ERROR("Can't load texture! SDL_Error:\n%s", SDL_GetError());
+      continue;
     }
+    SDL_QueryTexture(textures[i], NULL, NULL, &tex_sizes[i].x, &tex_sizes[i].y);
   }
+  PROF_END();
 
   // Sprites
   num_sprites = s_size / sizeof(SpriteSource);
 
-  spr_map = calloc(num_sprites, sizeof(char *));
-  sprites = calloc(num_sprites, sizeof(SDL_Rect));
-  spr_ids = calloc(num_sprites, sizeof(size_t));
+  hash_map_init(&spr_map, num_sprites);
+  sprites = arena_calloc(&asset_arena, num_sprites, sizeof(SDL_Rect));
+  spr_ids = arena_calloc(&asset_arena, num_sprites, sizeof(size_t));
 
-  if (spr_map == NULL || spr_ids == NULL || sprites == NULL)
+  if (spr_ids == NULL || sprites == NULL)
   {
     game_free();
     DEBUG_ASSERT(0, "Can't allocate space for sprites!");
   }
   for (size_t i = 0; i < num_sprites; i++)
   {
-    spr_map[i] = s_src[i].key;
+    hash_map_put(&spr_map, s_src[i].key, (int)i);
     sprites[i] = s_src[i].rect;
-    int tex_id = binary_search(tex_map, num_textures, s_src[i].tex);
+    int tex_id = hash_map_get(&tex_map, s_src[i].tex);
     if (tex_id != -1)
     {
       spr_ids[i] = (size_t)tex_id;
     }
+    else
+    {
+      DEBUG_ERROR("Can't find texture %s for sprite %s", s_src[i].tex, s_src[i].key);
+    }
   }
 
   // Fonts
+  PROF_BEGIN("fonts");
   num_fonts = f_size / sizeof(FontSource);
 
-  font_map   = calloc(num_fonts, sizeof(char *));
-  fonts      = calloc(num_fonts, sizeof(SDL_Texture *));
-  font_rects = calloc(num_fonts * (127 - ' '), sizeof(SDL_Rect));
+  hash_map_init(&font_map, num_fonts);
+  fonts      = arena_calloc(&asset_arena, num_fonts, sizeof(SDL_Texture *));
+  font_sizes = arena_calloc(&asset_arena, num_fonts, sizeof(SDL_Point));
+  font_rects = arena_calloc(&asset_arena, num_fonts * (127 - ' '), sizeof(SDL_Rect));
 
-  if (font_map == NULL || fonts == NULL || font_rects == NULL)
+  if (fonts == NULL || font_sizes == NULL || font_rects == NULL)
   {
     game_free();
     DEBUG_ASSERT(0, "Can't allocate space for fonts!");
   }
   for (size_t i = 0; i < num_fonts; i++)
   {
-    font_map[i] = f_src[i].key;
-    TTF_Font *font = TTF_OpenFont(f_src[i].file, f_src[i].ptsize);
+    hash_map_put(&font_map, f_src[i].key, (int)i);
+    if (headless)
+    {
+      continue;
+    }
+    TTF_Font *font = game_open_font(f_src[i].file, f_src[i].ptsize);
     if (font == NULL)
     {
       DEBUG_ERROR("Can't load font! TTF_Error:\n%s", TTF_GetError());
@@ -204,30 +355,40 @@ game_init_assets(TextureSource *t_src, size_t t_size,
       DEBUG_ERROR("Can't load charset texture! SDL_Error:\n%s", SDL_GetError());
     }
     SDL_SetTextureBlendMode(fonts[i], SDL_BLENDMODE_ADD);
+    font_sizes[i] = (SDL_Point){charset_width, charset_height};
     TTF_CloseFont(font);
     SDL_FreeSurface(charset_full);
   }
+  PROF_END();
 
   // Audio
+  PROF_BEGIN("audio");
   num_audio = a_size / sizeof(AudioSource);
 
-  audio_map = calloc(num_audio, sizeof(char *));
-  audios    = calloc(num_audio, sizeof(Mix_Chunk *));
+  hash_map_init(&audio_map, num_audio);
+  audios = arena_calloc(&asset_arena, num_audio, sizeof(Mix_Chunk *));
 
-  if (audio_map == NULL || audios == NULL)
+  if (audios == NULL)
   {
     game_free();
     DEBUG_ASSERT(0, "Can't allocate space for audio!");
   }
   for (size_t i = 0; i < num_audio; i++)
   {
-    audio_map[i] = a_src[i].key;
-    audios[i] = Mix_LoadWAV(a_src[i].file);
+    hash_map_put(&audio_map, a_src[i].key, (int)i);
+    if (headless)
+    {
+      continue;
+    }
+    audios[i] = game_load_audio(a_src[i].file);
     if (audios[i] == NULL)
     {
       DEBUG_ERROR("Can't load audio! Mix_Error:\n%s", Mix_GetError());
     }
   }
+  PROF_END();
+
+  PROF_END();
 
   DEBUG_TRACE("Asset init end");
 }
@@ -235,32 +396,52 @@ game_init_assets(TextureSource *t_src, size_t t_size,
 void
 game_init_scene()
 {
-  size_t w, h;
-  uint8_t *brick_data = level_load("lvl/00", &w, &h);
-
-  current_scene = scene_init(brick_data, w, h);
-  free(brick_data);
+  PROF_BEGIN("level_load");
+  current_level = level_load("lvl/00");
+  PROF_END();
+  DEBUG_ASSERT(current_level, "Can't load level lvl/00");
+
+  PROF_BEGIN("scene_init");
+  current_scene = scene_init(current_level);
+  PROF_END();
 }
 
 void
 game_run(int tick_rate)
 {
-  uint64_t tick_counter = 0;
+  uint64_t freq = SDL_GetPerformanceFrequency();
+
+  // The first snapshot is ready before the simulation starts
+  snapshot_buffer_init(&snapshots);
+  RenderSnapshot *first = snapshot_begin_write(&snapshots);
+  scene_snapshot(current_scene, first);
+  first->stamp = SDL_GetPerformanceCounter();
+  snapshot_publish(&snapshots);
+
+  // Recording needs chunk loads that don't depend on the loader's timing, or
+  // replays could see different collision geometry
+  if (record_file != NULL)
+  {
+    replay_init(&record, tick_rate, GAME_REPLAY_HASH_INTERVAL, logical_w, logical_h,
+                hash_bytes(current_level->data, current_level->size));
+    current_scene->stream_wait = 1;
+  }
+
+  // The overlay uses the first font
+  hud_init(&hud, num_fonts > 0 ? 0 : ASSET_NONE);
+  uint64_t last_frame = SDL_GetPerformanceCounter();
+  uint64_t last_tick = first->tick;
 
-  float tick_time     = 1.0f / tick_rate;
-  float current_time  = 0.0f;
-  float previous_time = 0.0f;
-  float delta_time    = 0.0f;
-  float lag_time      = 0.0f;
+  sim_tick_rate = tick_rate;
+  SDL_AtomicSet(&sim_quit, 0);
+  sim_thread = SDL_CreateThread(game_simulate, "simulation", NULL);
+  DEBUG_ASSERT(sim_thread, "Can't create simulation thread! SDL_Error:\n%s", SDL_GetError());
 
   int is_running = 1;
   while (is_running)
   {
-    // Time
-    current_time  = (float)SDL_GetTicks() / 1000.0f;
-    delta_time    = current_time - previous_time;
-    previous_time = current_time;
-    lag_time     += delta_time;
+    PROF_BEGIN("frame");
+    uint64_t frame_start = SDL_GetPerformanceCounter();
 
     // Events and input
     SDL_Event event;
@@ -276,33 +457,149 @@ game_run(int tick_rate)
         {
           break;
         }
-        scene_input_key(current_scene, event.key.keysym.sym, event.key.state);
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F9)
+        {
+          prof_dump(GAME_PROFILE_FILE);
+        }
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == GAME_HUD_KEY)
+        {
+          hud_toggle(&hud);
+        }
+        game_push_input(event.key.keysym.sym, event.key.state);
       }
     }
 
-    // Update
-    while (lag_time >= tick_time)
-    {
-      scene_update(current_scene, tick_time, current_time);
+    // Render the newest snapshot, alpha is how far into the next tick this frame is
+    const RenderSnapshot *snap = snapshot_read(&snapshots);
+    uint64_t now = SDL_GetPerformanceCounter();
+    double alpha = now > snap->stamp ? (double)(now - snap->stamp) * tick_rate / freq : 0;
+    uint64_t render_start = SDL_GetPerformanceCounter();
+    game_begin_frame();
+    scene_render(current_scene, snap, alpha < 1 ? (float)alpha : 1);
+    game_set_view(0, 0, 1);
+    hud_draw(&hud);
+    game_flush_sprites();
+    uint64_t present_start = SDL_GetPerformanceCounter();
+    game_end_frame();
+    uint64_t frame_end = SDL_GetPerformanceCounter();
+
+    double ms = 1000.0 / freq;
+    HudStats stats;
+    stats.frame_ms = (float)((frame_start - last_frame) * ms);
+    stats.update_ms = snap->ticks > 0 ? (float)(snap->update_time * ms / snap->ticks) : 0;
+    stats.render_ms = (float)((present_start - render_start) * ms);
+    stats.present_ms = (float)((frame_end - present_start) * ms);
+    stats.ticks = (uint32_t)(snap->tick - last_tick);
+    stats.entities = snap->entities;
+    stats.draw_calls = game_get_draw_calls();
+    hud_frame(&hud, &stats);
+    last_frame = frame_start;
+    last_tick = snap->tick;
+
+    PROF_END();
+  }
 
-      lag_time -= tick_time;
-      tick_counter++;
-    }
+  SDL_AtomicSet(&sim_quit, 1);
+  SDL_WaitThread(sim_thread, NULL);
+  sim_thread = NULL;
+  snapshot_buffer_free(&snapshots);
 
-    // Render
-    SDL_SetRenderDrawColor(renderer, 0x40, 0x80, 0xd0, 0xff);
-    SDL_RenderClear(renderer);
+  if (record_file != NULL)
+  {
+    replay_save(&record, record_file);
+    replay_free(&record);
+  }
+}
 
-    scene_render(current_scene, delta_time, current_time);
+void
+game_init_headless(int lw, int lh)
+{
+  DEBUG_TRACE("Headless init");
 
-    SDL_RenderPresent(renderer);
+  if (SDL_Init(0) != 0)
+  {
+    DEBUG_ASSERT(0, "Can't init SDL! SDL_Error:\n%s", SDL_GetError());
   }
+  simd_init();
+  logical_w = lw;
+  logical_h = lh;
+  clip_w = lw;
+  clip_h = lh;
+}
+
+void
+game_record(const char *file)
+{
+  record_file = file;
+}
+
+int
+game_replay(const char *file)
+{
+  ReplayLog r;
+  if (replay_load(&r, file) != 0)
+  {
+    return -1;
+  }
+  if (r.level_hash != hash_bytes(current_level->data, current_level->size))
+  {
+    replay_free(&r);
+    ERROR_RETURN(-1, "Replay %s was recorded on a different level", file);
+  }
+  if (r.view_w != (uint32_t)logical_w || r.view_h != (uint32_t)logical_h)
+  {
+    replay_free(&r);
+    ERROR_RETURN(-1, "Replay %s was recorded with a %ux%u view", file, r.view_w, r.view_h);
+  }
+
+  current_scene->stream_wait = 1;
+  float tick_time = 1.0f / r.tick_rate;
+  size_t checked = 0, mismatches = 0;
+  uint64_t first_mismatch = 0;
+
+  uint64_t start = SDL_GetPerformanceCounter();
+  for (uint64_t tick = 0; tick < r.num_ticks; tick++)
+  {
+    scene_set_input(current_scene, replay_next(&r));
+    scene_update(current_scene, tick_time, tick);
+
+    if ((tick + 1) % r.hash_interval == 0 && checked < r.num_hashes)
+    {
+      if (scene_hash(current_scene) != r.hashes[checked] && mismatches++ == 0)
+      {
+        first_mismatch = tick;
+      }
+      checked++;
+    }
+  }
+  double secs = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+  // Printed in every build, replays double as a benchmark
+  printf("Replay %s: %llu ticks in %.3f s, %.0f ticks/s, %zu/%zu hashes match\n", file,
+         (unsigned long long)r.num_ticks, secs, secs > 0 ? r.num_ticks / secs : 0,
+         checked - mismatches, r.num_hashes);
+  if (mismatches > 0)
+  {
+    printf("First mismatch after tick %llu\n", (unsigned long long)first_mismatch);
+  }
+
+  int result = mismatches == 0 && checked == r.num_hashes ? 0 : -1;
+  replay_free(&r);
+  return result;
 }
 
 void
 game_free()
 {
-  scene_free(current_scene);
+  if (current_scene != NULL)
+  {
+    scene_free(current_scene);
+  }
+  scene_save_free(&quick_save);
+  if (current_level != NULL)
+  {
+    level_free(current_level);
+  }
 
   DEBUG_TRACE("Asset free");
 
@@ -319,73 +616,94 @@ game_free()
     Mix_FreeChunk(audios[i]);
   }
 
-  free(tex_map);
-  free(textures);
+  hash_map_free(&tex_map);
+  hash_map_free(&spr_map);
+  hash_map_free(&font_map);
+  hash_map_free(&audio_map);
+  arena_free(&asset_arena);
+  // Sounds from the pack play straight from its mapping
+  pack_close(&asset_pack);
 
-  free(spr_map);
-  free(sprites);
-  free(spr_ids);
-
-  free(font_map);
-  free(fonts);
-  free(font_rects);
+  DEBUG_TRACE("System free");
 
-  free(audio_map);
-  free(audios);
+  free(batch_vertices);
+  free(batch_indices);
 
-  DEBUG_TRACE("System free");
+  if (renderer != NULL)
+  {
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+  }
 
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
+  prof_free();
 
   Mix_Quit();
   TTF_Quit();
   IMG_Quit();
   SDL_Quit();
+
+  mem_trim();
 }
 
-void
-game_draw_sprite(const char *sprite, float x, float y, float sx, float sy, float a)
+SpriteId
+game_sprite_id(const char *key)
 {
-  if (sprite == NULL)
+  int id = hash_map_get(&spr_map, key);
+  if (id == -1)
   {
-    ERROR_RETURN(, "No sprite provided!");
+    ERROR_RETURN(ASSET_NONE, "Can't find sprite: %s", key);
   }
+  return id;
+}
 
-  int si = binary_search(spr_map, num_sprites, sprite);
-  if (si == -1)
+FontId
+game_font_id(const char *key)
+{
+  int id = hash_map_get(&font_map, key);
+  if (id == -1)
   {
-    ERROR_RETURN(, "Can't find sprite: %s", sprite);
+    ERROR_RETURN(ASSET_NONE, "Can't find font: %s", key);
   }
+  return id;
+}
 
-  SDL_FRect dest = {
-    x - sprites[si].w / 2.0 * sx,
-    y - sprites[si].h / 2.0 * sy,
-    sprites[si].w * sx,
-    sprites[si].h * sy,
-  };
-  SDL_RenderCopyExF(renderer, textures[spr_ids[si]], &sprites[si], &dest, a, NULL, SDL_FLIP_NONE);
+AudioId
+game_audio_id(const char *key)
+{
+  int id = hash_map_get(&audio_map, key);
+  if (id == -1)
+  {
+    ERROR_RETURN(ASSET_NONE, "Can't find audio: %s", key);
+  }
+  return id;
 }
 
+void
+game_draw_sprite(SpriteId si, float x, float y, float sx, float sy, float a)
+{
+  if (si < 0 || (size_t)si >= num_sprites)
+  {
+    ERROR_RETURN(, "Invalid sprite id %d", si);
+  }
+
+  float w = sprites[si].w * sx;
+  float h = sprites[si].h * sy;
+  game_batch_quad(textures[spr_ids[si]], tex_sizes[spr_ids[si]], &sprites[si], x - w / 2, y - h / 2, w, h, a,
+                  (SDL_Color){255, 255, 255, 255});
+}
 
 void
-game_draw_text(const char *font, const char *text, float x, float y, float sx, float sy, float ox, float oy)
+game_draw_text(FontId fi, const char *text, float x, float y, float sx, float sy, float ox, float oy)
 {
-  if (font == NULL)
+  if (fi < 0 || (size_t)fi >= num_fonts)
   {
-    ERROR_RETURN(, "No font provided!");
+    ERROR_RETURN(, "Invalid font id %d", fi);
   }
   if (ox > 1 || ox < 0 || oy > 1 || oy < 0)
   {
     DEBUG_WARNING("Offets should be in the range of [0,1], 0 -> left/top, 1 -> right/bottom alignment");
   }
 
-  int fi = binary_search(font_map, num_fonts, font);
-  if (fi == -1)
-  {
-    ERROR_RETURN(, "Can't find font: %s", font);
-  }
-
   int offset_x = 0, offset_y = 0;
 
   if (ox != 0)
@@ -400,8 +718,7 @@ game_draw_text(const char *font, const char *text, float x, float y, float sx, f
 
   if (oy != 0)
   {
-    SDL_QueryTexture(fonts[fi], NULL, NULL, NULL, &offset_y);
-    offset_y *= -oy;
+    offset_y = font_sizes[fi].y * -oy;
   }
 
   offset_x *= sx;
@@ -410,31 +727,399 @@ game_draw_text(const char *font, const char *text, float x, float y, float sx, f
   for (size_t i = 0; text[i]; i++)
   {
     size_t ri = fi * (127 - ' ') + text[i] - ' ';
-    SDL_FRect dest = {
-      x + offset_x,
-      y + offset_y,
-      font_rects[ri].w * sx,
-      font_rects[ri].h * sy,
-    };
-    SDL_RenderCopyF(renderer, fonts[fi], &font_rects[ri], &dest);
+    float w = font_rects[ri].w * sx;
+    float h = font_rects[ri].h * sy;
+    game_batch_quad(fonts[fi], font_sizes[fi], &font_rects[ri], x + offset_x, y + offset_y, w, h, 0,
+                    (SDL_Color){255, 255, 255, 255});
+
+    offset_x += w;
+  }
+}
+
+void
+game_draw_rect(float x, float y, float w, float h, SDL_Color color)
+{
+  // Batched with texture NULL, SDL_RenderGeometry then only uses vertex colors
+  SDL_Rect src = {0, 0, 1, 1};
+  game_batch_quad(NULL, (SDL_Point){1, 1}, &src, x, y, w, h, 0, color);
+}
+
+void
+game_play_audio(AudioId ai, int loops)
+{
+  if (ai < 0 || (size_t)ai >= num_audio)
+  {
+    ERROR_RETURN(, "Invalid audio id %d", ai);
+  }
+
+  Mix_PlayChannel(-1, audios[ai], loops);
+}
+
+void
+game_begin_frame()
+{
+  SDL_SetRenderDrawColor(renderer, 0x40, 0x80, 0xd0, 0xff);
+  SDL_RenderClear(renderer);
+}
 
-    offset_x += dest.w;
+void
+game_end_frame()
+{
+  game_flush_sprites();
+  PROF_BEGIN("present");
+  SDL_RenderPresent(renderer);
+  PROF_END();
+
+  frame_draw_calls = draw_calls;
+  draw_calls = 0;
+}
+
+void
+game_get_view_size(int *w, int *h)
+{
+  *w = logical_w;
+  *h = logical_h;
+}
+
+SDL_Texture *
+game_create_target(int w, int h)
+{
+  SDL_Texture *target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+  if (target == NULL)
+  {
+    ERROR_RETURN(NULL, "Can't create render target! SDL_Error:\n%s", SDL_GetError());
   }
+  SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+  return target;
 }
 
 void
-game_play_audio(const char *aud, int loops)
+game_begin_target(SDL_Texture *target)
 {
-  if (aud == NULL)
+  game_flush_sprites();
+  SDL_SetRenderTarget(renderer, target);
+
+  saved_view_x = view_x;
+  saved_view_y = view_y;
+  saved_view_zoom = view_zoom;
+  saved_clip_w = clip_w;
+  saved_clip_h = clip_h;
+  game_set_view(0, 0, 1);
+  SDL_QueryTexture(target, NULL, NULL, &clip_w, &clip_h);
+
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+  SDL_RenderClear(renderer);
+}
+
+void
+game_end_target()
+{
+  game_flush_sprites();
+  SDL_SetRenderTarget(renderer, NULL);
+  game_set_view(saved_view_x, saved_view_y, saved_view_zoom);
+  clip_w = saved_clip_w;
+  clip_h = saved_clip_h;
+}
+
+void
+game_set_view(float x, float y, float zoom)
+{
+  view_x = x;
+  view_y = y;
+  view_zoom = zoom;
+}
+
+void
+game_draw_texture(SDL_Texture *tex, float x, float y)
+{
+  if (tex == NULL)
   {
-    ERROR_RETURN(, "No audio provided!");
+    ERROR_RETURN(, "No texture provided!");
   }
 
-  int ai = binary_search(audio_map, num_audio, aud);
-  if (ai == -1)
+  SDL_Point size;
+  SDL_QueryTexture(tex, NULL, NULL, &size.x, &size.y);
+
+  SDL_Rect src = {0, 0, size.x, size.y};
+  game_batch_quad(tex, size, &src, x, y, size.x, size.y, 0, (SDL_Color){255, 255, 255, 255});
+}
+
+void
+game_flush_sprites()
+{
+  if (batch_quads == 0)
   {
-    ERROR_RETURN(, "Can't find audio: %s", aud);
+    return;
   }
 
-  Mix_PlayChannel(-1, audios[ai], loops);
+  SDL_RenderGeometry(renderer, batch_texture, batch_vertices, batch_quads * 4, batch_indices, batch_quads * 6);
+  draw_calls++;
+  batch_quads = 0;
+}
+
+void
+game_set_sprite_batching(int enabled)
+{
+  game_flush_sprites();
+  batch_enabled = enabled;
+}
+
+size_t
+game_get_draw_calls()
+{
+  return frame_draw_calls;
+}
+
+static int
+game_simulate(void *data)
+{
+  PROF_THREAD("simulation");
+
+  uint64_t tick_counter = 0;
+  int tick_rate = sim_tick_rate;
+  float tick_time = 1.0f / tick_rate;
+
+  // Time is kept in performance counter units scaled by the tick rate, one
+  // tick is exactly freq of them and nothing is lost to rounding
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  uint64_t max_lag = (uint64_t)ceil(GAME_MAX_CATCHUP * tick_rate) * freq;
+  uint64_t previous_count = SDL_GetPerformanceCounter();
+  uint64_t lag = 0;
+
+  while (SDL_AtomicGet(&sim_quit) == 0)
+  {
+    uint64_t current_count = SDL_GetPerformanceCounter();
+    uint64_t delta_count = current_count - previous_count;
+    previous_count = current_count;
+    lag += delta_count * tick_rate;
+    if (lag > max_lag)
+    {
+      DEBUG_WARNING("Dropping %.3f s after a stall", (double)(lag - max_lag) / tick_rate / freq);
+      lag = max_lag;
+    }
+
+    uint32_t ticked = 0;
+    uint64_t update_time = 0;
+    while (lag >= freq)
+    {
+      PROF_BEGIN("tick");
+
+      // Input reaches the scene between ticks only
+      int tail = SDL_AtomicGet(&input_tail);
+      for (int head = SDL_AtomicGet(&input_head); tail != head; tail = (tail + 1) % GAME_INPUT_SIZE)
+      {
+        if (inputs[tail].key == GAME_SAVE_KEY && inputs[tail].pressed)
+        {
+          scene_save(current_scene, &quick_save);
+        }
+        if (inputs[tail].key == GAME_LOAD_KEY && inputs[tail].pressed && quick_save.ecs.size > 0)
+        {
+          // A recording only holds input, it couldn't replay the load
+          if (record_file != NULL)
+          {
+            DEBUG_WARNING("Can't load while recording");
+          }
+          else
+          {
+            scene_load(current_scene, &quick_save);
+          }
+        }
+        scene_input_key(current_scene, inputs[tail].key, inputs[tail].pressed);
+      }
+      SDL_AtomicSet(&input_tail, tail);
+      if (record_file != NULL)
+      {
+        replay_record(&record, scene_get_input(current_scene));
+      }
+
+      uint64_t update_start = SDL_GetPerformanceCounter();
+      scene_update(current_scene, tick_time, tick_counter);
+      update_time += SDL_GetPerformanceCounter() - update_start;
+      if (record_file != NULL && record.num_ticks % record.hash_interval == 0)
+      {
+        replay_record_hash(&record, scene_hash(current_scene));
+      }
+
+      lag -= freq;
+      tick_counter++;
+      ticked++;
+      PROF_END();
+    }
+
+    if (ticked)
+    {
+      PROF_BEGIN("snapshot");
+      RenderSnapshot *snap = snapshot_begin_write(&snapshots);
+      scene_snapshot(current_scene, snap);
+      snap->tick = tick_counter;
+      snap->stamp = current_count - lag / tick_rate;
+      snap->ticks = ticked;
+      snap->update_time = update_time;
+      snapshot_publish(&snapshots);
+      PROF_END();
+    }
+
+    // Sleep until about the next tick, SDL_Delay can oversleep by a millisecond
+    uint64_t wait_ms = (freq - lag) * 1000 / ((uint64_t)tick_rate * freq);
+    if (wait_ms > 1)
+    {
+      SDL_Delay((uint32_t)wait_ms - 1);
+    }
+  }
+
+  return 0;
+}
+
+static void
+game_push_input(int key, int pressed)
+{
+  int head = SDL_AtomicGet(&input_head);
+  int next = (head + 1) % GAME_INPUT_SIZE;
+  if (next == SDL_AtomicGet(&input_tail))
+  {
+    ERROR_RETURN(, "Input queue full, dropping key %d", key);
+  }
+  inputs[head] = (GameInput){key, pressed};
+  SDL_AtomicSet(&input_head, next);
+}
+
+// Pack entries decoded by the packer are uploaded or played as they are, any
+// other entry goes through the loader its file would have
+static SDL_Texture *
+game_load_texture(const char *file)
+{
+  PackEntry e;
+  if (pack_find(&asset_pack, file, &e) != 0)
+  {
+    return IMG_LoadTexture(renderer, file);
+  }
+  if (e.type != PackType_Rgba)
+  {
+    return IMG_LoadTexture_RW(renderer, SDL_RWFromConstMem(e.data, (int)e.size), 1);
+  }
+
+  uint32_t w, h, pitch;
+  const uint8_t *pixels = pack_rgba(&e, &w, &h, &pitch);
+  if (pixels == NULL)
+  {
+    SDL_SetError("Broken image %s in asset pack", file);
+    return NULL;
+  }
+
+  // RGBA32 is R, G, B, A in memory whatever the byte order, like the pack
+  SDL_Texture *tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, (int)w, (int)h);
+  if (tex == NULL)
+  {
+    return NULL;
+  }
+  if (SDL_UpdateTexture(tex, NULL, pixels, (int)pitch) != 0)
+  {
+    SDL_DestroyTexture(tex);
+    return NULL;
+  }
+  // IMG_LoadTexture blends images with alpha too
+  SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+  return tex;
+}
+
+static TTF_Font *
+game_open_font(const char *file, int ptsize)
+{
+  PackEntry e;
+  if (pack_find(&asset_pack, file, &e) != 0)
+  {
+    return TTF_OpenFont(file, ptsize);
+  }
+  return TTF_OpenFontRW(SDL_RWFromConstMem(e.data, (int)e.size), 1, ptsize);
+}
+
+static Mix_Chunk *
+game_load_audio(const char *file)
+{
+  PackEntry e;
+  if (pack_find(&asset_pack, file, &e) != 0)
+  {
+    return Mix_LoadWAV(file);
+  }
+
+  // Samples in the device format play from the mapping without a copy, the
+  // mixer only reads them and doesn't free chunks it didn't allocate
+  int freq, channels;
+  Uint16 format;
+  uint32_t pcm_freq, pcm_channels;
+  size_t size;
+  const uint8_t *samples = pack_pcm(&e, &pcm_freq, &pcm_channels, &size);
+  if (samples != NULL && Mix_QuerySpec(&freq, &format, &channels) != 0 && format == AUDIO_S16LSB &&
+      (uint32_t)freq == pcm_freq && (uint32_t)channels == pcm_channels)
+  {
+    return Mix_QuickLoad_RAW((Uint8 *)samples, (Uint32)size);
+  }
+  return Mix_LoadWAV_RW(SDL_RWFromConstMem(e.data, (int)e.size), 1);
+}
+
+static void
+game_batch_quad(SDL_Texture *tex, SDL_Point tex_size, const SDL_Rect *src,
+                float x, float y, float w, float h, float a, SDL_Color color)
+{
+  x = (x - view_x) * view_zoom;
+  y = (y - view_y) * view_zoom;
+  w *= view_zoom;
+  h *= view_zoom;
+
+  // Quads entirely outside the view are dropped, the radius covers any rotation
+  float r = (fabsf(w) + fabsf(h)) / 2;
+  if (x + w / 2 + r < 0 || y + h / 2 + r < 0 || x + w / 2 - r > clip_w || y + h / 2 - r > clip_h)
+  {
+    return;
+  }
+
+  if (batch_enabled == 0)
+  {
+    SDL_FRect dest = {x, y, w, h};
+    if (tex == NULL)
+    {
+      SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderFillRectF(renderer, &dest);
+    }
+    else
+    {
+      SDL_RenderCopyExF(renderer, tex, src, &dest, a, NULL, SDL_FLIP_NONE);
+    }
+    draw_calls++;
+    return;
+  }
+
+  if (tex != batch_texture || batch_quads >= BATCH_QUADS)
+  {
+    game_flush_sprites();
+    batch_texture = tex;
+  }
+
+  // Corners relative to the quad center, rotated clockwise by a degrees like SDL_RenderCopyEx
+  float cx = x + w / 2, cy = y + h / 2;
+  float hw = w / 2, hh = h / 2;
+  float c = 1, s = 0;
+  if (a != 0)
+  {
+    c = cosf(a * 3.14159265f / 180.0f);
+    s = sinf(a * 3.14159265f / 180.0f);
+  }
+  float corners[4][2] = {{-hw, -hh}, {hw, -hh}, {hw, hh}, {-hw, hh}};
+
+  float u0 = (float)src->x / tex_size.x;
+  float v0 = (float)src->y / tex_size.y;
+  float u1 = (float)(src->x + src->w) / tex_size.x;
+  float v1 = (float)(src->y + src->h) / tex_size.y;
+  float uvs[4][2] = {{u0, v0}, {u1, v0}, {u1, v1}, {u0, v1}};
+
+  SDL_Vertex *v = &batch_vertices[batch_quads * 4];
+  for (int i = 0; i < 4; i++)
+  {
+    v[i].position.x = cx + corners[i][0] * c - corners[i][1] * s;
+    v[i].position.y = cy + corners[i][0] * s + corners[i][1] * c;
+    v[i].color = color;
+    v[i].tex_coord.x = uvs[i][0];
+    v[i].tex_coord.y = uvs[i][1];
+  }
+  batch_quads++;
 }
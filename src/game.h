@@ -5,6 +5,18 @@
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
 
+// Asset handles, looked up by key once with game_*_id and stored in components
+typedef int SpriteId;
+typedef int FontId;
+typedef int AudioId;
+
+#define ASSET_NONE -1
+
+// Mixer output, sounds in an asset pack are stored in this format so they can
+// be played straight from the mapped file
+#define GAME_AUDIO_FREQ     44100
+#define GAME_AUDIO_CHANNELS 2
+
 typedef struct {
   const char *key;
   const char *file;
@@ -32,6 +44,10 @@ typedef struct {
 AudioSource;
 
 void game_init_system(int ww, int wh, int lw, int lh, const char *title);
+// Loads assets from the pack in file, as written by the packer, where it has
+// them and from their own files otherwise. Called before game_init_assets,
+// returns -1 and leaves everything to the files when the pack can't be opened.
+int  game_open_asset_pack(const char *file);
 void game_init_assets(TextureSource *t_src, size_t t_size,
                       SpriteSource  *s_src, size_t s_size,
                       FontSource    *f_src, size_t f_size,
@@ -40,6 +56,46 @@ void game_init_scene();
 void game_run(int tick_rate);
 void game_free();
 
-void game_draw_sprite(const char *sprite, float x, float y, float sx, float sy, float a);
-void game_draw_text(const char *font, const char *text, float x, float y, float sx, float sy, float ox, float oy);
-void game_play_audio(const char *aud, int loops);
+// Replaces game_init_system for runs without a window, assets are only
+// registered by key and nothing can be drawn
+void game_init_headless(int lw, int lh);
+// Makes game_run record input per tick, with state hashes, and write it to
+// file when it returns
+void game_record(const char *file);
+// Feeds a recorded log through the scene as fast as possible and checks the
+// state hashes. Returns 0 when the replay matched the recording.
+int  game_replay(const char *file);
+
+SpriteId game_sprite_id(const char *key);
+FontId   game_font_id(const char *key);
+AudioId  game_audio_id(const char *key);
+
+void game_draw_sprite(SpriteId sprite, float x, float y, float sx, float sy, float a);
+void game_draw_text(FontId font, const char *text, float x, float y, float sx, float sy, float ox, float oy);
+// Untextured quad, x and y are the top left corner
+void game_draw_rect(float x, float y, float w, float h, SDL_Color color);
+void game_play_audio(AudioId aud, int loops);
+
+// Clears the screen, and flushes and presents everything drawn in between
+void game_begin_frame();
+void game_end_frame();
+
+// Logical view size set in game_init_system
+void game_get_view_size(int *w, int *h);
+
+// Offscreen render targets, drawing between begin and end goes into the target
+SDL_Texture *game_create_target(int w, int h);
+void game_begin_target(SDL_Texture *target);
+void game_end_target();
+void game_draw_texture(SDL_Texture *tex, float x, float y);
+
+// Everything drawn afterwards is offset so world point (x, y) lands on the top
+// left of the view and scaled by zoom. Render targets always draw untransformed.
+void game_set_view(float x, float y, float zoom);
+
+// Sprites and text are batched per texture, the batch is flushed on texture
+// changes and before presenting. Batching can be turned off for comparison.
+// Draw calls are counted for the last presented frame.
+void   game_flush_sprites();
+void   game_set_sprite_batching(int enabled);
+size_t game_get_draw_calls();
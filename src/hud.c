@@ -0,0 +1,138 @@
+#include "hud.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HUD_X          4.0f
+#define HUD_Y          4.0f
+#define HUD_TEXT_SCALE 0.3f
+#define HUD_LINE_H     11.0f
+#define HUD_WIDTH      150.0f
+
+// The graph spans twice the frame time of a 60 Hz display, one pixel per frame
+#define HUD_TARGET_MS (1000.0f / 60.0f)
+#define HUD_GRAPH_H   32.0f
+
+static void hud_refresh(Hud *h);
+static int  hud_compare(const void *a, const void *b);
+
+void
+hud_init(Hud *h, FontId font)
+{
+  memset(h, 0, sizeof(Hud));
+  h->font = font;
+}
+
+void
+hud_toggle(Hud *h)
+{
+  h->visible = !h->visible;
+  h->until_refresh = 0;
+}
+
+void
+hud_frame(Hud *h, const HudStats *stats)
+{
+  h->frames[h->next] = *stats;
+  h->next = (h->next + 1) % HUD_FRAMES;
+  if (h->num_frames < HUD_FRAMES)
+  {
+    h->num_frames++;
+  }
+}
+
+void
+hud_draw(Hud *h)
+{
+  if (h->visible == 0)
+  {
+    return;
+  }
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  if (h->until_refresh == 0)
+  {
+    hud_refresh(h);
+    h->until_refresh = HUD_REFRESH;
+  }
+  h->until_refresh--;
+
+  // Rectangles first and text after, two draw calls for the whole overlay
+  float graph_y = HUD_Y + HUD_LINES * HUD_LINE_H + 2;
+  game_draw_rect(HUD_X - 2, HUD_Y - 2, HUD_WIDTH, graph_y + HUD_GRAPH_H + 4 - HUD_Y, (SDL_Color){0, 0, 0, 255});
+
+  float px_per_ms = HUD_GRAPH_H / (2 * HUD_TARGET_MS);
+  game_draw_rect(HUD_X, graph_y + HUD_GRAPH_H - HUD_TARGET_MS * px_per_ms, HUD_FRAMES, 1,
+                 (SDL_Color){96, 96, 96, 255});
+
+  // Oldest frame on the left, frames missing the target in red
+  for (size_t i = 0; i < h->num_frames; i++)
+  {
+    const HudStats *f = &h->frames[(h->next + HUD_FRAMES - h->num_frames + i) % HUD_FRAMES];
+    float bar = f->frame_ms * px_per_ms;
+    bar = bar < HUD_GRAPH_H ? bar : HUD_GRAPH_H;
+    SDL_Color color = f->frame_ms > HUD_TARGET_MS * 1.5f ? (SDL_Color){224, 64, 64, 255} : (SDL_Color){64, 192, 64, 255};
+    game_draw_rect(HUD_X + i, graph_y + HUD_GRAPH_H - bar, 1, bar, color);
+  }
+
+  for (int i = 0; i < HUD_LINES && h->font != ASSET_NONE; i++)
+  {
+    game_draw_text(h->font, h->lines[i], HUD_X, HUD_Y + i * HUD_LINE_H, HUD_TEXT_SCALE, HUD_TEXT_SCALE, 0, 0);
+  }
+
+  h->cost = SDL_GetPerformanceCounter() - start;
+}
+
+static void
+hud_refresh(Hud *h)
+{
+  size_t n = h->num_frames;
+  if (n == 0)
+  {
+    for (int i = 0; i < HUD_LINES; i++)
+    {
+      h->lines[i][0] = '\0';
+    }
+    return;
+  }
+
+  float frame = 0, update = 0, render = 0, present = 0, ticks = 0;
+  float sorted[HUD_FRAMES];
+  for (size_t i = 0; i < n; i++)
+  {
+    const HudStats *f = &h->frames[i];
+    frame += f->frame_ms;
+    update += f->update_ms;
+    render += f->render_ms;
+    present += f->present_ms;
+    ticks += f->ticks;
+    sorted[i] = f->frame_ms;
+  }
+  qsort(sorted, n, sizeof(float), hud_compare);
+
+  // Nearest rank percentiles
+  float p50 = sorted[(n * 50 + 99) / 100 - 1];
+  float p99 = sorted[(n * 99 + 99) / 100 - 1];
+  const HudStats *last = &h->frames[(h->next + HUD_FRAMES - 1) % HUD_FRAMES];
+  double cost_ms = (double)h->cost * 1000 / SDL_GetPerformanceFrequency();
+  MemStats mem;
+  mem_get_stats(&mem);
+
+  snprintf(h->lines[0], HUD_LINE_SIZE, "%.0f fps  %.2f ticks/frame", frame > 0 ? 1000 * n / frame : 0, ticks / n);
+  snprintf(h->lines[1], HUD_LINE_SIZE, "update %.2f ms/tick", update / n);
+  snprintf(h->lines[2], HUD_LINE_SIZE, "render %.2f  present %.2f ms", render / n, present / n);
+  snprintf(h->lines[3], HUD_LINE_SIZE, "entities %zu  draws %zu", last->entities, last->draw_calls);
+  snprintf(h->lines[4], HUD_LINE_SIZE, "frame p50 %.2f  p99 %.2f ms", p50, p99);
+  snprintf(h->lines[5], HUD_LINE_SIZE, "hud %.3f ms", cost_ms);
+  snprintf(h->lines[6], HUD_LINE_SIZE, "committed %.1f MB  cached %.1f MB", mem.committed / 1048576.0,
+           mem.cached / 1048576.0);
+}
+
+static int
+hud_compare(const void *a, const void *b)
+{
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "game.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames kept for the graph and percentiles
+#define HUD_FRAMES 128
+
+// Numbers are redrawn from the latest window every HUD_REFRESH frames, so
+// they stay readable and sorting for percentiles doesn't happen every frame
+#define HUD_REFRESH 15
+
+#define HUD_LINES     7
+#define HUD_LINE_SIZE 48
+
+// Measurements for one presented frame, times in milliseconds
+typedef struct {
+  float frame_ms, update_ms, render_ms, present_ms;
+  uint32_t ticks;
+  size_t entities, draw_calls;
+}
+HudStats;
+
+// Performance overlay, it's fed and drawn by the render thread only
+typedef struct {
+  int visible;
+  FontId font;
+
+  size_t   num_frames, next;
+  HudStats frames[HUD_FRAMES];
+  size_t   until_refresh;
+  char     lines[HUD_LINES][HUD_LINE_SIZE];
+
+  // Performance counter time hud_draw took last frame
+  uint64_t cost;
+}
+Hud;
+
+void hud_init(Hud *h, FontId font);
+void hud_toggle(Hud *h);
+// Records a presented frame, cheap enough to call when hidden
+void hud_frame(Hud *h, const HudStats *stats);
+// Draws in view coordinates, call with the view reset
+void hud_draw(Hud *h);
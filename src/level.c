@@ -0,0 +1,659 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "level.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#define LEVEL_HEADER_SIZE  24
+#define LEVEL_ENTRY_SIZE   32
+#define LEVEL_TILE_HEADER  16
+#define LEVEL_SPWN_HEADER  8
+#define LEVEL_SPAWN_SIZE   16
+#define LEVEL_CHUNK_ENTRY  24
+#define LEVEL_CHUNK_BYTES  (LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES)
+
+static const char level_magic[4] = {'L', 'U', 'K', 'L'};
+
+static int      level_map(Level *l, const char *file);
+static void     level_unmap(Level *l);
+static int      level_parse(Level *l);
+static int      level_parse_legacy(Level *l);
+static size_t   level_encode_rle(const uint8_t *in, uint8_t *out);
+static size_t   level_encode_bits(const uint8_t *in, uint8_t *out);
+static int      level_decode_rle(const uint8_t *in, size_t size, uint8_t *out);
+static void     level_decode_bits(const uint8_t *in, uint8_t *out);
+static uint16_t level_u16(const uint8_t *p);
+static uint32_t level_u32(const uint8_t *p);
+static uint64_t level_u64(const uint8_t *p);
+static void     level_put_u16(uint8_t *p, uint16_t v);
+static void     level_put_u32(uint8_t *p, uint32_t v);
+static void     level_put_u64(uint8_t *p, uint64_t v);
+
+Level *
+level_load(const char *file)
+{
+  DEBUG_TRACE("Level load %s", file);
+
+  Level *l = calloc(1, sizeof(Level));
+  if (l == NULL)
+  {
+    ERROR_RETURN(NULL, "Can't allocate space for level");
+  }
+
+  if (level_map(l, file) != 0)
+  {
+    free(l);
+    return NULL;
+  }
+
+  int legacy = l->size < sizeof(level_magic) || memcmp(l->data, level_magic, sizeof(level_magic)) != 0;
+  if ((legacy ? level_parse_legacy(l) : level_parse(l)) != 0)
+  {
+    DEBUG_ERROR("Invalid level file %s", file);
+    level_free(l);
+    return NULL;
+  }
+
+  return l;
+}
+
+void
+level_free(Level *l)
+{
+  level_unmap(l);
+  free(l);
+}
+
+LevelSpawn
+level_get_spawn(const Level *l, size_t i)
+{
+  const uint8_t *p = l->spawns + i * LEVEL_SPAWN_SIZE;
+  LevelSpawn s = {
+    .type  = level_u32(p),
+    .flags = level_u32(p + 4),
+    .x     = (int32_t)level_u32(p + 8),
+    .y     = (int32_t)level_u32(p + 12),
+  };
+  return s;
+}
+
+int
+level_read_chunk(const Level *l, uint32_t cx, uint32_t cy, uint8_t *out)
+{
+  if (cx >= l->chunks_w || cy >= l->chunks_h)
+  {
+    ERROR_RETURN(-1, "Chunk %u, %u outside of level", cx, cy);
+  }
+
+  if (l->tiles != NULL)
+  {
+    memset(out, 0, LEVEL_CHUNK_BYTES);
+    uint32_t x0 = cx * LEVEL_CHUNK_TILES, y0 = cy * LEVEL_CHUNK_TILES;
+    uint32_t cw = l->w - x0 < LEVEL_CHUNK_TILES ? l->w - x0 : LEVEL_CHUNK_TILES;
+    for (uint32_t y = 0; y < LEVEL_CHUNK_TILES && y0 + y < l->h; y++)
+    {
+      memcpy(out + y * LEVEL_CHUNK_TILES, l->tiles + (size_t)(y0 + y) * l->w + x0, cw);
+    }
+    return 0;
+  }
+
+  const uint8_t *e = l->chunk_table + ((size_t)cy * l->chunks_w + cx) * LEVEL_CHUNK_ENTRY;
+  uint64_t offset = level_u64(e);
+  uint32_t size = level_u32(e + 8);
+  uint32_t codec = level_u32(e + 12);
+
+  if (size == 0)
+  {
+    memset(out, 0, LEVEL_CHUNK_BYTES);
+    return 0;
+  }
+  if (offset > l->chunk_data_size || size > l->chunk_data_size - offset)
+  {
+    ERROR_RETURN(-1, "Chunk %u, %u outside of tile data", cx, cy);
+  }
+
+  const uint8_t *p = l->chunk_data + offset;
+  if (hash_bytes(p, size) != level_u64(e + 16))
+  {
+    ERROR_RETURN(-1, "Chunk %u, %u checksum mismatch", cx, cy);
+  }
+
+  switch (codec)
+  {
+  case LevelCodec_Raw:
+    if (size != LEVEL_CHUNK_BYTES)
+    {
+      ERROR_RETURN(-1, "Chunk %u, %u has the wrong size", cx, cy);
+    }
+    memcpy(out, p, LEVEL_CHUNK_BYTES);
+    return 0;
+  case LevelCodec_Rle:
+    if (level_decode_rle(p, size, out) != 0)
+    {
+      ERROR_RETURN(-1, "Chunk %u, %u has broken runs", cx, cy);
+    }
+    return 0;
+  case LevelCodec_Bits:
+    if (size != LEVEL_CHUNK_BYTES / 8)
+    {
+      ERROR_RETURN(-1, "Chunk %u, %u has the wrong size", cx, cy);
+    }
+    level_decode_bits(p, out);
+    return 0;
+  default:
+    ERROR_RETURN(-1, "Chunk %u, %u has unknown codec %u", cx, cy, codec);
+  }
+}
+
+int
+level_write(const char *file, uint32_t w, uint32_t h, const uint8_t *tiles,
+            const LevelSpawn *spawns, size_t num_spawns, const char *meta, int compress)
+{
+  uint32_t chunks_w = (w + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+  uint32_t chunks_h = (h + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+  size_t num_chunks = (size_t)chunks_w * chunks_h;
+
+  // Chunk data first, empty chunks take no space
+  uint8_t *table = calloc(num_chunks, LEVEL_CHUNK_ENTRY);
+  uint8_t *chunks = malloc(num_chunks * LEVEL_CHUNK_BYTES + 1);
+  if (table == NULL || chunks == NULL)
+  {
+    free(table);
+    free(chunks);
+    ERROR_RETURN(-1, "Can't allocate space for level %s", file);
+  }
+
+  Level flat = {.w = w, .h = h, .chunks_w = chunks_w, .chunks_h = chunks_h, .tiles = tiles};
+  uint64_t chunks_size = 0;
+  for (uint32_t cy = 0; cy < chunks_h; cy++)
+  {
+    for (uint32_t cx = 0; cx < chunks_w; cx++)
+    {
+      uint8_t *c = chunks + chunks_size;
+      level_read_chunk(&flat, cx, cy, c);
+
+      int empty = 1;
+      for (size_t i = 0; i < LEVEL_CHUNK_BYTES && empty; i++)
+      {
+        empty = c[i] == 0;
+      }
+      if (empty)
+      {
+        continue;
+      }
+
+      // Encoders give up (return 0) as soon as they'd lose against raw
+      uint32_t codec = LevelCodec_Raw, size = LEVEL_CHUNK_BYTES;
+      if (compress)
+      {
+        uint8_t rle[LEVEL_CHUNK_BYTES], bits[LEVEL_CHUNK_BYTES / 8];
+        size_t rle_size = level_encode_rle(c, rle);
+        size_t bits_size = level_encode_bits(c, bits);
+        if (bits_size && (rle_size == 0 || bits_size <= rle_size))
+        {
+          codec = LevelCodec_Bits;
+          size = bits_size;
+          memcpy(c, bits, size);
+        }
+        else if (rle_size)
+        {
+          codec = LevelCodec_Rle;
+          size = rle_size;
+          memcpy(c, rle, size);
+        }
+      }
+
+      uint8_t *e = table + ((size_t)cy * chunks_w + cx) * LEVEL_CHUNK_ENTRY;
+      level_put_u64(e, chunks_size);
+      level_put_u32(e + 8, size);
+      level_put_u32(e + 12, codec);
+      level_put_u64(e + 16, hash_bytes(c, size));
+      chunks_size += size;
+    }
+  }
+
+  size_t meta_size = meta ? strlen(meta) : 0;
+  uint64_t sizes[5] = {
+    LEVEL_TILE_HEADER + num_chunks * LEVEL_CHUNK_ENTRY,
+    chunks_size,
+    LEVEL_SPWN_HEADER + (uint64_t)num_spawns * LEVEL_SPAWN_SIZE,
+    meta_size,
+  };
+  uint32_t types[5] = {LEVEL_SECTION_TILE, LEVEL_SECTION_TDAT, LEVEL_SECTION_SPWN, LEVEL_SECTION_META};
+  uint32_t flags[5] = {0, LEVEL_SECTION_LAZY, 0, 0};
+  uint16_t num_sections = meta_size ? 4 : 3;
+
+  // The whole file is assembled in memory so section hashes cover contiguous bytes
+  uint64_t offsets[5];
+  uint64_t size = LEVEL_HEADER_SIZE + num_sections * LEVEL_ENTRY_SIZE;
+  for (int i = 0; i < num_sections; i++)
+  {
+    size = (size + 7) & ~(uint64_t)7;
+    offsets[i] = size;
+    size += sizes[i];
+  }
+
+  uint8_t *data = calloc(1, size);
+  if (data == NULL)
+  {
+    free(table);
+    free(chunks);
+    ERROR_RETURN(-1, "Can't allocate space for level %s", file);
+  }
+
+  uint8_t *tile = data + offsets[0];
+  level_put_u32(tile, w);
+  level_put_u32(tile + 4, h);
+  level_put_u32(tile + 8, LevelLayout_Chunked);
+  level_put_u32(tile + 12, LEVEL_CHUNK_TILES);
+  memcpy(tile + LEVEL_TILE_HEADER, table, num_chunks * LEVEL_CHUNK_ENTRY);
+  memcpy(data + offsets[1], chunks, chunks_size);
+  free(table);
+  free(chunks);
+
+  uint8_t *spwn = data + offsets[2];
+  level_put_u32(spwn, (uint32_t)num_spawns);
+  for (size_t i = 0; i < num_spawns; i++)
+  {
+    uint8_t *p = spwn + LEVEL_SPWN_HEADER + i * LEVEL_SPAWN_SIZE;
+    level_put_u32(p, spawns[i].type);
+    level_put_u32(p + 4, spawns[i].flags);
+    level_put_u32(p + 8, (uint32_t)spawns[i].x);
+    level_put_u32(p + 12, (uint32_t)spawns[i].y);
+  }
+
+  if (meta_size)
+  {
+    memcpy(data + offsets[3], meta, meta_size);
+  }
+
+  for (int i = 0; i < num_sections; i++)
+  {
+    uint8_t *e = data + LEVEL_HEADER_SIZE + i * LEVEL_ENTRY_SIZE;
+    level_put_u32(e, types[i]);
+    level_put_u32(e + 4, flags[i]);
+    level_put_u64(e + 8, offsets[i]);
+    level_put_u64(e + 16, sizes[i]);
+    level_put_u64(e + 24, (flags[i] & LEVEL_SECTION_LAZY) ? 0 : hash_bytes(data + offsets[i], sizes[i]));
+  }
+
+  memcpy(data, level_magic, sizeof(level_magic));
+  level_put_u16(data + 4, LEVEL_VERSION);
+  level_put_u16(data + 6, num_sections);
+  level_put_u64(data + 8, size);
+  level_put_u64(data + 16, hash_bytes(data + LEVEL_HEADER_SIZE, num_sections * LEVEL_ENTRY_SIZE));
+
+  FILE *f = fopen(file, "wb");
+  if (f == NULL)
+  {
+    free(data);
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  size_t written = fwrite(data, 1, size, f);
+  int closed = fclose(f);
+  free(data);
+  if (written != size || closed != 0)
+  {
+    ERROR_RETURN(-1, "Can't write level %s", file);
+  }
+
+  return 0;
+}
+
+static int
+level_map(Level *l, const char *file)
+{
+#ifdef _WIN32
+  HANDLE f = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(f, &size) == 0 || size.QuadPart == 0)
+  {
+    CloseHandle(f);
+    ERROR_RETURN(-1, "Empty level file %s", file);
+  }
+
+  HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(f);
+  if (m == NULL)
+  {
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+
+  l->data = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  if (l->data == NULL)
+  {
+    CloseHandle(m);
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+  l->size = (size_t)size.QuadPart;
+  l->mapping = m;
+#else
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    ERROR_RETURN(-1, "Empty level file %s", file);
+  }
+
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+
+  l->data = data;
+  l->size = (size_t)st.st_size;
+#endif
+
+  return 0;
+}
+
+static void
+level_unmap(Level *l)
+{
+  if (l->data == NULL)
+  {
+    return;
+  }
+
+#ifdef _WIN32
+  UnmapViewOfFile(l->data);
+  CloseHandle(l->mapping);
+#else
+  munmap((void *)l->data, l->size);
+#endif
+
+  l->data = NULL;
+}
+
+static int
+level_parse(Level *l)
+{
+  if (l->size < LEVEL_HEADER_SIZE)
+  {
+    ERROR_RETURN(-1, "Truncated level header");
+  }
+
+  uint16_t version = level_u16(l->data + 4);
+  uint16_t num_sections = level_u16(l->data + 6);
+  if (version == 0 || version > LEVEL_VERSION)
+  {
+    ERROR_RETURN(-1, "Unsupported level version %u", version);
+  }
+  if (level_u64(l->data + 8) != l->size)
+  {
+    ERROR_RETURN(-1, "Level size mismatch");
+  }
+
+  // The table size can't overflow, num_sections is only 16 bits
+  size_t table_size = (size_t)num_sections * LEVEL_ENTRY_SIZE;
+  if (LEVEL_HEADER_SIZE + table_size > l->size)
+  {
+    ERROR_RETURN(-1, "Truncated section table");
+  }
+  if (hash_bytes(l->data + LEVEL_HEADER_SIZE, table_size) != level_u64(l->data + 16))
+  {
+    ERROR_RETURN(-1, "Section table checksum mismatch");
+  }
+
+  int has_tiles = 0, layout = LevelLayout_Flat;
+  for (size_t i = 0; i < num_sections; i++)
+  {
+    const uint8_t *e = l->data + LEVEL_HEADER_SIZE + i * LEVEL_ENTRY_SIZE;
+    uint32_t type = level_u32(e);
+    uint32_t flags = level_u32(e + 4);
+    uint64_t offset = level_u64(e + 8);
+    uint64_t size = level_u64(e + 16);
+
+    if (offset > l->size || size > l->size - offset)
+    {
+      ERROR_RETURN(-1, "Section %zu outside of file", i);
+    }
+    const uint8_t *p = l->data + offset;
+    if ((flags & LEVEL_SECTION_LAZY) == 0 && hash_bytes(p, size) != level_u64(e + 24))
+    {
+      ERROR_RETURN(-1, "Section %zu checksum mismatch", i);
+    }
+
+    switch (type)
+    {
+    case LEVEL_SECTION_TILE:
+      if (size < LEVEL_TILE_HEADER)
+      {
+        ERROR_RETURN(-1, "Truncated tile section");
+      }
+      l->w = level_u32(p);
+      l->h = level_u32(p + 4);
+      l->chunks_w = (l->w + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+      l->chunks_h = (l->h + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+      layout = level_u32(p + 8);
+      if (layout == LevelLayout_Flat)
+      {
+        if ((uint64_t)l->w * l->h > size - LEVEL_TILE_HEADER)
+        {
+          ERROR_RETURN(-1, "Truncated tile section");
+        }
+        l->tiles = p + LEVEL_TILE_HEADER;
+      }
+      else if (layout == LevelLayout_Chunked)
+      {
+        if (level_u32(p + 12) != LEVEL_CHUNK_TILES)
+        {
+          ERROR_RETURN(-1, "Unsupported chunk size %u", level_u32(p + 12));
+        }
+        if ((uint64_t)l->chunks_w * l->chunks_h * LEVEL_CHUNK_ENTRY > size - LEVEL_TILE_HEADER)
+        {
+          ERROR_RETURN(-1, "Truncated chunk table");
+        }
+        l->chunk_table = p + LEVEL_TILE_HEADER;
+      }
+      else
+      {
+        ERROR_RETURN(-1, "Unknown tile layout %u", layout);
+      }
+      has_tiles = 1;
+      break;
+    case LEVEL_SECTION_TDAT:
+      l->chunk_data = p;
+      l->chunk_data_size = size;
+      break;
+    case LEVEL_SECTION_SPWN:
+      if (size < LEVEL_SPWN_HEADER ||
+          (uint64_t)level_u32(p) * LEVEL_SPAWN_SIZE > size - LEVEL_SPWN_HEADER)
+      {
+        ERROR_RETURN(-1, "Truncated spawn section");
+      }
+      l->num_spawns = level_u32(p);
+      l->spawns = p + LEVEL_SPWN_HEADER;
+      break;
+    case LEVEL_SECTION_META:
+      l->meta = (const char *)p;
+      l->meta_size = size;
+      break;
+    }
+  }
+
+  if (has_tiles == 0)
+  {
+    ERROR_RETURN(-1, "Level has no tile section");
+  }
+  if (layout == LevelLayout_Chunked && l->chunk_data == NULL)
+  {
+    ERROR_RETURN(-1, "Level has no tile data section");
+  }
+
+  return 0;
+}
+
+static int
+level_parse_legacy(Level *l)
+{
+  size_t w, h;
+  if (l->size < 2 * sizeof(size_t))
+  {
+    ERROR_RETURN(-1, "Truncated level header");
+  }
+  memcpy(&w, l->data, sizeof(size_t));
+  memcpy(&h, l->data + sizeof(size_t), sizeof(size_t));
+
+  if (w > UINT32_MAX || h > UINT32_MAX || (uint64_t)w * h != l->size - 2 * sizeof(size_t))
+  {
+    ERROR_RETURN(-1, "Level size mismatch");
+  }
+
+  DEBUG_WARNING("Level in the old raw format, rewrite it with level_write");
+
+  l->w = (uint32_t)w;
+  l->h = (uint32_t)h;
+  l->chunks_w = (l->w + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+  l->chunks_h = (l->h + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+  l->tiles = l->data + 2 * sizeof(size_t);
+  return 0;
+}
+
+static size_t
+level_encode_rle(const uint8_t *in, uint8_t *out)
+{
+  size_t size = 0;
+  for (size_t i = 0; i < LEVEL_CHUNK_BYTES; )
+  {
+    size_t run = 1;
+    while (i + run < LEVEL_CHUNK_BYTES && run < 256 && in[i + run] == in[i])
+    {
+      run++;
+    }
+    if (size + 2 >= LEVEL_CHUNK_BYTES)
+    {
+      return 0;
+    }
+    out[size++] = (uint8_t)(run - 1);
+    out[size++] = in[i];
+    i += run;
+  }
+  return size;
+}
+
+static size_t
+level_encode_bits(const uint8_t *in, uint8_t *out)
+{
+  memset(out, 0, LEVEL_CHUNK_BYTES / 8);
+  for (size_t i = 0; i < LEVEL_CHUNK_BYTES; i++)
+  {
+    if (in[i] & ~1)
+    {
+      return 0;
+    }
+    out[i / 8] |= in[i] << (i % 8);
+  }
+  return LEVEL_CHUNK_BYTES / 8;
+}
+
+static int
+level_decode_rle(const uint8_t *in, size_t size, uint8_t *out)
+{
+  size_t n = 0;
+  for (size_t i = 0; i + 1 < size; i += 2)
+  {
+    size_t run = (size_t)in[i] + 1;
+    if (n + run > LEVEL_CHUNK_BYTES)
+    {
+      return -1;
+    }
+
+    // Short runs are the common case, two word stores beat a memset call.
+    // Writing past the run is fine, the next run overwrites it.
+    if (run <= 16 && n + 16 <= LEVEL_CHUNK_BYTES)
+    {
+      uint64_t v = in[i + 1] * 0x0101010101010101ull;
+      memcpy(out + n, &v, 8);
+      memcpy(out + n + 8, &v, 8);
+    }
+    else
+    {
+      memset(out + n, in[i + 1], run);
+    }
+    n += run;
+  }
+  return (size % 2 == 0 && n == LEVEL_CHUNK_BYTES) ? 0 : -1;
+}
+
+static void
+level_decode_bits(const uint8_t *in, uint8_t *out)
+{
+  // Spreads the 8 bits of a byte over the 8 bytes of a word: copy the byte to
+  // every lane, keep bit i in lane i, then turn non-zero lanes into 1
+  for (size_t i = 0; i < LEVEL_CHUNK_BYTES / 8; i++)
+  {
+    uint64_t w = (in[i] * 0x0101010101010101ull) & 0x8040201008040201ull;
+    w = ((w + 0x7f7f7f7f7f7f7f7full) >> 7) & 0x0101010101010101ull;
+    level_put_u64(out + i * 8, w);
+  }
+}
+
+static uint16_t
+level_u16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t
+level_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+level_u64(const uint8_t *p)
+{
+  return level_u32(p) | (uint64_t)level_u32(p + 4) << 32;
+}
+
+static void
+level_put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void
+level_put_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (uint8_t)(v >> (i * 8));
+  }
+}
+
+static void
+level_put_u64(uint8_t *p, uint64_t v)
+{
+  level_put_u32(p, (uint32_t)v);
+  level_put_u32(p + 4, (uint32_t)(v >> 32));
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Level container, all fields little-endian and fixed width:
+//
+//   header   magic "LUKL", u16 version, u16 section count, u64 file size,
+//            u64 hash of the section table
+//   table    per section u32 type, u32 flags, u64 offset, u64 size, u64 hash
+//   sections 8 byte aligned, unknown types are skipped
+//
+// TILE  u32 w, u32 h, u32 layout, u32 chunk size in tiles, then by layout
+//       flat:    w * h LevelElement flags (version 1)
+//       chunked: per chunk, row major, u64 offset into TDAT, u32 size,
+//                u32 codec, u64 hash
+// TDAT  chunk data, lazy: only the chunk hashes are checked, when read
+// SPWN  u32 count, u32 reserved, count * (u32 type, u32 flags, i32 x, i32 y)
+// META  free form "key=value" lines
+//
+// Files are mapped read-only and nothing is copied at load, tiles are read a
+// chunk at a time so big levels can be streamed. Files without the magic are
+// read as the old raw format of two native size_t dimensions followed by the
+// tiles.
+#define LEVEL_VERSION     2
+#define LEVEL_CHUNK_TILES 32
+
+#define LEVEL_FOURCC(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+#define LEVEL_SECTION_TILE LEVEL_FOURCC('T', 'I', 'L', 'E')
+#define LEVEL_SECTION_TDAT LEVEL_FOURCC('T', 'D', 'A', 'T')
+#define LEVEL_SECTION_SPWN LEVEL_FOURCC('S', 'P', 'W', 'N')
+#define LEVEL_SECTION_META LEVEL_FOURCC('M', 'E', 'T', 'A')
+
+#define LEVEL_SECTION_LAZY 1
+
+typedef enum {
+  LevelLayout_Flat    = 0,
+  LevelLayout_Chunked = 1,
+}
+LevelLayout;
+
+// Chunks without bricks are stored with size 0 whatever the codec
+//   raw   one byte per tile
+//   rle   pairs of u8 run length - 1 and u8 tile
+//   bits  one bit per tile, lowest bit first, chunks holding only bricks
+typedef enum {
+  LevelCodec_Raw  = 0,
+  LevelCodec_Rle  = 1,
+  LevelCodec_Bits = 2,
+}
+LevelCodec;
+
+typedef enum {
+  LevelSpawn_Player = 1,
+  LevelSpawn_Coin   = 2,
+  LevelSpawn_Crate  = 3,
+}
+LevelSpawnType;
+
+typedef struct {
+  uint32_t type, flags;
+  int32_t x, y;
+}
+LevelSpawn;
+
+typedef struct {
+  uint32_t w, h;
+  uint32_t chunks_w, chunks_h;
+
+  // Flat layout only, NULL for chunked levels
+  const uint8_t *tiles;
+
+  const uint8_t *chunk_table;
+  const uint8_t *chunk_data;
+  size_t chunk_data_size;
+
+  size_t num_spawns;
+  const uint8_t *spawns;
+
+  size_t meta_size;
+  const char *meta;
+
+  // Whole file as mapped
+  const uint8_t *data;
+  size_t size;
+  void *mapping;
+}
+Level;
+
+// Returns NULL when the file is missing, truncated or fails a checksum
+Level *level_load(const char *file);
+void level_free(Level *l);
+
+LevelSpawn level_get_spawn(const Level *l, size_t i);
+
+// Copies LEVEL_CHUNK_TILES^2 tiles of chunk (cx, cy) into out, row major,
+// tiles past the level edge are empty. Safe to call from any thread.
+int level_read_chunk(const Level *l, uint32_t cx, uint32_t cy, uint8_t *out);
+
+// With compress set every chunk is stored with whichever codec is smallest
+int level_write(const char *file, uint32_t w, uint32_t h, const uint8_t *tiles,
+                const LevelSpawn *spawns, size_t num_spawns, const char *meta, int compress);
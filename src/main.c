@@ -1,5 +1,7 @@
 #include "game.h"
 
+#include <string.h>
+
 int
 main(int argc, char *argv[])
 {
@@ -7,9 +9,8 @@ main(int argc, char *argv[])
   int ww = 640, wh = 480;
   int lw = 320, lh = 240;
 
-  int tick_rate = 300;
-
-  // Sources MUST be in alphabetical order because of binary search
+  // Rendering interpolates between ticks, a higher rate isn't any smoother
+  int tick_rate = 60;
 
   // Textures
   TextureSource t_src[] = {
@@ -36,13 +37,50 @@ main(int argc, char *argv[])
     {"explosion", "sfx/explosion.wav"},
   };
 
-  game_init_system(ww, wh, lw, lh, title);
+  // --record <file> saves the input of a session, --replay <file> plays it
+  // back without a window and checks it ends up in the same states
+  const char *record = NULL, *replay = NULL;
+  for (int i = 1; i + 1 < argc; i++)
+  {
+    if (strcmp(argv[i], "--record") == 0)
+    {
+      record = argv[++i];
+    }
+    else if (strcmp(argv[i], "--replay") == 0)
+    {
+      replay = argv[++i];
+    }
+  }
+
+  if (replay != NULL)
+  {
+    game_init_headless(lw, lh);
+  }
+  else
+  {
+    game_init_system(ww, wh, lw, lh, title);
+  }
+  // Without the pack, built by make assets, everything loads from its own file
+  game_open_asset_pack("assets.pak");
   game_init_assets(t_src, sizeof(t_src),
                    s_src, sizeof(s_src),
                    f_src, sizeof(f_src),
                    a_src, sizeof(a_src));
   game_init_scene();
-  game_run(tick_rate);
+
+  int result = 0;
+  if (replay != NULL)
+  {
+    result = game_replay(replay) == 0 ? 0 : 1;
+  }
+  else
+  {
+    if (record != NULL)
+    {
+      game_record(record);
+    }
+    game_run(tick_rate);
+  }
   game_free();
-  return 0;
+  return result;
 }
@@ -0,0 +1,287 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "mem.h"
+#include "util.h"
+
+#include <SDL2/SDL.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #ifndef MAP_ANONYMOUS
+    #define MAP_ANONYMOUS MAP_ANON
+  #endif
+  #ifndef MAP_NORESERVE
+    #define MAP_NORESERVE 0
+  #endif
+#endif
+
+// Arenas commit in steps of this many bytes, so small allocations don't each
+// cost a system call
+#define ARENA_COMMIT (64 * 1024)
+
+// Released ranges are zeroed and kept for the next reservation of the same
+// size while the cache holds less than VMEM_CACHE_COMMIT committed bytes,
+// address space alone isn't limited beyond VMEM_CACHE_SIZE ranges. Reusing one
+// costs no system calls or page faults. Tearing a scene down and setting up
+// the next one mostly hits.
+#define VMEM_CACHE_SIZE   256
+#define VMEM_CACHE_COMMIT (16 * 1024 * 1024)
+
+// Counted in pages so an int is enough
+static SDL_atomic_t reserved_pages, committed_pages, cached_pages, commits;
+
+static SDL_SpinLock cache_lock;
+static size_t       num_cached;
+static VMem         cached[VMEM_CACHE_SIZE];
+
+static size_t mem_page_size();
+static void   vmem_unmap(VMem *v);
+
+int
+vmem_reserve(VMem *v, size_t size)
+{
+  memset(v, 0, sizeof(VMem));
+  size_t page = mem_page_size();
+  size = (size + page - 1) / page * page;
+
+  // Newest first, it's the most likely to still be in cache
+  SDL_AtomicLock(&cache_lock);
+  for (size_t i = num_cached; i-- > 0; )
+  {
+    if (cached[i].reserved == size)
+    {
+      *v = cached[i];
+      cached[i] = cached[--num_cached];
+      break;
+    }
+  }
+  SDL_AtomicUnlock(&cache_lock);
+  if (v->base != NULL)
+  {
+    SDL_AtomicAdd(&cached_pages, -(int)(v->committed / page));
+    return 0;
+  }
+
+#ifdef _WIN32
+  void *base = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+  if (base == NULL)
+  {
+    ERROR_RETURN(-1, "Can't reserve %zu bytes of address space", size);
+  }
+#else
+  void *base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    ERROR_RETURN(-1, "Can't reserve %zu bytes of address space", size);
+  }
+#endif
+
+  v->base = base;
+  v->reserved = size;
+  SDL_AtomicAdd(&reserved_pages, (int)(size / page));
+  return 0;
+}
+
+int
+vmem_commit(VMem *v, size_t size)
+{
+  if (size <= v->committed)
+  {
+    return 0;
+  }
+  if (size > v->reserved)
+  {
+    ERROR_RETURN(-1, "Commit of %zu bytes past a reservation of %zu", size, v->reserved);
+  }
+
+  size_t page = mem_page_size();
+  size = (size + page - 1) / page * page;
+  size = size < v->reserved ? size : v->reserved;
+
+  // Only the new pages change protection, the committed ones stay put
+#ifdef _WIN32
+  if (VirtualAlloc(v->base + v->committed, size - v->committed, MEM_COMMIT, PAGE_READWRITE) == NULL)
+  {
+    ERROR_RETURN(-1, "Can't commit %zu bytes", size - v->committed);
+  }
+#else
+  if (mprotect(v->base + v->committed, size - v->committed, PROT_READ | PROT_WRITE) != 0)
+  {
+    ERROR_RETURN(-1, "Can't commit %zu bytes", size - v->committed);
+  }
+#endif
+
+  SDL_AtomicAdd(&committed_pages, (int)((size - v->committed) / page));
+  SDL_AtomicAdd(&commits, 1);
+  v->committed = size;
+  return 0;
+}
+
+void
+vmem_release(VMem *v)
+{
+  if (v->base == NULL)
+  {
+    return;
+  }
+
+  // Zeroed before it's visible to other threads, the check is repeated under
+  // the lock in case the cache filled up meanwhile
+  size_t page = mem_page_size();
+  int kept = (size_t)SDL_AtomicGet(&cached_pages) * page + v->committed <= VMEM_CACHE_COMMIT;
+  if (kept)
+  {
+    memset(v->base, 0, v->committed);
+
+    SDL_AtomicLock(&cache_lock);
+    kept = num_cached < VMEM_CACHE_SIZE &&
+           (size_t)SDL_AtomicGet(&cached_pages) * page + v->committed <= VMEM_CACHE_COMMIT;
+    if (kept)
+    {
+      cached[num_cached++] = *v;
+      SDL_AtomicAdd(&cached_pages, (int)(v->committed / page));
+    }
+    SDL_AtomicUnlock(&cache_lock);
+  }
+
+  if (kept)
+  {
+    memset(v, 0, sizeof(VMem));
+  }
+  else
+  {
+    vmem_unmap(v);
+  }
+}
+
+void
+mem_trim()
+{
+  SDL_AtomicLock(&cache_lock);
+  size_t n = num_cached;
+  VMem trimmed[VMEM_CACHE_SIZE];
+  memcpy(trimmed, cached, n * sizeof(VMem));
+  num_cached = 0;
+  SDL_AtomicUnlock(&cache_lock);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    SDL_AtomicAdd(&cached_pages, -(int)(trimmed[i].committed / mem_page_size()));
+    vmem_unmap(&trimmed[i]);
+  }
+}
+
+void
+arena_init(Arena *a, size_t reserve)
+{
+  memset(a, 0, sizeof(Arena));
+  if (vmem_reserve(&a->mem, reserve) != 0)
+  {
+    ERROR_RETURN(, "Can't reserve space for arena");
+  }
+}
+
+void
+arena_free(Arena *a)
+{
+  vmem_release(&a->mem);
+  memset(a, 0, sizeof(Arena));
+}
+
+void *
+arena_alloc(Arena *a, size_t size)
+{
+  size_t start = (a->used + 15) & ~(size_t)15;
+  if (start > a->mem.reserved || size > a->mem.reserved - start)
+  {
+    ERROR_RETURN(NULL, "Arena of %zu bytes is full", a->mem.reserved);
+  }
+
+  size_t end = start + size;
+  if (end > a->mem.committed)
+  {
+    size_t commit = (end + ARENA_COMMIT - 1) / ARENA_COMMIT * ARENA_COMMIT;
+    if (vmem_commit(&a->mem, commit < a->mem.reserved ? commit : a->mem.reserved) != 0)
+    {
+      return NULL;
+    }
+  }
+
+  a->used = end;
+  a->peak = end > a->peak ? end : a->peak;
+  return a->mem.base + start;
+}
+
+void *
+arena_calloc(Arena *a, size_t n, size_t size)
+{
+  if (size != 0 && n > SIZE_MAX / size)
+  {
+    ERROR_RETURN(NULL, "Arena allocation of %zu x %zu bytes overflows", n, size);
+  }
+
+  // Memory past the peak was never handed out and is still zero
+  size_t start = (a->used + 15) & ~(size_t)15, peak = a->peak;
+  void *p = arena_alloc(a, n * size);
+  if (p != NULL && start < peak)
+  {
+    size_t dirty = peak - start < n * size ? peak - start : n * size;
+    memset(p, 0, dirty);
+  }
+  return p;
+}
+
+void
+arena_reset(Arena *a)
+{
+  a->used = 0;
+}
+
+void
+mem_get_stats(MemStats *out)
+{
+  size_t page = mem_page_size();
+  out->reserved = (size_t)SDL_AtomicGet(&reserved_pages) * page;
+  out->committed = (size_t)SDL_AtomicGet(&committed_pages) * page;
+  out->cached = (size_t)SDL_AtomicGet(&cached_pages) * page;
+  out->commits = (size_t)SDL_AtomicGet(&commits);
+}
+
+static void
+vmem_unmap(VMem *v)
+{
+#ifdef _WIN32
+  VirtualFree(v->base, 0, MEM_RELEASE);
+#else
+  munmap(v->base, v->reserved);
+#endif
+
+  size_t page = mem_page_size();
+  SDL_AtomicAdd(&reserved_pages, -(int)(v->reserved / page));
+  SDL_AtomicAdd(&committed_pages, -(int)(v->committed / page));
+  memset(v, 0, sizeof(VMem));
+}
+
+static size_t
+mem_page_size()
+{
+  static size_t page;
+  if (page == 0)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    page = info.dwPageSize;
+#else
+    page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  }
+  return page;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Address range reserved up front and committed as it's used. Growing never
+// moves the memory, so pointers into it stay valid, and pages aren't touched
+// until they're first written. Committed memory starts out zeroed.
+typedef struct {
+  uint8_t *base;
+  size_t reserved, committed;
+}
+VMem;
+
+// Bump allocator over one reserved range, so its allocations are contiguous.
+// Nothing is freed on its own, the arena is reset or freed as a whole, reset
+// keeps the committed pages for the next round.
+typedef struct {
+  VMem mem;
+  size_t used, peak;
+}
+Arena;
+
+// Totals over every range in the process, in bytes. Cached is the part of
+// committed held by released ranges kept for reuse, commits counts the calls
+// that had to map new pages.
+typedef struct {
+  size_t reserved, committed, cached;
+  size_t commits;
+}
+MemStats;
+
+// Both return 0, or -1 when the address space can't be reserved or the commit
+// runs past the reservation
+int  vmem_reserve(VMem *v, size_t size);
+int  vmem_commit(VMem *v, size_t size);
+// Released ranges go to a cache for reuse by the next reservation of the same
+// size instead of being unmapped, as long as the committed bytes of the cache
+// stay under a cap. Reserved size doesn't count, a big reservation with few
+// pages committed is cached too. mem_trim unmaps the cached ones.
+void vmem_release(VMem *v);
+void mem_trim();
+
+void arena_init(Arena *a, size_t reserve);
+void arena_free(Arena *a);
+// Aligned to 16 bytes, NULL once the reservation runs out. Memory from
+// arena_alloc may hold data from before the last reset.
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t n, size_t size);
+void arena_reset(Arena *a);
+
+void mem_get_stats(MemStats *out);
@@ -0,0 +1,439 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "pack.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#define PACK_HEADER_SIZE 40
+#define PACK_SLOT_SIZE   40
+
+static const char pack_magic[4] = {'L', 'U', 'K', 'P'};
+
+static int      pack_map(Pack *p, const char *file);
+static void     pack_unmap(Pack *p);
+static int      pack_parse(Pack *p);
+static uint16_t pack_u16(const uint8_t *p);
+static uint32_t pack_u32(const uint8_t *p);
+static uint64_t pack_u64(const uint8_t *p);
+static void     pack_put_u16(uint8_t *p, uint16_t v);
+static void     pack_put_u32(uint8_t *p, uint32_t v);
+static void     pack_put_u64(uint8_t *p, uint64_t v);
+
+int
+pack_open(Pack *p, const char *file)
+{
+  DEBUG_TRACE("Pack open %s", file);
+  memset(p, 0, sizeof(Pack));
+
+  if (pack_map(p, file) != 0)
+  {
+    return -1;
+  }
+  if (pack_parse(p) != 0)
+  {
+    DEBUG_ERROR("Invalid pack file %s", file);
+    pack_close(p);
+    return -1;
+  }
+  return 0;
+}
+
+void
+pack_close(Pack *p)
+{
+  pack_unmap(p);
+  memset(p, 0, sizeof(Pack));
+}
+
+int
+pack_find(const Pack *p, const char *name, PackEntry *out)
+{
+  if (p->num_slots == 0)
+  {
+    return -1;
+  }
+
+  size_t name_size = strlen(name);
+  uint64_t hash = hash_bytes(name, name_size);
+  for (size_t i = hash & (p->num_slots - 1); ; i = (i + 1) & (p->num_slots - 1))
+  {
+    const uint8_t *s = p->slots + i * PACK_SLOT_SIZE;
+    uint16_t size = pack_u16(s + 36);
+    if (size == 0)
+    {
+      return -1;
+    }
+    if (pack_u64(s) != hash || size != name_size || memcmp(p->names + pack_u32(s + 32), name, size) != 0)
+    {
+      continue;
+    }
+
+    // Bounds were checked at open. Decoded entries are read whole right after,
+    // so checking them costs little, raw ones are left to their loaders and
+    // only paged in as those read them.
+    const uint8_t *data = p->data + pack_u64(s + 8);
+    size_t data_size = (size_t)pack_u64(s + 16);
+    uint16_t type = pack_u16(s + 38);
+    if (type != PackType_Raw && hash_bytes(data, data_size) != pack_u64(s + 24))
+    {
+      ERROR_RETURN(-1, "Pack entry %s checksum mismatch", name);
+    }
+
+    out->name = name;
+    out->type = type;
+    out->data = data;
+    out->size = data_size;
+    return 0;
+  }
+}
+
+const uint8_t *
+pack_rgba(const PackEntry *e, uint32_t *w, uint32_t *h, uint32_t *pitch)
+{
+  if (e->type != PackType_Rgba || e->size < PACK_RGBA_HEADER)
+  {
+    return NULL;
+  }
+
+  *w = pack_u32(e->data);
+  *h = pack_u32(e->data + 4);
+  *pitch = pack_u32(e->data + 8);
+  if ((uint64_t)*w * 4 > *pitch || (uint64_t)*pitch * *h > e->size - PACK_RGBA_HEADER)
+  {
+    return NULL;
+  }
+  return e->data + PACK_RGBA_HEADER;
+}
+
+const uint8_t *
+pack_pcm(const PackEntry *e, uint32_t *freq, uint32_t *channels, size_t *size)
+{
+  if (e->type != PackType_Pcm || e->size < PACK_PCM_HEADER)
+  {
+    return NULL;
+  }
+
+  // RIFF header, a 16 byte PCM fmt chunk and the data chunk right after it
+  const uint8_t *d = e->data;
+  if (memcmp(d, "RIFF", 4) != 0 || memcmp(d + 8, "WAVEfmt ", 8) != 0 || pack_u32(d + 16) != 16 ||
+      pack_u16(d + 20) != 1 || pack_u16(d + 34) != 16 || memcmp(d + 36, "data", 4) != 0 ||
+      pack_u32(d + 40) > e->size - PACK_PCM_HEADER)
+  {
+    return NULL;
+  }
+
+  *channels = pack_u16(d + 22);
+  *freq = pack_u32(d + 24);
+  *size = pack_u32(d + 40);
+  return d + PACK_PCM_HEADER;
+}
+
+int
+pack_write(const char *file, const PackEntry *entries, size_t num_entries)
+{
+  // At most half full, so misses end after a probe or two
+  size_t num_slots = 1;
+  while (num_slots < num_entries * 2)
+  {
+    num_slots *= 2;
+  }
+
+  uint64_t names_size = 0;
+  for (size_t i = 0; i < num_entries; i++)
+  {
+    size_t n = strlen(entries[i].name);
+    if (n == 0 || n > UINT16_MAX)
+    {
+      ERROR_RETURN(-1, "Pack entry name %zu has length %zu", i, n);
+    }
+    names_size += n;
+  }
+
+  uint64_t size = PACK_HEADER_SIZE + num_slots * PACK_SLOT_SIZE + names_size;
+  uint64_t *offsets = malloc(num_entries * sizeof(uint64_t) + 1);
+  if (offsets == NULL)
+  {
+    ERROR_RETURN(-1, "Can't allocate space for pack %s", file);
+  }
+  for (size_t i = 0; i < num_entries; i++)
+  {
+    size = (size + 15) & ~(uint64_t)15;
+    offsets[i] = size;
+    size += entries[i].size;
+  }
+
+  // The whole file is assembled in memory so the index hash covers contiguous bytes
+  uint8_t *data = calloc(1, size);
+  if (data == NULL)
+  {
+    free(offsets);
+    ERROR_RETURN(-1, "Can't allocate space for pack %s", file);
+  }
+
+  uint8_t *slots = data + PACK_HEADER_SIZE;
+  uint8_t *names = slots + num_slots * PACK_SLOT_SIZE;
+  uint32_t name_offset = 0;
+  for (size_t i = 0; i < num_entries; i++)
+  {
+    size_t name_size = strlen(entries[i].name);
+    uint64_t hash = hash_bytes(entries[i].name, name_size);
+    size_t slot = hash & (num_slots - 1);
+    while (pack_u16(slots + slot * PACK_SLOT_SIZE + 36) != 0)
+    {
+      const uint8_t *s = slots + slot * PACK_SLOT_SIZE;
+      if (pack_u16(s + 36) == name_size && memcmp(names + pack_u32(s + 32), entries[i].name, name_size) == 0)
+      {
+        free(offsets);
+        free(data);
+        ERROR_RETURN(-1, "Pack entry %s added twice", entries[i].name);
+      }
+      slot = (slot + 1) & (num_slots - 1);
+    }
+
+    uint8_t *s = slots + slot * PACK_SLOT_SIZE;
+    pack_put_u64(s, hash);
+    pack_put_u64(s + 8, offsets[i]);
+    pack_put_u64(s + 16, entries[i].size);
+    pack_put_u64(s + 24, hash_bytes(entries[i].data, entries[i].size));
+    pack_put_u32(s + 32, name_offset);
+    pack_put_u16(s + 36, (uint16_t)name_size);
+    pack_put_u16(s + 38, (uint16_t)entries[i].type);
+
+    memcpy(names + name_offset, entries[i].name, name_size);
+    name_offset += (uint32_t)name_size;
+    memcpy(data + offsets[i], entries[i].data, entries[i].size);
+  }
+  free(offsets);
+
+  memcpy(data, pack_magic, sizeof(pack_magic));
+  pack_put_u16(data + 4, PACK_VERSION);
+  pack_put_u32(data + 8, (uint32_t)num_entries);
+  pack_put_u32(data + 12, (uint32_t)num_slots);
+  pack_put_u64(data + 16, size);
+  pack_put_u64(data + 24, names_size);
+  pack_put_u64(data + 32, hash_bytes(slots, num_slots * PACK_SLOT_SIZE + names_size));
+
+  FILE *f = fopen(file, "wb");
+  if (f == NULL)
+  {
+    free(data);
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  size_t written = fwrite(data, 1, size, f);
+  int closed = fclose(f);
+  free(data);
+  if (written != size || closed != 0)
+  {
+    ERROR_RETURN(-1, "Can't write pack %s", file);
+  }
+
+  return 0;
+}
+
+static int
+pack_map(Pack *p, const char *file)
+{
+#ifdef _WIN32
+  HANDLE f = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(f, &size) == 0 || size.QuadPart == 0)
+  {
+    CloseHandle(f);
+    ERROR_RETURN(-1, "Empty pack file %s", file);
+  }
+
+  HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(f);
+  if (m == NULL)
+  {
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+
+  p->data = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  if (p->data == NULL)
+  {
+    CloseHandle(m);
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+  p->size = (size_t)size.QuadPart;
+  p->mapping = m;
+#else
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    ERROR_RETURN(-1, "Empty pack file %s", file);
+  }
+
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    ERROR_RETURN(-1, "Can't map file %s", file);
+  }
+
+  p->data = data;
+  p->size = (size_t)st.st_size;
+#endif
+
+  return 0;
+}
+
+static void
+pack_unmap(Pack *p)
+{
+  if (p->data == NULL)
+  {
+    return;
+  }
+
+#ifdef _WIN32
+  UnmapViewOfFile(p->data);
+  CloseHandle(p->mapping);
+#else
+  munmap((void *)p->data, p->size);
+#endif
+
+  p->data = NULL;
+}
+
+static int
+pack_parse(Pack *p)
+{
+  if (p->size < PACK_HEADER_SIZE || memcmp(p->data, pack_magic, sizeof(pack_magic)) != 0)
+  {
+    ERROR_RETURN(-1, "Not a pack file");
+  }
+
+  uint16_t version = pack_u16(p->data + 4);
+  if (version == 0 || version > PACK_VERSION)
+  {
+    ERROR_RETURN(-1, "Unsupported pack version %u", version);
+  }
+  if (pack_u64(p->data + 16) != p->size)
+  {
+    ERROR_RETURN(-1, "Pack size mismatch");
+  }
+
+  uint64_t num_entries = pack_u32(p->data + 8);
+  uint64_t num_slots = pack_u32(p->data + 12);
+  uint64_t names_size = pack_u64(p->data + 24);
+  if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0 || num_entries * 2 > num_slots)
+  {
+    ERROR_RETURN(-1, "Broken pack header");
+  }
+
+  // Both sizes come from 32 bit counts or are checked against the file size
+  // first, so the sum can't overflow
+  uint64_t index_size = num_slots * PACK_SLOT_SIZE;
+  if (index_size > p->size - PACK_HEADER_SIZE || names_size > p->size - PACK_HEADER_SIZE - index_size)
+  {
+    ERROR_RETURN(-1, "Truncated pack index");
+  }
+  if (hash_bytes(p->data + PACK_HEADER_SIZE, index_size + names_size) != pack_u64(p->data + 32))
+  {
+    ERROR_RETURN(-1, "Pack index checksum mismatch");
+  }
+
+  p->num_entries = (size_t)num_entries;
+  p->num_slots = (size_t)num_slots;
+  p->slots = p->data + PACK_HEADER_SIZE;
+  p->names = p->slots + index_size;
+
+  // Every slot is checked once here so lookups don't have to
+  size_t used = 0;
+  for (size_t i = 0; i < p->num_slots; i++)
+  {
+    const uint8_t *s = p->slots + i * PACK_SLOT_SIZE;
+    uint16_t name_size = pack_u16(s + 36);
+    if (name_size == 0)
+    {
+      continue;
+    }
+
+    uint64_t offset = pack_u64(s + 8);
+    uint64_t size = pack_u64(s + 16);
+    if (pack_u32(s + 32) > names_size || name_size > names_size - pack_u32(s + 32))
+    {
+      ERROR_RETURN(-1, "Pack slot %zu name outside of index", i);
+    }
+    if (offset > p->size || size > p->size - offset)
+    {
+      ERROR_RETURN(-1, "Pack slot %zu outside of file", i);
+    }
+    used++;
+  }
+  if (used != p->num_entries)
+  {
+    ERROR_RETURN(-1, "Pack holds %zu entries, header says %zu", used, p->num_entries);
+  }
+
+  return 0;
+}
+
+static uint16_t
+pack_u16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t
+pack_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+pack_u64(const uint8_t *p)
+{
+  return pack_u32(p) | (uint64_t)pack_u32(p + 4) << 32;
+}
+
+static void
+pack_put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void
+pack_put_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (uint8_t)(v >> (i * 8));
+  }
+}
+
+static void
+pack_put_u64(uint8_t *p, uint64_t v)
+{
+  pack_put_u32(p, (uint32_t)v);
+  pack_put_u32(p + 4, (uint32_t)(v >> 32));
+}
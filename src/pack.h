@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Asset pack, all fields little-endian and fixed width:
+//
+//   header  magic "LUKP", u16 version, u16 reserved, u32 entry count,
+//           u32 slot count, u64 file size, u64 names size, u64 hash of the
+//           slots and names
+//   slots   open addressing table, a power of two of at least twice the entry
+//           count, per slot u64 name hash, u64 offset, u64 size, u64 data
+//           hash, u32 name offset, u16 name size, u16 type, name size 0 marks
+//           an empty slot
+//   names   entry names, not terminated
+//   data    16 byte aligned
+//
+// RGBA  u32 w, u32 h, u32 pitch, u32 reserved, then h rows of pitch bytes,
+//       4 bytes per pixel in R, G, B, A order
+// PCM   WAV file with a canonical 44 byte header and no other chunks
+// RAW   the file as it was
+//
+// Entries are named after the file they were made from, relative to the
+// directory the game runs in. The pack is mapped read-only and nothing is
+// copied at open. RGBA and PCM entries are checked against their hash when
+// they're looked up, RAW ones only by whatever parses them.
+#define PACK_VERSION 1
+
+typedef enum {
+  PackType_Raw  = 0,
+  PackType_Rgba = 1,
+  PackType_Pcm  = 2,
+}
+PackType;
+
+#define PACK_RGBA_HEADER 16
+#define PACK_PCM_HEADER  44
+
+typedef struct {
+  const char *name;
+  PackType type;
+  const uint8_t *data;
+  size_t size;
+}
+PackEntry;
+
+typedef struct {
+  size_t num_entries, num_slots;
+  const uint8_t *slots;
+  const uint8_t *names;
+
+  // Whole file as mapped
+  const uint8_t *data;
+  size_t size;
+  void *mapping;
+}
+Pack;
+
+// Returns -1 when the file is missing, truncated or fails the index checksum
+int  pack_open(Pack *p, const char *file);
+void pack_close(Pack *p);
+
+// Fills out with the entry's type and data, which stay valid until the pack is
+// closed, and returns 0. Returns -1 for names that aren't in the pack and for
+// decoded entries that fail their checksum.
+int pack_find(const Pack *p, const char *name, PackEntry *out);
+
+// Pixels of an RGBA entry and their layout, NULL when the entry is of another
+// type or too short for its header
+const uint8_t *pack_rgba(const PackEntry *e, uint32_t *w, uint32_t *h, uint32_t *pitch);
+// Samples of a PCM entry, 16 bit signed little-endian and interleaved, NULL
+// when the entry is of another type or its header isn't the canonical one
+const uint8_t *pack_pcm(const PackEntry *e, uint32_t *freq, uint32_t *channels, size_t *size);
+
+int pack_write(const char *file, const PackEntry *entries, size_t num_entries);
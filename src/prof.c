@@ -0,0 +1,245 @@
+#include "prof.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rings are only ever added until prof_free, the dump walks all of them
+static SDL_SpinLock rings_lock;
+static SDL_atomic_t num_rings;
+static ProfRing     *rings[PROF_MAX_THREADS];
+static SDL_atomic_t ring_tls;
+static uint64_t     epoch;
+
+// Set in the TLS slot of threads that found every ring taken, so they fail
+// once instead of on every zone
+static ProfRing     no_ring;
+
+static ProfRing *prof_ring();
+static ProfRing *prof_register();
+static void      prof_release(void *ring);
+static void      prof_write_string(FILE *f, const char *s);
+
+void
+prof_begin(const char *name)
+{
+  ProfRing *r = prof_ring();
+  if (r == NULL)
+  {
+    return;
+  }
+
+  // Zones nested too deep are still counted so the ends pair up
+  if (r->depth < PROF_MAX_DEPTH)
+  {
+    r->stack_names[r->depth] = name;
+    r->stack_starts[r->depth] = SDL_GetPerformanceCounter();
+  }
+  r->depth++;
+}
+
+void
+prof_end()
+{
+  uint64_t end = SDL_GetPerformanceCounter();
+  ProfRing *r = prof_ring();
+  if (r == NULL)
+  {
+    return;
+  }
+  if (r->depth == 0)
+  {
+    ERROR_RETURN(, "Profiling zone ended without a begin");
+  }
+
+  r->depth--;
+  if (r->depth >= PROF_MAX_DEPTH)
+  {
+    return;
+  }
+
+  // The event is written before the head moves past it, SDL_AtomicSet is a
+  // full barrier
+  int head = SDL_AtomicGet(&r->head);
+  ProfEvent *e = &r->events[(uint32_t)head & (PROF_RING_SIZE - 1)];
+  e->name = r->stack_names[r->depth];
+  e->start = r->stack_starts[r->depth];
+  e->end = end;
+  e->depth = r->depth;
+  SDL_AtomicSet(&r->head, (int)((uint32_t)head + 1));
+}
+
+void
+prof_thread(const char *name)
+{
+  ProfRing *r = prof_ring();
+  if (r != NULL)
+  {
+    r->name = name;
+  }
+}
+
+int
+prof_dump(const char *file)
+{
+  FILE *f = fopen(file, "w");
+  if (f == NULL)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  ProfEvent *events = malloc(PROF_RING_SIZE * sizeof(ProfEvent));
+  if (events == NULL)
+  {
+    fclose(f);
+    ERROR_RETURN(-1, "Can't allocate space for profiler dump");
+  }
+
+  double us = 1e6 / SDL_GetPerformanceFrequency();
+  size_t written = 0;
+  fputs("{\"traceEvents\":[\n", f);
+
+  int n = SDL_AtomicGet(&num_rings);
+  for (int i = 0; i < n; i++)
+  {
+    ProfRing *r = rings[i];
+
+    // Copy the newest events, then drop the ones the owner may have
+    // overwritten while they were copied
+    uint32_t head = (uint32_t)SDL_AtomicGet(&r->head);
+    uint32_t first = head > PROF_RING_SIZE ? head - PROF_RING_SIZE : 0;
+    for (uint32_t j = first; j < head; j++)
+    {
+      events[j - first] = r->events[j & (PROF_RING_SIZE - 1)];
+    }
+    SDL_MemoryBarrierAcquire();
+    uint32_t now = (uint32_t)SDL_AtomicGet(&r->head);
+    // The owner may be writing event now into the slot of now - PROF_RING_SIZE
+    uint32_t safe = now + 1 > PROF_RING_SIZE ? now + 1 - PROF_RING_SIZE : 0;
+
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            written++ ? ",\n" : "", r->id);
+    prof_write_string(f, r->name != NULL ? r->name : "thread");
+    fputs("}}", f);
+
+    for (uint32_t j = safe > first ? safe : first; j < head; j++)
+    {
+      const ProfEvent *e = &events[j - first];
+      fputs(",\n{\"name\":", f);
+      prof_write_string(f, e->name);
+      fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              r->id, (e->start - epoch) * us, (e->end - e->start) * us);
+      written++;
+    }
+  }
+
+  fputs("\n]}\n", f);
+  free(events);
+  if (fclose(f) != 0)
+  {
+    ERROR_RETURN(-1, "Can't write profile %s", file);
+  }
+
+  DEBUG_TRACE("Profile written to %s, %zu events", file, written);
+  return 0;
+}
+
+void
+prof_free()
+{
+  SDL_AtomicLock(&rings_lock);
+  int n = SDL_AtomicGet(&num_rings);
+  for (int i = 0; i < n; i++)
+  {
+    free(rings[i]);
+    rings[i] = NULL;
+  }
+  SDL_AtomicSet(&num_rings, 0);
+  if (SDL_AtomicGet(&ring_tls) != 0)
+  {
+    SDL_TLSSet(SDL_AtomicGet(&ring_tls), NULL, NULL);
+  }
+  SDL_AtomicUnlock(&rings_lock);
+}
+
+static ProfRing *
+prof_ring()
+{
+  SDL_TLSID tls = SDL_AtomicGet(&ring_tls);
+  ProfRing *r = tls != 0 ? SDL_TLSGet(tls) : NULL;
+  if (r == &no_ring)
+  {
+    return NULL;
+  }
+  return r != NULL ? r : prof_register();
+}
+
+static ProfRing *
+prof_register()
+{
+  SDL_AtomicLock(&rings_lock);
+  if (SDL_AtomicGet(&ring_tls) == 0)
+  {
+    SDL_AtomicSet(&ring_tls, SDL_TLSCreate());
+    epoch = SDL_GetPerformanceCounter();
+  }
+
+  // Rings of threads that exited are reused before new ones are made
+  int n = SDL_AtomicGet(&num_rings);
+  ProfRing *r = NULL;
+  for (int i = 0; i < n && r == NULL; i++)
+  {
+    if (SDL_AtomicCAS(&rings[i]->owned, 0, 1))
+    {
+      r = rings[i];
+      r->name = NULL;
+      r->depth = 0;
+    }
+  }
+  if (r == NULL && n < PROF_MAX_THREADS)
+  {
+    r = calloc(1, sizeof(ProfRing));
+    if (r != NULL)
+    {
+      r->id = n + 1;
+      SDL_AtomicSet(&r->owned, 1);
+      rings[n] = r;
+      SDL_AtomicSet(&num_rings, n + 1);
+    }
+  }
+  SDL_TLSSet(SDL_AtomicGet(&ring_tls), r != NULL ? r : &no_ring, prof_release);
+  SDL_AtomicUnlock(&rings_lock);
+
+  if (r == NULL)
+  {
+    ERROR_RETURN(NULL, "Can't create profiler ring for this thread");
+  }
+  return r;
+}
+
+// Called by SDL when a thread that recorded exits
+static void
+prof_release(void *ring)
+{
+  ProfRing *r = ring;
+  if (r != NULL && r != &no_ring)
+  {
+    SDL_AtomicSet(&r->owned, 0);
+  }
+}
+
+static void
+prof_write_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      fputc('\\', f);
+    }
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROF_RING_SIZE   16384
+#define PROF_MAX_DEPTH   32
+#define PROF_MAX_THREADS 64
+
+// Profiling zones, PROF_BEGIN and PROF_END pair up like braces on one thread
+// and may nest. Zone names aren't copied, they have to be string literals or
+// otherwise outlive the profiler. Everything compiles to nothing under _NO_DEBUG.
+#ifdef _NO_DEBUG
+
+#define PROF_BEGIN(name)
+#define PROF_END()
+#define PROF_THREAD(name)
+
+#else
+
+#define PROF_BEGIN(name)  prof_begin(name)
+#define PROF_END()        prof_end()
+#define PROF_THREAD(name) prof_thread(name)
+
+#endif
+
+// One finished zone, times are performance counter values
+typedef struct {
+  const char *name;
+  uint64_t start, end;
+  uint32_t depth;
+}
+ProfEvent;
+
+// Each thread records into its own ring, taken on its first zone. Only the
+// owning thread writes it, the newest PROF_RING_SIZE zones are kept. Rings of
+// exited threads go to the next new thread along with their older zones, so at
+// most PROF_MAX_THREADS threads record at the same time.
+typedef struct {
+  const char *name;
+  int        id;
+  uint32_t   depth;
+  // Set while a live thread records into the ring
+  SDL_atomic_t owned;
+  const char *stack_names[PROF_MAX_DEPTH];
+  uint64_t   stack_starts[PROF_MAX_DEPTH];
+  // Count of zones ever recorded, the owner publishes events by bumping it
+  SDL_atomic_t head;
+  ProfEvent    events[PROF_RING_SIZE];
+}
+ProfRing;
+
+void prof_begin(const char *name);
+void prof_end();
+// Names the calling thread in traces
+void prof_thread(const char *name);
+
+// Writes every recorded zone as Chrome trace event JSON, for chrome://tracing
+// or Perfetto. Safe to call while other threads record. Returns 0 on success.
+int  prof_dump(const char *file);
+// Releases all rings, no thread may record anymore and every other thread that
+// recorded has to have exited. Called before SDL_Quit,
+// which takes the thread local storage down with it.
+void prof_free();
@@ -0,0 +1,309 @@
+#include "replay.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_HEADER_SIZE 56
+
+static const uint8_t replay_magic[4] = {'L', 'U', 'K', 'R'};
+
+static void     replay_push(ReplayLog *r, uint8_t b);
+static int      replay_read_varint(const ReplayLog *r, size_t *pos, uint64_t *out);
+static void     replay_decode_next(ReplayLog *r);
+static uint32_t replay_u32(const uint8_t *p);
+static uint64_t replay_u64(const uint8_t *p);
+static void     replay_put_u32(uint8_t *p, uint32_t v);
+static void     replay_put_u64(uint8_t *p, uint64_t v);
+
+void
+replay_init(ReplayLog *r, uint32_t tick_rate, uint32_t hash_interval,
+            uint32_t view_w, uint32_t view_h, uint64_t level_hash)
+{
+  memset(r, 0, sizeof(ReplayLog));
+  r->tick_rate = tick_rate;
+  r->hash_interval = hash_interval > 0 ? hash_interval : 1;
+  r->view_w = view_w;
+  r->view_h = view_h;
+  r->level_hash = level_hash;
+}
+
+void
+replay_free(ReplayLog *r)
+{
+  free(r->bytes);
+  free(r->hashes);
+  memset(r, 0, sizeof(ReplayLog));
+}
+
+void
+replay_record(ReplayLog *r, uint8_t input)
+{
+  if (input != r->last_input)
+  {
+    uint64_t delta = r->num_ticks - r->last_tick;
+    do
+    {
+      replay_push(r, (uint8_t)(delta & 0x7f) | (delta > 0x7f ? 0x80 : 0));
+      delta >>= 7;
+    }
+    while (delta > 0);
+    replay_push(r, input);
+
+    r->last_tick = r->num_ticks;
+    r->last_input = input;
+  }
+  r->num_ticks++;
+}
+
+void
+replay_record_hash(ReplayLog *r, uint64_t hash)
+{
+  if (r->num_ticks == 0 || r->num_ticks % r->hash_interval != 0)
+  {
+    return;
+  }
+  if (r->num_hashes >= r->max_hashes)
+  {
+    size_t capacity = r->max_hashes ? r->max_hashes * 2 : 256;
+    uint64_t *new_hashes = realloc(r->hashes, capacity * sizeof(uint64_t));
+    if (new_hashes == NULL)
+    {
+      ERROR_RETURN(, "Can't allocate space for replay hashes");
+    }
+    r->hashes = new_hashes;
+    r->max_hashes = capacity;
+  }
+  r->hashes[r->num_hashes++] = hash;
+}
+
+int
+replay_save(const ReplayLog *r, const char *file)
+{
+  uint8_t header[REPLAY_HEADER_SIZE] = {0};
+  memcpy(header, replay_magic, sizeof(replay_magic));
+  header[4] = (uint8_t)REPLAY_VERSION;
+  header[5] = (uint8_t)(REPLAY_VERSION >> 8);
+  replay_put_u32(header + 8, r->tick_rate);
+  replay_put_u32(header + 12, r->hash_interval);
+  replay_put_u32(header + 16, r->view_w);
+  replay_put_u32(header + 20, r->view_h);
+  replay_put_u64(header + 24, r->level_hash);
+  replay_put_u64(header + 32, r->num_ticks);
+  replay_put_u64(header + 40, r->num_bytes);
+  replay_put_u64(header + 48, r->num_hashes);
+
+  FILE *f = fopen(file, "wb");
+  if (f == NULL)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  int ok = fwrite(header, 1, REPLAY_HEADER_SIZE, f) == REPLAY_HEADER_SIZE;
+  ok = ok && fwrite(r->bytes, 1, r->num_bytes, f) == r->num_bytes;
+  for (size_t i = 0; ok && i < r->num_hashes; i++)
+  {
+    uint8_t h[8];
+    replay_put_u64(h, r->hashes[i]);
+    ok = fwrite(h, 1, 8, f) == 8;
+  }
+  if (fclose(f) != 0 || ok == 0)
+  {
+    ERROR_RETURN(-1, "Can't write replay %s", file);
+  }
+
+  DEBUG_TRACE("Replay saved to %s, %llu ticks, %zu bytes of input", file,
+              (unsigned long long)r->num_ticks, r->num_bytes);
+  return 0;
+}
+
+int
+replay_load(ReplayLog *r, const char *file)
+{
+  memset(r, 0, sizeof(ReplayLog));
+
+  FILE *f = fopen(file, "rb");
+  if (f == NULL)
+  {
+    ERROR_RETURN(-1, "Can't open file %s", file);
+  }
+
+  uint8_t header[REPLAY_HEADER_SIZE];
+  if (fread(header, 1, REPLAY_HEADER_SIZE, f) != REPLAY_HEADER_SIZE ||
+      memcmp(header, replay_magic, sizeof(replay_magic)) != 0)
+  {
+    fclose(f);
+    ERROR_RETURN(-1, "Not a replay file %s", file);
+  }
+  uint32_t version = header[4] | header[5] << 8;
+  if (version != REPLAY_VERSION)
+  {
+    fclose(f);
+    ERROR_RETURN(-1, "Unsupported replay version %u", version);
+  }
+
+  r->tick_rate = replay_u32(header + 8);
+  r->hash_interval = replay_u32(header + 12);
+  r->view_w = replay_u32(header + 16);
+  r->view_h = replay_u32(header + 20);
+  r->level_hash = replay_u64(header + 24);
+  r->num_ticks = replay_u64(header + 32);
+  uint64_t num_bytes = replay_u64(header + 40);
+  uint64_t num_hashes = replay_u64(header + 48);
+
+  // The counts are bounded by the tick count and must add up to the rest of
+  // the file, which rejects garbage sizes before anything is allocated
+  long end = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+  {
+    end = ftell(f);
+  }
+  if (end < REPLAY_HEADER_SIZE || fseek(f, REPLAY_HEADER_SIZE, SEEK_SET) != 0)
+  {
+    fclose(f);
+    ERROR_RETURN(-1, "Can't get the size of replay %s", file);
+  }
+  uint64_t body_size = (uint64_t)end - REPLAY_HEADER_SIZE;
+  if (r->tick_rate == 0 || r->hash_interval == 0 || r->num_ticks > (UINT64_MAX - 1) / 11 ||
+      num_bytes > r->num_ticks * 11 || num_hashes > r->num_ticks / r->hash_interval ||
+      num_bytes > body_size || num_hashes > (body_size - num_bytes) / 8 ||
+      num_bytes + num_hashes * 8 != body_size)
+  {
+    fclose(f);
+    ERROR_RETURN(-1, "Broken replay header in %s", file);
+  }
+
+  r->num_bytes = r->max_bytes = (size_t)num_bytes;
+  r->num_hashes = r->max_hashes = (size_t)num_hashes;
+  r->bytes = malloc(r->num_bytes + 1);
+  r->hashes = malloc(r->num_hashes * sizeof(uint64_t) + 1);
+  int ok = r->bytes != NULL && r->hashes != NULL;
+  ok = ok && fread(r->bytes, 1, r->num_bytes, f) == r->num_bytes;
+  for (size_t i = 0; ok && i < r->num_hashes; i++)
+  {
+    uint8_t h[8];
+    ok = fread(h, 1, 8, f) == 8;
+    if (ok)
+    {
+      r->hashes[i] = replay_u64(h);
+    }
+  }
+  fclose(f);
+  if (ok == 0)
+  {
+    replay_free(r);
+    ERROR_RETURN(-1, "Truncated replay %s", file);
+  }
+
+  replay_rewind(r);
+  return 0;
+}
+
+void
+replay_rewind(ReplayLog *r)
+{
+  r->play_tick = 0;
+  r->play_input = 0;
+  r->read_pos = 0;
+  r->next_change = UINT64_MAX;
+  r->last_tick = 0;
+  replay_decode_next(r);
+}
+
+uint8_t
+replay_next(ReplayLog *r)
+{
+  if (r->play_tick == r->next_change)
+  {
+    r->play_input = r->bytes[r->read_pos++];
+    replay_decode_next(r);
+  }
+  r->play_tick++;
+  return r->play_tick <= r->num_ticks ? r->play_input : 0;
+}
+
+static void
+replay_push(ReplayLog *r, uint8_t b)
+{
+  if (r->num_bytes >= r->max_bytes)
+  {
+    size_t capacity = r->max_bytes ? r->max_bytes * 2 : 256;
+    uint8_t *new_bytes = realloc(r->bytes, capacity);
+    if (new_bytes == NULL)
+    {
+      ERROR_RETURN(, "Can't allocate space for replay input");
+    }
+    r->bytes = new_bytes;
+    r->max_bytes = capacity;
+  }
+  r->bytes[r->num_bytes++] = b;
+}
+
+static int
+replay_read_varint(const ReplayLog *r, size_t *pos, uint64_t *out)
+{
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (*pos >= r->num_bytes)
+    {
+      return -1;
+    }
+    uint8_t b = r->bytes[(*pos)++];
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+    {
+      *out = v;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Reads the tick of the next change, the input byte after it is consumed by
+// replay_next once that tick comes up
+static void
+replay_decode_next(ReplayLog *r)
+{
+  uint64_t delta;
+  size_t pos = r->read_pos;
+  if (replay_read_varint(r, &pos, &delta) != 0 || pos >= r->num_bytes)
+  {
+    r->next_change = UINT64_MAX;
+    return;
+  }
+
+  // Changes are relative to the previous one, last_tick starts at 0
+  r->read_pos = pos;
+  r->next_change = r->last_tick + delta;
+  r->last_tick = r->next_change;
+}
+
+static uint32_t
+replay_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+replay_u64(const uint8_t *p)
+{
+  return replay_u32(p) | (uint64_t)replay_u32(p + 4) << 32;
+}
+
+static void
+replay_put_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (uint8_t)(v >> (i * 8));
+  }
+}
+
+static void
+replay_put_u64(uint8_t *p, uint64_t v)
+{
+  replay_put_u32(p, (uint32_t)v);
+  replay_put_u32(p + 4, (uint32_t)(v >> 32));
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Replay file, all fields little-endian:
+//
+//   header  magic "LUKR", u16 version, u16 reserved, u32 tick rate,
+//           u32 hash interval, u32 view w, u32 view h, u64 level hash,
+//           u64 tick count, u64 input size, u64 hash count
+//   input   per change of the input byte: LEB128 ticks since the previous
+//           change (since tick 0 for the first), then the new input byte
+//   hashes  u64 scene hash after every hash interval ticks
+//
+// Input that doesn't change costs nothing, a typical minute of play is a few
+// hundred bytes plus the hashes.
+#define REPLAY_VERSION 1
+
+typedef struct {
+  uint32_t tick_rate, hash_interval;
+  uint32_t view_w, view_h;
+  uint64_t level_hash;
+  uint64_t num_ticks;
+
+  size_t  num_bytes, max_bytes;
+  uint8_t *bytes;
+  size_t   num_hashes, max_hashes;
+  uint64_t *hashes;
+
+  // Recording, tick and value of the last change
+  uint64_t last_tick;
+  uint8_t  last_input;
+
+  // Playback cursor
+  uint64_t play_tick, next_change;
+  size_t   read_pos;
+  uint8_t  play_input;
+}
+ReplayLog;
+
+void replay_init(ReplayLog *r, uint32_t tick_rate, uint32_t hash_interval,
+                 uint32_t view_w, uint32_t view_h, uint64_t level_hash);
+void replay_free(ReplayLog *r);
+
+// Input for the next tick, called once per tick in order
+void replay_record(ReplayLog *r, uint8_t input);
+// State hash after the last recorded tick, only kept when the tick count is a
+// multiple of hash_interval, so callers check that before hashing
+void replay_record_hash(ReplayLog *r, uint64_t hash);
+
+int replay_save(const ReplayLog *r, const char *file);
+// Returns 0 and a log ready for playback, or -1 for missing or broken files
+int replay_load(ReplayLog *r, const char *file);
+
+// Input for the next tick of playback, 0 past the end
+void    replay_rewind(ReplayLog *r);
+uint8_t replay_next(ReplayLog *r);
@@ -1,13 +1,31 @@
 #include "scene.h"
 #include "game.h"
+#include "prof.h"
+#include "simd.h"
 #include "util.h"
 
 #include <stdint.h>
+#include <string.h>
+
+// Sprites are indexed by position, the view is widened by the largest sprite
+// half extent so sprites poking in from a neighbouring cell still get drawn
+#define SCENE_CULL_CELL   128.0f
+#define SCENE_CULL_MARGIN 32.0f
+
+// Most bodies are a tile or two across
+#define SCENE_BROAD_CELL 64.0f
+
+// Address space for the scene arena, the per chunk tables of an 8192x8192
+// level take under 2 MB
+#define SCENE_ARENA_RESERVE ((size_t)64 << 20)
+
+// Entities alive at once, spawns included, sizes the ECS reservations
+#define SCENE_MAX_ENTITIES ((size_t)1 << 18)
 
 typedef enum {
-  ETag_Player = 1 >> 0,
-  ETag_Wall   = 1 >> 1,
-  ETag_Coin   = 1 >> 2,
+  ETag_Player = 1 << 0,
+  ETag_Wall   = 1 << 1,
+  ETag_Coin   = 1 << 2,
 }
 ETag;
 
@@ -16,16 +34,24 @@ typedef struct {
 }
 C_Tag;
 
+// Only floats, columns of these are flat float arrays for the simd kernels
 typedef struct {
   float x, y;
 }
-C_Pos, C_Vel;
+C_Pos, C_Vel, C_Acc, C_Prev;
 
+// Collision box of size x by y, centered on the position moved by ox, oy
 typedef struct {
   float x, y, ox, oy;
 }
 C_Size;
 
+// COLLIDE_* contacts from the last collision step
+typedef struct {
+  uint32_t hits;
+}
+C_Coll;
+
 typedef struct {
   int can_jump;
   float timer_jump, timer_coyote;
@@ -33,7 +59,7 @@ typedef struct {
 C_Plat;
 
 typedef struct {
-  const char *spr;
+  SpriteId spr;
   float sx, sy, rot;
 } C_Spr;
 
@@ -44,50 +70,68 @@ typedef enum {
   CE_Size,
   CE_Plat,
   CE_Spr,
+  CE_Coll,
+  CE_Acc,
+  CE_Prev,
   CE_Count
 }
 Component;
 
-static size_t scene_create_entity(Scene *s, C_Tag *i_tag, C_Pos *i_pos, C_Vel *i_vel, C_Size *i_size, C_Spr *i_spr);
-static void scene_update_player(Scene *s, size_t e, float dt);
-
-uint8_t *
-level_load(const char *file, size_t *width, size_t *height)
-{
-  FILE *f = fopen(file, "rb");
-  fread(width, sizeof(size_t), 1, f);
-  fread(height, sizeof(size_t), 1, f);
-
-  uint8_t *brick_data = malloc(sizeof(uint8_t) * (*width) * (*height));
-  fread(brick_data, sizeof(uint8_t), (*width) * (*height), f);
-
-  fclose(f);
-
-  return brick_data;
+// Scene state systems share outside the ECS, numbered past the components so
+// systems declare it in their signatures and the scheduler orders them
+typedef enum {
+  CR_Camera = CE_Count,
+  CR_Cull,
+  // The broadphase and the trigger pairs read out of it
+  CR_Broad,
 }
+Resource;
 
-void
-level_write(const char *file, size_t w, size_t h, uint8_t *data)
-{
-  FILE *f = fopen(file, "wb");
-  if (f == NULL)
-  {
-    ERROR_RETURN(, "Can't open file %s", file);
-  }
-
-  fwrite(&w, sizeof(size_t), 1, f);
-  fwrite(&h, sizeof(size_t), 1, f);
-  fwrite(data, sizeof(uint8_t), w * h, f);
+// Adds src * dt to dst, both columns of float pairs
+typedef struct {
+  float *dst;
+  const float *src;
+  float dt;
+}
+MaddJob;
 
-  fclose(f);
+typedef struct {
+  C_Pos  *pos;
+  C_Vel  *vel;
+  C_Size *size;
+  C_Coll *coll;
+  Tilemap *tilemap;
+  float dt;
 }
+CollideJob;
+
+static EntityId scene_create_entity(Scene *s, C_Tag *i_tag, C_Pos *i_pos, C_Vel *i_vel, C_Size *i_size, C_Spr *i_spr);
+static void scene_system_player(void *data, float dt);
+static void scene_system_accel(void *data, float dt);
+static void scene_system_move(void *data, float dt);
+static void scene_system_collide(void *data, float dt);
+static void scene_collide_range(void *data, size_t begin, size_t end);
+static void scene_system_prev(void *data, float dt);
+static void scene_view(Scene *s, float alpha, float *x, float *y, float *w, float *h);
+static void scene_system_camera(void *data, float dt);
+static void scene_system_cull(void *data, float dt);
+static void scene_system_trigger(void *data, float dt);
+static void scene_handle_trigger(Scene *s, EntityId a, EntityId b);
+static uint64_t scene_tags(Scene *s, EntityId e);
+static void scene_madd_range(void *data, size_t begin, size_t end);
+static void scene_update_player(Scene *s, EntityId e, float dt);
 
 Scene *
-scene_init(uint8_t *bricks, size_t w, size_t h)
+scene_init(const Level *level)
 {
-  Scene *scene = calloc(sizeof(Scene), 1);
-  scene->w = w;
-  scene->h = h;
+  // The scene lives in its own arena, which moves into it once allocated
+  Arena arena;
+  arena_init(&arena, SCENE_ARENA_RESERVE);
+  Scene *scene = arena_calloc(&arena, 1, sizeof(Scene));
+  DEBUG_ASSERT(scene, "Can't allocate space for scene");
+  scene->arena = arena;
+  scene->w = level->w;
+  scene->h = level->h;
 
   scene->plat_speed   = 160.0f;
   scene->plat_accel   = 700.0f;
@@ -99,6 +143,8 @@ scene_init(uint8_t *bricks, size_t w, size_t h)
   scene->timer_jump   = 0.18f;
   scene->timer_coyote = 0.05f;
 
+  scene->font = game_font_id("font0");
+
   DEBUG_TRACE("Scene init begin");
 
   size_t cs[CE_Count] = {
@@ -108,13 +154,88 @@ scene_init(uint8_t *bricks, size_t w, size_t h)
     [CE_Size] = sizeof(C_Size),
     [CE_Plat] = sizeof(C_Plat),
     [CE_Spr]  = sizeof(C_Spr),
+    [CE_Coll] = sizeof(C_Coll),
+    [CE_Acc]  = sizeof(C_Acc),
+    [CE_Prev] = sizeof(C_Prev),
   };
-  scene->ecs = ecs_init(CE_Count, cs);
+  scene->ecs = ecs_init(CE_Count, cs, SCENE_MAX_ENTITIES);
+  scene->cmd = ecs_cmd_init(scene->ecs);
+  scene->sched = sched_init(0);
+  scene->cull = spatial_init(SCENE_CULL_CELL);
+  scene->broad = broad_init(SCENE_BROAD_CELL);
+
+  // Systems
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Pos);
+    signature_set(&writes, CE_Prev);
+    sched_add_system(scene->sched, "prev", scene_system_prev, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Tag);
+    signature_set(&reads, CE_Coll);
+    signature_set(&writes, CE_Vel);
+    signature_set(&writes, CE_Acc);
+    signature_set(&writes, CE_Plat);
+    sched_add_system(scene->sched, "player", scene_system_player, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Acc);
+    signature_set(&writes, CE_Vel);
+    sched_add_system(scene->sched, "accel", scene_system_accel, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Vel);
+    signature_set(&writes, CE_Pos);
+    sched_add_system(scene->sched, "move", scene_system_move, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Size);
+    signature_set(&writes, CE_Pos);
+    signature_set(&writes, CE_Vel);
+    signature_set(&writes, CE_Coll);
+    sched_add_system(scene->sched, "collide", scene_system_collide, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Pos);
+    signature_set(&writes, CR_Camera);
+    sched_add_system(scene->sched, "camera", scene_system_camera, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Pos);
+    signature_set(&reads, CE_Vel);
+    signature_set(&reads, CE_Spr);
+    signature_set(&writes, CR_Cull);
+    sched_add_system(scene->sched, "cull", scene_system_cull, scene, &reads, &writes);
+  }
+  {
+    Signature reads = {{0}}, writes = {{0}};
+    signature_set(&reads, CE_Pos);
+    signature_set(&reads, CE_Size);
+    signature_set(&writes, CR_Broad);
+    sched_add_system(scene->sched, "trigger", scene_system_trigger, scene, &reads, &writes);
+  }
 
-  // Player
+  // Player, at the first player spawn if the level has one
   {
     C_Tag p_tag = {ETag_Player};
     C_Pos p_pos = {80, 80};
+    for (size_t i = 0; i < level->num_spawns; i++)
+    {
+      LevelSpawn sp = level_get_spawn(level, i);
+      if (sp.type == LevelSpawn_Player)
+      {
+        p_pos.x = sp.x;
+        p_pos.y = sp.y;
+        break;
+      }
+    }
     C_Vel p_vel = {0};
     C_Size p_size = {
       .x  = 10,
@@ -123,51 +244,78 @@ scene_init(uint8_t *bricks, size_t w, size_t h)
       .oy = 1
     };
     C_Spr p_sprite = {
-      .spr = "plr_s",
+      .spr = game_sprite_id("plr_s"),
       .sx  = 1,
       .sy  = 1,
       .rot = 0,
     };
-    size_t p = scene_create_entity(scene, &p_tag, &p_pos, &p_vel, &p_size, &p_sprite);
-    ecs_add_component(scene->ecs, p, CE_Plat);
+    EntityId p = scene_create_entity(scene, &p_tag, &p_pos, &p_vel, &p_size, &p_sprite);
+    ecs_cmd_add(scene->cmd, p, CE_Plat, NULL);
+    ecs_cmd_add(scene->cmd, p, CE_Coll, NULL);
+    ecs_cmd_add(scene->cmd, p, CE_Acc, NULL);
+
+    camera_init(&scene->camera, p_pos.x, p_pos.y, 1);
+    scene->camera.target = p;
+    scene->camera.bound_w = level->w * TILE_SIZE;
+    scene->camera.bound_h = level->h * TILE_SIZE;
   }
 
-  int *brick_ids = calloc(w * h, sizeof(int));
-
-  // Bricks
-  for (size_t i = 0; i < w * h; i++)
+  // Coins and crates
+  for (size_t i = 0; i < level->num_spawns; i++)
   {
-    if ((bricks[i] & LevelElement_Brick) == 0)
+    LevelSpawn sp = level_get_spawn(level, i);
+    if (sp.type == LevelSpawn_Crate)
     {
-      brick_ids[i] = -1;
+      C_Pos k_pos = {sp.x, sp.y};
+      C_Vel k_vel = {0};
+      C_Acc k_acc = {0, scene->grav_fall};
+      C_Size k_size = {
+        .x  = 14,
+        .y  = 14,
+        .ox = 0,
+        .oy = 1
+      };
+      C_Spr k_sprite = {
+        .spr = game_sprite_id("brick_c"),
+        .sx  = 1,
+        .sy  = 1,
+        .rot = 0,
+      };
+      EntityId k = scene_create_entity(scene, NULL, &k_pos, &k_vel, &k_size, &k_sprite);
+      ecs_cmd_add(scene->cmd, k, CE_Acc, &k_acc);
       continue;
     }
-
-    int x = i % w, y = i / w;
-    C_Tag b_tag = {ETag_Wall};
-    C_Pos b_pos = {x * 16 + 8, y * 16 + 8};
-    C_Spr b_sprite = {NULL, 1, 1, 0};
-
-    int left_n = (x == 0) || (bricks[i - 1] & LevelElement_Brick);
-    int right_n = (x == w - 1) || (bricks[i + 1] & LevelElement_Brick);
-
-    switch((left_n * 1) | (right_n * 2))
+    if (sp.type != LevelSpawn_Coin)
     {
-    case 1:
-      b_sprite.spr = "brick_r";
-      break;
-    case 2:
-      b_sprite.spr = "brick_l";
-      break;
-    default:
-      b_sprite.spr = "brick_c";
-      break;
+      continue;
     }
+    C_Tag c_tag = {ETag_Coin};
+    C_Pos c_pos = {sp.x, sp.y};
+    C_Size c_size = {
+      .x  = 10,
+      .y  = 10,
+      .ox = 0,
+      .oy = 0
+    };
+    C_Spr c_sprite = {
+      .spr = game_sprite_id("coin"),
+      .sx  = 1,
+      .sy  = 1,
+      .rot = 0,
+    };
+    scene_create_entity(scene, &c_tag, &c_pos, NULL, &c_size, &c_sprite);
+  }
 
-    int b = scene_create_entity(scene, &b_tag, &b_pos, NULL, NULL, &b_sprite);
-    brick_ids[i] = b;
+  // Bricks never move, they're kept as tiles and drawn from baked chunks. The
+  // chunks around the player are loaded before the first frame.
+  scene->tilemap = tilemap_init(level, &scene->arena);
+  {
+    float vx, vy, vw, vh;
+    scene_view(scene, 1, &vx, &vy, &vw, &vh);
+    tilemap_stream(scene->tilemap, vx, vy, vw, vh, 1);
   }
-  scene->brick_ids = brick_ids;
+
+  ecs_cmd_flush(scene->cmd);
 
   DEBUG_TRACE("Scene init end");
 
@@ -179,78 +327,110 @@ scene_free(Scene *s)
 {
   DEBUG_TRACE("Scene free");
 
+  sched_free(s->sched);
+  spatial_free(s->cull);
+  broad_free(s->broad);
+  ecs_cmd_free(s->cmd);
   ecs_free(s->ecs);
-  free(s->brick_ids);
-  free(s);
+  tilemap_free(s->tilemap);
+
+  Arena arena = s->arena;
+  arena_free(&arena);
 }
 
 void
-scene_update(Scene *s, float dt, float ct)
+scene_update(Scene *s, float dt, uint64_t tick)
 {
-  size_t num_e = 0, max_e = 0, num_iter = 0;
-  ecs_get_entities(s->ecs, &num_e, &max_e);
+  PROF_BEGIN("scene_update");
+  sched_run(s->sched, dt);
 
-  for (size_t e = 0; e < max_e && num_iter < num_e; e++)
+  // Triggers run one at a time after the systems, they're free to change
+  // anything, structural changes go through the command buffer
+  for (size_t i = 0; i < s->num_triggers; i++)
   {
-    if (ecs_alive(s->ecs, e) == 0)
-    {
-      continue;
-    }
-    num_iter++;
+    scene_handle_trigger(s, s->triggers[i].a, s->triggers[i].b);
+  }
 
-    if (ecs_has_component(s->ecs, e, CE_Tag) == 0)
-    {
-      DEBUG_ERROR("Entity %ld has no tags!", e);
-      continue;
-    }
+  // Structural changes requested by systems are applied here, after iteration
+  ecs_cmd_flush(s->cmd);
 
-    C_Tag *et = ecs_get_component(s->ecs, e, CE_Tag);
+  float vx, vy, vw, vh;
+  scene_view(s, 1, &vx, &vy, &vw, &vh);
+  tilemap_stream(s->tilemap, vx, vy, vw, vh, s->stream_wait);
+  PROF_END();
+}
 
-    // Player
-    if (et->tags & ETag_Player)
+void
+scene_snapshot(Scene *s, RenderSnapshot *out)
+{
+  out->camera = s->camera;
+  size_t max_entities;
+  ecs_get_entities(s->ecs, &out->entities, &max_entities);
+
+  // The renderer's view lies between the views before and after the tick
+  float px, py, pw, ph, cx, cy, cw, ch;
+  scene_view(s, 0, &px, &py, &pw, &ph);
+  scene_view(s, 1, &cx, &cy, &cw, &ch);
+  float x0 = (px < cx ? px : cx) - SCENE_CULL_MARGIN;
+  float y0 = (py < cy ? py : cy) - SCENE_CULL_MARGIN;
+  float x1 = (px + pw > cx + cw ? px + pw : cx + cw) + SCENE_CULL_MARGIN;
+  float y1 = (py + ph > cy + ch ? py + ph : cy + ch) + SCENE_CULL_MARGIN;
+
+  // Only cells around the view are visited, whatever the size of the level
+  EntityId *visible;
+  size_t num_visible = spatial_query(s->cull, x0, y0, x1, y1, &visible);
+  for (size_t i = 0; i < num_visible; i++)
+  {
+    if (ecs_alive(s->ecs, visible[i]) == 0)
     {
-      scene_update_player(s, e, dt);
+      continue;
     }
-
-    // Update position with velocity
-    if (ecs_has_component(s->ecs, e, CE_Pos) && ecs_has_component(s->ecs, e, CE_Vel))
+    C_Pos *ep = ecs_get_component(s->ecs, visible[i], CE_Pos);
+    C_Spr *es = ecs_get_component(s->ecs, visible[i], CE_Spr);
+    C_Prev *eq = ep;
+    if (ecs_has_component(s->ecs, visible[i], CE_Prev))
     {
-      C_Vel *ep = ecs_get_component(s->ecs, e, CE_Pos);
-      C_Vel *ev = ecs_get_component(s->ecs, e, CE_Vel);
-      ep->x += ev->x * dt;
-      ep->y += ev->y * dt;
+      eq = ecs_get_component(s->ecs, visible[i], CE_Prev);
     }
+    snapshot_sprite(out, es->spr, eq->x, eq->y, ep->x, ep->y, es->sx, es->sy, es->rot);
   }
+
+  snapshot_text(out, s->font, "Press arrow keys to move around", 160, 32, 0.5f, 0.5f, 0.5f, 0.5f);
 }
 
 void
-scene_render(Scene *s, float dt, float ct)
+scene_render(Scene *s, const RenderSnapshot *snap, float alpha)
 {
-  size_t num_e = 0, max_e = 0, num_iter = 0;
-  ecs_get_entities(s->ecs, &num_e, &max_e);
-
-  for (size_t e = 0; e < max_e && num_iter < num_e; e++)
-  {
-    if (ecs_alive(s->ecs, e) == 0)
-    {
-      continue;
-    }
-    num_iter++;
+  PROF_BEGIN("scene_render");
 
-    if (ecs_has_component(s->ecs, e, CE_Pos) == 0 || ecs_has_component(s->ecs, e, CE_Spr) == 0)
-    {
-      continue;
-    }
+  // Everything is drawn alpha of the way between the last two ticks, so motion
+  // stays smooth at any tick rate, a tick behind the simulation at most
+  int vw, vh;
+  game_get_view_size(&vw, &vh);
+  Camera c;
+  camera_blend(&snap->camera, alpha, &c);
+  float cx, cy, cw, ch;
+  camera_get_view(&c, vw, vh, &cx, &cy, &cw, &ch);
 
-    C_Pos *ep = ecs_get_component(s->ecs, e, CE_Pos);
-    C_Spr *es = ecs_get_component(s->ecs, e, CE_Spr);
+  game_set_view(cx, cy, c.zoom);
+  tilemap_render(s->tilemap, cx, cy, cw, ch);
 
-    game_draw_sprite(es->spr, ep->x, ep->y, es->sx, es->sy, es->rot);
+  for (size_t i = 0; i < snap->num_sprites; i++)
+  {
+    const RenderSprite *r = &snap->sprites[i];
+    float x = r->prev_x + (r->x - r->prev_x) * alpha;
+    float y = r->prev_y + (r->y - r->prev_y) * alpha;
+    game_draw_sprite(r->spr, x, y, r->sx, r->sy, r->rot);
   }
 
-  game_draw_text("font0",
-                 "Press arrow keys to move around",
-                 160, 32, 0.5f, 0.5f, 0.5f, 0.5f);
+  // Text is overlay, drawn in view coordinates
+  game_set_view(0, 0, 1);
+  for (size_t i = 0; i < snap->num_texts; i++)
+  {
+    const RenderText *r = &snap->texts[i];
+    game_draw_text(r->font, snap->chars + r->text, r->x, r->y, r->sx, r->sy, r->ox, r->oy);
+  }
+  PROF_END();
 }
 
 void
@@ -273,61 +453,396 @@ scene_input_key(Scene *s, int key, int pressed)
   }
 }
 
-static size_t
+uint8_t
+scene_get_input(const Scene *s)
+{
+  return (s->in.left  ? SCENE_INPUT_LEFT  : 0) |
+         (s->in.right ? SCENE_INPUT_RIGHT : 0) |
+         (s->in.up    ? SCENE_INPUT_UP    : 0) |
+         (s->in.down  ? SCENE_INPUT_DOWN  : 0);
+}
+
+void
+scene_set_input(Scene *s, uint8_t input)
+{
+  s->in.left  = (input & SCENE_INPUT_LEFT)  != 0;
+  s->in.right = (input & SCENE_INPUT_RIGHT) != 0;
+  s->in.up    = (input & SCENE_INPUT_UP)    != 0;
+  s->in.down  = (input & SCENE_INPUT_DOWN)  != 0;
+}
+
+uint64_t
+scene_hash(Scene *s)
+{
+  uint64_t h = ecs_hash(s->ecs);
+  h = h * 0x100000001b3ull ^ hash_bytes(&s->camera, sizeof(Camera));
+  h = h * 0x100000001b3ull ^ hash_bytes(&s->coins, sizeof(int));
+  return h;
+}
+
+void
+scene_save(Scene *s, SceneSave *out)
+{
+  ecs_snapshot(s->ecs, &out->ecs);
+  out->camera = s->camera;
+  out->coins = s->coins;
+}
+
+int
+scene_load(Scene *s, const SceneSave *save)
+{
+  if (ecs_restore(s->ecs, &save->ecs) != 0)
+  {
+    return -1;
+  }
+  s->camera = save->camera;
+  s->coins = save->coins;
+
+  // Coins picked up since the save were taken out of the cull index, so it's
+  // built again from every sprite
+  spatial_free(s->cull);
+  s->cull = spatial_init(SCENE_CULL_CELL);
+
+  Signature spr_mask = {{0}};
+  signature_set(&spr_mask, CE_Pos);
+  signature_set(&spr_mask, CE_Spr);
+  ECSQuery q = ecs_query(s->ecs, &spr_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    C_Pos *ep = ecs_query_column(&q, CE_Pos);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      spatial_update(s->cull, q.entities[i], ep[i].x, ep[i].y);
+    }
+  }
+
+  // Triggers found at the end of the saved tick
+  scene_system_trigger(s, 0);
+  return 0;
+}
+
+void
+scene_save_free(SceneSave *save)
+{
+  ecs_snapshot_free(&save->ecs);
+}
+
+size_t
+scene_query_region(Scene *s, float x0, float y0, float x1, float y1, EntityId **out)
+{
+  return broad_query(s->broad, x0, y0, x1, y1, out);
+}
+
+size_t
+scene_query_point(Scene *s, float x, float y, EntityId **out)
+{
+  return broad_point(s->broad, x, y, out);
+}
+
+static EntityId
 scene_create_entity(Scene *s, C_Tag *i_tag, C_Pos *i_pos, C_Vel *i_vel, C_Size *i_size, C_Spr *i_spr)
 {
-  size_t e = ecs_create_entity(s->ecs);
+  EntityId e = ecs_cmd_create(s->cmd);
 
   if (i_tag != NULL)
   {
-    C_Tag *t = ecs_add_component(s->ecs, e, CE_Tag);
-    t->tags |= i_tag->tags;
+    ecs_cmd_add(s->cmd, e, CE_Tag, i_tag);
   }
   if (i_pos != NULL)
   {
-    C_Pos *p = ecs_add_component(s->ecs, e, CE_Pos);
-    p->x = i_pos->x;
-    p->y = i_pos->y;
+    ecs_cmd_add(s->cmd, e, CE_Pos, i_pos);
   }
   if (i_vel != NULL)
   {
-    C_Vel *v = ecs_add_component(s->ecs, e, CE_Vel);
-    v->x = i_vel->x;
-    v->y = i_vel->y;
+    ecs_cmd_add(s->cmd, e, CE_Vel, i_vel);
   }
   if (i_size != NULL)
   {
-    C_Size *sz = ecs_add_component(s->ecs, e, CE_Size);
-    sz->x = i_size->x;
-    sz->y = i_size->y;
-    sz->ox = i_size->ox;
-    sz->oy = i_size->oy;
+    ecs_cmd_add(s->cmd, e, CE_Size, i_size);
   }
   if (i_spr != NULL)
   {
-    C_Spr *sp = ecs_add_component(s->ecs, e, CE_Spr);
-    sp->spr = i_spr->spr;
-    sp->rot = i_spr->rot;
-    sp->sx = i_spr->sx;
-    sp->sy = i_spr->sy;
+    ecs_cmd_add(s->cmd, e, CE_Spr, i_spr);
+  }
+  if (i_pos != NULL && i_vel != NULL && i_spr != NULL)
+  {
+    ecs_cmd_add(s->cmd, e, CE_Prev, i_pos);
+  }
+  if (i_pos != NULL && i_spr != NULL)
+  {
+    spatial_update(s->cull, e, i_pos->x, i_pos->y);
   }
 
   return e;
 }
 
 static void
-scene_update_player(Scene *s, size_t plr, float dt)
+scene_view(Scene *s, float alpha, float *x, float *y, float *w, float *h)
+{
+  int vw, vh;
+  game_get_view_size(&vw, &vh);
+
+  Camera c;
+  camera_blend(&s->camera, alpha, &c);
+  camera_get_view(&c, vw, vh, x, y, w, h);
+}
+
+static void
+scene_system_prev(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature prev_mask = {{0}};
+  signature_set(&prev_mask, CE_Pos);
+  signature_set(&prev_mask, CE_Prev);
+
+  // Positions at the start of the tick, renderers blend from these
+  ECSQuery q = ecs_query(s->ecs, &prev_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    memcpy(ecs_query_column(&q, CE_Prev), ecs_query_column(&q, CE_Pos), q.count * sizeof(C_Pos));
+  }
+}
+
+static void
+scene_system_player(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature plat_mask = {{0}};
+  signature_set(&plat_mask, CE_Tag);
+  signature_set(&plat_mask, CE_Plat);
+
+  ECSQuery q = ecs_query(s->ecs, &plat_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    C_Tag *et = ecs_query_column(&q, CE_Tag);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      if (et[i].tags & ETag_Player)
+      {
+        scene_update_player(s, q.entities[i], dt);
+      }
+    }
+  }
+}
+
+static void
+scene_system_accel(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature accel_mask = {{0}};
+  signature_set(&accel_mask, CE_Vel);
+  signature_set(&accel_mask, CE_Acc);
+
+  ECSQuery q = ecs_query(s->ecs, &accel_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    MaddJob job = {ecs_query_column(&q, CE_Vel), ecs_query_column(&q, CE_Acc), dt};
+    sched_parallel_for(s->sched, q.count, 4096, scene_madd_range, &job);
+  }
+}
+
+static void
+scene_system_move(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature move_mask = {{0}}, exclude = {{0}};
+  signature_set(&move_mask, CE_Pos);
+  signature_set(&move_mask, CE_Vel);
+  signature_set(&exclude, CE_Size);
+
+  // Update position with velocity, split over worker threads for big archetypes.
+  // Bodies with a size are moved by the collide system instead.
+  ECSQuery q = ecs_query(s->ecs, &move_mask, &exclude);
+  while (ecs_query_next(&q))
+  {
+    MaddJob job = {ecs_query_column(&q, CE_Pos), ecs_query_column(&q, CE_Vel), dt};
+    sched_parallel_for(s->sched, q.count, 4096, scene_madd_range, &job);
+  }
+}
+
+static void
+scene_system_collide(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature coll_mask = {{0}};
+  signature_set(&coll_mask, CE_Pos);
+  signature_set(&coll_mask, CE_Vel);
+  signature_set(&coll_mask, CE_Size);
+
+  // Bodies only read the solid grid and write their own components, so they
+  // are swept in parallel like plain movers
+  ECSQuery q = ecs_query(s->ecs, &coll_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    CollideJob job = {
+      .pos     = ecs_query_column(&q, CE_Pos),
+      .vel     = ecs_query_column(&q, CE_Vel),
+      .size    = ecs_query_column(&q, CE_Size),
+      .coll    = ecs_query_column(&q, CE_Coll),
+      .tilemap = s->tilemap,
+      .dt      = dt,
+    };
+    sched_parallel_for(s->sched, q.count, 1024, scene_collide_range, &job);
+  }
+}
+
+static void
+scene_system_camera(void *data, float dt)
+{
+  Scene *s = data;
+  Camera *c = &s->camera;
+
+  if (c->target != ECS_NULL_ENTITY && ecs_alive(s->ecs, c->target))
+  {
+    C_Pos *tp = ecs_get_component(s->ecs, c->target, CE_Pos);
+    camera_follow(c, tp->x, tp->y, dt);
+  }
+}
+
+static void
+scene_system_cull(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature cull_mask = {{0}};
+  signature_set(&cull_mask, CE_Pos);
+  signature_set(&cull_mask, CE_Vel);
+  signature_set(&cull_mask, CE_Spr);
+
+  // Sprites without velocity are indexed once when created, only movers are
+  // revisited, and most of them stay in the same cell
+  ECSQuery q = ecs_query(s->ecs, &cull_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    C_Pos *ep = ecs_query_column(&q, CE_Pos);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      spatial_update(s->cull, q.entities[i], ep[i].x, ep[i].y);
+    }
+  }
+}
+
+static void
+scene_system_trigger(void *data, float dt)
+{
+  Scene *s = data;
+
+  Signature body_mask = {{0}};
+  signature_set(&body_mask, CE_Pos);
+  signature_set(&body_mask, CE_Size);
+
+  broad_clear(s->broad);
+  ECSQuery q = ecs_query(s->ecs, &body_mask, NULL);
+  while (ecs_query_next(&q))
+  {
+    C_Pos  *ep = ecs_query_column(&q, CE_Pos);
+    C_Size *es = ecs_query_column(&q, CE_Size);
+    for (size_t i = 0; i < q.count; i++)
+    {
+      float x0 = ep[i].x + es[i].ox - es[i].x / 2;
+      float y0 = ep[i].y + es[i].oy - es[i].y / 2;
+      broad_add(s->broad, q.entities[i], x0, y0, x0 + es[i].x, y0 + es[i].y);
+    }
+  }
+  broad_build(s->broad);
+
+  s->num_triggers = broad_pairs(s->broad, &s->triggers);
+}
+
+static void
+scene_handle_trigger(Scene *s, EntityId a, EntityId b)
+{
+  uint64_t ta = scene_tags(s, a), tb = scene_tags(s, b);
+
+  // Player picks up coins
+  EntityId coin = (ta & ETag_Coin) ? a : (tb & ETag_Coin) ? b : ECS_NULL_ENTITY;
+  uint64_t other = coin == a ? tb : ta;
+  if (coin != ECS_NULL_ENTITY && (other & ETag_Player))
+  {
+    ecs_cmd_destroy(s->cmd, coin);
+    spatial_remove(s->cull, coin);
+    s->coins++;
+  }
+}
+
+static uint64_t
+scene_tags(Scene *s, EntityId e)
+{
+  if (ecs_alive(s->ecs, e) == 0 || ecs_has_component(s->ecs, e, CE_Tag) == 0)
+  {
+    return 0;
+  }
+  return ((C_Tag *)ecs_get_component(s->ecs, e, CE_Tag))->tags;
+}
+
+static void
+scene_madd_range(void *data, size_t begin, size_t end)
 {
-  C_Pos *pp = ecs_get_component(s->ecs, plr, CE_Pos);
+  MaddJob *job = data;
+  simd_madd(job->dst + begin * 2, job->src + begin * 2, (end - begin) * 2, job->dt);
+}
+
+static void
+scene_collide_range(void *data, size_t begin, size_t end)
+{
+  CollideJob *job = data;
+  for (size_t i = begin; i < end; i++)
+  {
+    C_Pos  *p = &job->pos[i];
+    C_Vel  *v = &job->vel[i];
+    C_Size *z = &job->size[i];
+
+    float bx = p->x + z->ox - z->x / 2;
+    float by = p->y + z->oy - z->y / 2;
+    float dx = v->x * job->dt, dy = v->y * job->dt;
+
+    // Tiles the body would sweep through were never loaded, it waits there
+    // instead of moving through an empty grid
+    if (tilemap_known(job->tilemap, bx + (dx < 0 ? dx : 0), by + (dy < 0 ? dy : 0),
+                      bx + z->x + (dx > 0 ? dx : 0), by + z->y + (dy > 0 ? dy : 0)) == 0)
+    {
+      v->x = 0;
+      v->y = 0;
+      continue;
+    }
+
+    uint32_t hits = collide_sweep(job->tilemap->solid, &bx, &by, z->x, z->y, dx, dy);
+    p->x = bx - z->ox + z->x / 2;
+    p->y = by - z->oy + z->y / 2;
+
+    if (hits & (COLLIDE_LEFT | COLLIDE_RIGHT))
+    {
+      v->x = 0;
+    }
+    if (hits & (COLLIDE_UP | COLLIDE_DOWN))
+    {
+      v->y = 0;
+    }
+    if (job->coll != NULL)
+    {
+      job->coll[i].hits = hits;
+    }
+  }
+}
+
+static void
+scene_update_player(Scene *s, EntityId plr, float dt)
+{
+  PROF_BEGIN("scene_update_player");
   C_Vel *pv = ecs_get_component(s->ecs, plr, CE_Vel);
-  C_Size *ps = ecs_get_component(s->ecs, plr, CE_Size);
+  C_Acc *pa = ecs_get_component(s->ecs, plr, CE_Acc);
+  C_Coll *pc = ecs_get_component(s->ecs, plr, CE_Coll);
   C_Plat *pl = ecs_get_component(s->ecs, plr, CE_Plat);
 
   float h_dest = (s->in.right - s->in.left) * s->plat_speed;
   float h_step = h_dest ? s->plat_accel : s->plat_fric;
   pv->x = lerp(pv->x, h_dest, h_step * dt);
 
-  pv->y += (pv->y > 0 ? s->grav_fall : s->grav_jump) * dt ;
   if (s->in.up && pl->can_jump)
   {
     float jump_linear = sqrtf(pl->timer_jump / s->timer_jump);
@@ -339,43 +854,11 @@ scene_update_player(Scene *s, size_t plr, float dt)
     pl->timer_coyote = s->timer_coyote;
   }
 
-  // Horzontal and vertical movement for collision has to be handled separately
-  int xi_hl = (int)((pp->x - (ps->x - ps->ox + 0.5f) / 2 + pv->x * dt) / 16);
-  int xi_hr = (int)((pp->x + (ps->x + ps->ox + 0.5f) / 2 + pv->x * dt) / 16);
-  int yi_hu = (int)((pp->y - (ps->y - ps->oy + 0.5f) / 2) / 16);
-  int yi_hd = (int)((pp->y + (ps->y + ps->oy + 0.5f) / 2) / 16);
-  int xi_vl = (int)((pp->x - (ps->x - ps->ox + 0.5f) / 2) / 16);
-  int xi_vr = (int)((pp->x + (ps->x + ps->ox + 0.5f) / 2) / 16);
-  int yi_vu = (int)((pp->y - (ps->y - ps->oy + 0.5f) / 2 + pv->y * dt) / 16);
-  int yi_vd = (int)((pp->y + (ps->y + ps->oy + 0.5f) / 2 + pv->y * dt) / 16);
-
-  if (xi_hl < 0    || xi_hr < 0    || yi_hu < 0    || yi_hd < 0    ||
-      xi_vl < 0    || xi_vr < 0    || yi_vu < 0    || yi_vd < 0    ||
-      xi_hl > s->w || xi_hr > s->w || yi_hu > s->h || yi_hd > s->h ||
-      xi_vl > s->w || xi_vr > s->w || yi_vu > s->h || yi_vd > s->h)
-  {
-    DEBUG_WARNING("Player outside bounds");
-    return;
-  }
-
-  int col_l = (s->brick_ids[yi_hu * s->w + xi_hl] != -1 ||
-               s->brick_ids[yi_hd * s->w + xi_hl] != -1);
-  int col_r = (s->brick_ids[yi_hu * s->w + xi_hr] != -1 ||
-               s->brick_ids[yi_hd * s->w + xi_hr] != -1);
-  int col_u = (s->brick_ids[yi_vu * s->w + xi_vl] != -1 ||
-               s->brick_ids[yi_vu * s->w + xi_vr] != -1);
-  int col_d = (s->brick_ids[yi_vd * s->w + xi_vl] != -1 ||
-               s->brick_ids[yi_vd * s->w + xi_vr] != -1);
+  // Gravity is applied by the accel system with every other body
+  pa->y = pv->y > 0 ? s->grav_fall : s->grav_jump;
 
-  if ((pv->x < 0 && col_l) || (pv->x > 0 && col_r))
-  {
-    pv->x = 0;
-  }
-  if ((pv->y < 0 && col_u) || col_d)
-  {
-    pp->y -= col_d * pv->y * dt;
-    pv->y = 0;
-  }
+  // Standing on ground as of the last collision step
+  int col_d = (pc->hits & COLLIDE_DOWN) != 0;
 
   // Update coyote and jump timers and update if player can jump
   pl->timer_jump += dt;
@@ -391,4 +874,5 @@ scene_update_player(Scene *s, size_t plr, float dt)
     pl->timer_coyote = 0;
   }
   pl->can_jump = col_d || (pl->timer_jump < s->timer_jump) || (pl->timer_coyote < s->timer_coyote);
+  PROF_END();
 }
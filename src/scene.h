@@ -1,19 +1,54 @@
 #pragma once
 
+#include "broad.h"
+#include "camera.h"
 #include "ecs.h"
+#include "game.h"
+#include "level.h"
+#include "sched.h"
+#include "snapshot.h"
+#include "spatial.h"
+#include "tilemap.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
   int left, right, up, down;
 }
 Input;
 
+// Input packed into one byte, for recording and replaying it tick by tick
+#define SCENE_INPUT_LEFT  1
+#define SCENE_INPUT_RIGHT 2
+#define SCENE_INPUT_UP    4
+#define SCENE_INPUT_DOWN  8
+
 typedef struct {
+  // Memory that lives exactly as long as the scene, the scene itself included,
+  // released at once by scene_free
+  Arena arena;
+
   size_t w, h;
   Input in;
   ECS *ecs;
-  int *brick_ids;
+  ECSCommandBuffer *cmd;
+  Scheduler *sched;
+  Tilemap *tilemap;
+  Camera camera;
+  SpatialHash *cull;
+  FontId font;
+
+  // Entity overlaps, rebuilt every tick from Pos and Size. Overlapping pairs
+  // of the last tick are handed to the game as trigger events.
+  Broadphase *broad;
+  size_t    num_triggers;
+  BroadPair *triggers;
+  int coins;
+
+  // Headless runs set this so every tick waits for the chunks around the view,
+  // which makes results independent of the loader thread's timing
+  int stream_wait;
 
   float plat_speed, plat_accel, plat_fric;
   float grav_jump, grav_fall, jump_bottom, jump_top;
@@ -21,16 +56,40 @@ typedef struct {
 }
 Scene;
 
-typedef enum {
-  LevelElement_Brick = 1 >> 0,
+// Simulation state that isn't rebuilt every tick. The cull and trigger
+// indices are derived from the ECS and rebuilt on load.
+typedef struct {
+  ECSSnapshot ecs;
+  Camera camera;
+  int coins;
 }
-LevelElement;
-
-uint8_t *level_load(const char *file, size_t *w, size_t *h);
-void    level_write(const char *file, size_t w, size_t h, uint8_t *data);
+SceneSave;
 
-Scene *scene_init(uint8_t *bricks, size_t w, size_t h);
+// The level is referenced, not copied, and has to outlive the scene
+Scene *scene_init(const Level *level);
 void scene_free(Scene *s);
-void scene_update(Scene *s, float dt, float ct);
-void scene_render(Scene *s, float dt, float ct);
+// Simulation thread. Steps the simulation by dt, tick counts updates since
+// the start.
+void scene_update(Scene *s, float dt, uint64_t tick);
 void scene_input_key(Scene *s, int key, int pressed);
+uint8_t scene_get_input(const Scene *s);
+void    scene_set_input(Scene *s, uint8_t input);
+// Simulation thread. Hash of the simulation state, the ECS, the camera and
+// the coin count. Two runs with equal hashes at a tick are in the same state.
+uint64_t scene_hash(Scene *s);
+// Simulation thread. Saves reuse the buffers of the previous save into out,
+// loads return -1 for a save of another scene layout.
+void scene_save(Scene *s, SceneSave *out);
+int  scene_load(Scene *s, const SceneSave *save);
+void scene_save_free(SceneSave *save);
+// Simulation thread. Records what the renderer needs from the current tick.
+void scene_snapshot(Scene *s, RenderSnapshot *out);
+
+// Render thread. Draws a snapshot, alpha in [0, 1] is the time since its tick
+// as a fraction of a tick. Only the tilemap is shared with the simulation.
+void scene_render(Scene *s, const RenderSnapshot *snap, float alpha);
+
+// Entities whose collision box overlaps the region or holds the point as of the
+// last tick, the array is valid until the next query
+size_t scene_query_region(Scene *s, float x0, float y0, float x1, float y1, EntityId **out);
+size_t scene_query_point(Scene *s, float x, float y, EntityId **out);
@@ -0,0 +1,391 @@
+#include "sched.h"
+#include "prof.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  Scheduler *sched;
+  int index;
+}
+WorkerArgs;
+
+// WorkerArgs of the current thread, unset (NULL) on threads that aren't
+// workers. Holding the scheduler too keeps a worker of one scheduler from
+// using its index in another.
+static SDL_TLSID worker_tls;
+
+static int  sched_worker(void *data);
+static int  sched_worker_index(Scheduler *s);
+static void sched_push(Scheduler *s, int w, Task *t);
+static int  sched_pop(Scheduler *s, int w, Task *t);
+static int  sched_steal(Scheduler *s, int w, Task *t);
+static int  sched_execute_one(Scheduler *s, int w);
+static void sched_run_system(void *data, size_t begin, size_t end);
+static void sched_build_graph(Scheduler *s);
+
+Scheduler *
+sched_init(int num_threads)
+{
+  DEBUG_TRACE("Scheduler init begin");
+
+  Scheduler *s = calloc(1, sizeof(Scheduler));
+  DEBUG_ASSERT(s, "Can't allocate space for scheduler");
+
+  if (num_threads <= 0)
+  {
+    num_threads = SDL_GetCPUCount();
+  }
+  if (num_threads > SCHED_MAX_THREADS)
+  {
+    num_threads = SCHED_MAX_THREADS;
+  }
+  s->num_threads = num_threads;
+
+  s->queues = calloc(num_threads, sizeof(TaskQueue));
+  DEBUG_ASSERT(s->queues, "Can't allocate space for task queues");
+
+  s->wake_lock = SDL_CreateMutex();
+  s->wake_cond = SDL_CreateCond();
+
+  if (worker_tls == 0)
+  {
+    worker_tls = SDL_TLSCreate();
+  }
+
+  // The calling thread is worker 0
+  for (int i = 1; i < num_threads; i++)
+  {
+    WorkerArgs *args = malloc(sizeof(WorkerArgs));
+    args->sched = s;
+    args->index = i;
+
+    s->threads[i] = SDL_CreateThread(sched_worker, "sched_worker", args);
+    if (s->threads[i] == NULL)
+    {
+      DEBUG_ERROR("Can't create worker thread! SDL_Error:\n%s", SDL_GetError());
+      free(args);
+    }
+  }
+
+  DEBUG_TRACE("Scheduler init end, %d threads", num_threads);
+
+  return s;
+}
+
+void
+sched_free(Scheduler *s)
+{
+  DEBUG_TRACE("Scheduler free");
+
+  SDL_AtomicSet(&s->quit, 1);
+  SDL_LockMutex(s->wake_lock);
+  SDL_CondBroadcast(s->wake_cond);
+  SDL_UnlockMutex(s->wake_lock);
+
+  for (int i = 1; i < s->num_threads; i++)
+  {
+    if (s->threads[i] != NULL)
+    {
+      SDL_WaitThread(s->threads[i], NULL);
+    }
+  }
+
+  SDL_DestroyCond(s->wake_cond);
+  SDL_DestroyMutex(s->wake_lock);
+  free(s->queues);
+  free(s);
+}
+
+void
+sched_add_system(Scheduler *s, const char *name, SystemFunc fn, void *data,
+                 const Signature *reads, const Signature *writes)
+{
+  if (s->num_systems >= SCHED_MAX_SYSTEMS)
+  {
+    ERROR_RETURN(, "Too many systems, can't add %s", name);
+  }
+
+  System *sys = &s->systems[s->num_systems++];
+  memset(sys, 0, sizeof(System));
+  sys->name = name;
+  sys->fn = fn;
+  sys->data = data;
+  if (reads != NULL)
+  {
+    sys->reads = *reads;
+  }
+  if (writes != NULL)
+  {
+    sys->writes = *writes;
+  }
+
+  sched_build_graph(s);
+}
+
+void
+sched_run(Scheduler *s, float dt)
+{
+  if (s->num_systems == 0)
+  {
+    return;
+  }
+
+  s->dt = dt;
+  SDL_AtomicSet(&s->systems_left, (int)s->num_systems);
+  for (size_t i = 0; i < s->num_systems; i++)
+  {
+    SDL_AtomicSet(&s->systems[i].remaining, s->systems[i].num_dependencies);
+  }
+
+  int w = sched_worker_index(s);
+  for (size_t i = 0; i < s->num_systems; i++)
+  {
+    if (s->systems[i].num_dependencies == 0)
+    {
+      Task t = {sched_run_system, s, i, i + 1, NULL};
+      sched_push(s, w, &t);
+    }
+  }
+
+  while (SDL_AtomicGet(&s->systems_left) > 0)
+  {
+    if (sched_execute_one(s, w))
+    {
+      continue;
+    }
+
+    // Systems still running elsewhere, sleep like a worker until they push
+    // more or the last one finishes
+    SDL_LockMutex(s->wake_lock);
+    SDL_AtomicAdd(&s->sleeping, 1);
+    while (SDL_AtomicGet(&s->queued) == 0 && SDL_AtomicGet(&s->systems_left) > 0)
+    {
+      SDL_CondWait(s->wake_cond, s->wake_lock);
+    }
+    SDL_AtomicAdd(&s->sleeping, -1);
+    SDL_UnlockMutex(s->wake_lock);
+  }
+}
+
+void
+sched_parallel_for(Scheduler *s, size_t count, size_t grain, RangeFunc fn, void *data)
+{
+  if (grain == 0)
+  {
+    grain = 1;
+  }
+  if (count <= grain || s->num_threads == 1)
+  {
+    fn(data, 0, count);
+    return;
+  }
+
+  int w = sched_worker_index(s);
+  SDL_atomic_t pending;
+  SDL_AtomicSet(&pending, (int)((count + grain - 1) / grain));
+
+  for (size_t begin = 0; begin < count; begin += grain)
+  {
+    Task t = {fn, data, begin, begin + grain < count ? begin + grain : count, &pending};
+    sched_push(s, w, &t);
+  }
+
+  // Help out instead of blocking, this also runs nested and unrelated tasks
+  while (SDL_AtomicGet(&pending) > 0)
+  {
+    sched_execute_one(s, w);
+  }
+}
+
+static int
+sched_worker(void *data)
+{
+  WorkerArgs args = *(WorkerArgs *)data;
+  free(data);
+
+  Scheduler *s = args.sched;
+  SDL_TLSSet(worker_tls, &args, NULL);
+  PROF_THREAD("sched_worker");
+
+  while (SDL_AtomicGet(&s->quit) == 0)
+  {
+    if (sched_execute_one(s, args.index))
+    {
+      continue;
+    }
+
+    // Nothing to run or steal, sleep until a push wakes us. queued is checked
+    // under the lock so a push between the check and the wait isn't lost.
+    SDL_LockMutex(s->wake_lock);
+    SDL_AtomicAdd(&s->sleeping, 1);
+    while (SDL_AtomicGet(&s->queued) == 0 && SDL_AtomicGet(&s->quit) == 0)
+    {
+      SDL_CondWait(s->wake_cond, s->wake_lock);
+    }
+    SDL_AtomicAdd(&s->sleeping, -1);
+    SDL_UnlockMutex(s->wake_lock);
+  }
+  return 0;
+}
+
+static int
+sched_worker_index(Scheduler *s)
+{
+  // Threads that aren't ours share the main thread's queue, pushes are locked
+  WorkerArgs *args = SDL_TLSGet(worker_tls);
+  return args != NULL && args->sched == s ? args->index : 0;
+}
+
+static void
+sched_push(Scheduler *s, int w, Task *t)
+{
+  TaskQueue *q = &s->queues[w];
+
+  SDL_AtomicLock(&q->lock);
+  if (q->tail - q->head >= SCHED_MAX_TASKS)
+  {
+    // Queue is full, run it right here rather than dropping it
+    SDL_AtomicUnlock(&q->lock);
+    t->fn(t->data, t->begin, t->end);
+    if (t->pending != NULL)
+    {
+      SDL_AtomicAdd(t->pending, -1);
+    }
+    return;
+  }
+  q->tasks[q->tail % SCHED_MAX_TASKS] = *t;
+  q->tail++;
+  SDL_AtomicUnlock(&q->lock);
+
+  SDL_AtomicAdd(&s->queued, 1);
+  if (SDL_AtomicGet(&s->sleeping) > 0)
+  {
+    SDL_LockMutex(s->wake_lock);
+    SDL_CondBroadcast(s->wake_cond);
+    SDL_UnlockMutex(s->wake_lock);
+  }
+}
+
+static int
+sched_pop(Scheduler *s, int w, Task *t)
+{
+  TaskQueue *q = &s->queues[w];
+  int found = 0;
+
+  SDL_AtomicLock(&q->lock);
+  if (q->tail > q->head)
+  {
+    q->tail--;
+    *t = q->tasks[q->tail % SCHED_MAX_TASKS];
+    found = 1;
+  }
+  SDL_AtomicUnlock(&q->lock);
+
+  return found;
+}
+
+static int
+sched_steal(Scheduler *s, int w, Task *t)
+{
+  for (int i = 1; i < s->num_threads; i++)
+  {
+    TaskQueue *q = &s->queues[(w + i) % s->num_threads];
+    int found = 0;
+
+    SDL_AtomicLock(&q->lock);
+    if (q->tail > q->head)
+    {
+      *t = q->tasks[q->head % SCHED_MAX_TASKS];
+      q->head++;
+      found = 1;
+    }
+    SDL_AtomicUnlock(&q->lock);
+
+    if (found)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+sched_execute_one(Scheduler *s, int w)
+{
+  Task t;
+  if (sched_pop(s, w, &t) == 0 && sched_steal(s, w, &t) == 0)
+  {
+    return 0;
+  }
+  SDL_AtomicAdd(&s->queued, -1);
+
+  t.fn(t.data, t.begin, t.end);
+  if (t.pending != NULL)
+  {
+    SDL_AtomicAdd(t.pending, -1);
+  }
+  return 1;
+}
+
+static void
+sched_run_system(void *data, size_t begin, size_t end)
+{
+  Scheduler *s = data;
+  System *sys = &s->systems[begin];
+
+  PROF_BEGIN(sys->name);
+  sys->fn(sys->data, s->dt);
+  PROF_END();
+
+  // Release systems waiting on this one
+  int w = sched_worker_index(s);
+  for (size_t i = 0; i < s->num_systems; i++)
+  {
+    if ((sys->dependents >> i) & 1)
+    {
+      if (SDL_AtomicAdd(&s->systems[i].remaining, -1) == 1)
+      {
+        Task t = {sched_run_system, s, i, i + 1, NULL};
+        sched_push(s, w, &t);
+      }
+    }
+  }
+
+  // sched_run may be asleep waiting for the last one
+  if (SDL_AtomicAdd(&s->systems_left, -1) == 1)
+  {
+    SDL_LockMutex(s->wake_lock);
+    SDL_CondBroadcast(s->wake_cond);
+    SDL_UnlockMutex(s->wake_lock);
+  }
+}
+
+static void
+sched_build_graph(Scheduler *s)
+{
+  for (size_t j = 0; j < s->num_systems; j++)
+  {
+    System *b = &s->systems[j];
+    b->num_dependencies = 0;
+    b->dependents = 0;
+  }
+
+  // A later system waits on every earlier one it conflicts with
+  for (size_t j = 0; j < s->num_systems; j++)
+  {
+    System *b = &s->systems[j];
+    for (size_t i = 0; i < j; i++)
+    {
+      System *a = &s->systems[i];
+      if (signature_intersects(&a->writes, &b->reads) ||
+          signature_intersects(&a->writes, &b->writes) ||
+          signature_intersects(&a->reads, &b->writes))
+      {
+        a->dependents |= (uint64_t)1 << j;
+        b->num_dependencies++;
+      }
+    }
+  }
+}
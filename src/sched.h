@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ecs.h"
+
+#include <SDL2/SDL.h>
+
+#include <stddef.h>
+
+#define SCHED_MAX_SYSTEMS 64
+#define SCHED_MAX_TASKS   4096
+#define SCHED_MAX_THREADS 32
+
+typedef void (*SystemFunc)(void *data, float dt);
+typedef void (*RangeFunc)(void *data, size_t begin, size_t end);
+
+// Systems declare which components they read and write. Two systems conflict
+// when one writes something the other touches, conflicting systems run in
+// registration order and everything else may run in parallel. Systems that
+// run in parallel must not record into the same ECSCommandBuffer.
+typedef struct {
+  const char *name;
+  SystemFunc fn;
+  void *data;
+  Signature reads, writes;
+
+  uint64_t     dependents;
+  int          num_dependencies;
+  SDL_atomic_t remaining;
+}
+System;
+
+typedef struct {
+  RangeFunc fn;
+  void *data;
+  size_t begin, end;
+  SDL_atomic_t *pending;
+}
+Task;
+
+// Owner pushes and pops at the tail, idle workers steal from the head
+typedef struct {
+  SDL_SpinLock lock;
+  size_t head, tail;
+  Task   tasks[SCHED_MAX_TASKS];
+}
+TaskQueue;
+
+typedef struct {
+  int num_threads;
+  SDL_Thread *threads[SCHED_MAX_THREADS];
+  TaskQueue  *queues;
+
+  SDL_mutex    *wake_lock;
+  SDL_cond     *wake_cond;
+  SDL_atomic_t queued, sleeping, quit;
+
+  size_t       num_systems;
+  System       systems[SCHED_MAX_SYSTEMS];
+  SDL_atomic_t systems_left;
+  float        dt;
+}
+Scheduler;
+
+// num_threads counts the calling thread, 0 picks one per CPU
+Scheduler *sched_init(int num_threads);
+void sched_free(Scheduler *s);
+
+void sched_add_system(Scheduler *s, const char *name, SystemFunc fn, void *data,
+                      const Signature *reads, const Signature *writes);
+void sched_run(Scheduler *s, float dt);
+
+// Splits [0, count) into chunks of grain items, chunk bounds only depend on
+// count and grain so results don't change with the number of threads
+void sched_parallel_for(Scheduler *s, size_t count, size_t grain, RangeFunc fn, void *data);
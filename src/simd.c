@@ -0,0 +1,164 @@
+#include "simd.h"
+#include "util.h"
+
+#include <SDL2/SDL.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define SIMD_X86
+  #include <immintrin.h>
+#endif
+
+// Wider paths are compiled for their instruction set function by function, so
+// the rest of the build keeps running on any x86 CPU
+#if defined(__GNUC__)
+  #define SIMD_TARGET(t) __attribute__((target(t)))
+#else
+  #define SIMD_TARGET(t)
+#endif
+
+typedef void (*MaddFunc)(float *dst, const float *src, size_t n, float k);
+
+static void simd_madd_scalar(float *dst, const float *src, size_t n, float k);
+#ifdef SIMD_X86
+static void simd_madd_sse(float *dst, const float *src, size_t n, float k);
+static void simd_madd_avx2(float *dst, const float *src, size_t n, float k);
+#endif
+
+static SimdPath path = SimdPath_Scalar;
+static MaddFunc madd = simd_madd_scalar;
+
+void
+simd_init(void)
+{
+  SimdPath best = SimdPath_Scalar;
+  for (int p = SimdPath_Scalar; p < SimdPath_Count; p++)
+  {
+    if (simd_supported(p))
+    {
+      best = p;
+    }
+  }
+  simd_set_path(best);
+  DEBUG_TRACE("SIMD path: %s", simd_path_name(best));
+}
+
+int
+simd_supported(SimdPath p)
+{
+  switch (p)
+  {
+  case SimdPath_Scalar:
+    return 1;
+#ifdef SIMD_X86
+  case SimdPath_Sse:
+    return SDL_HasSSE2() == SDL_TRUE;
+  case SimdPath_Avx2:
+    return SDL_HasAVX2() == SDL_TRUE;
+#endif
+  default:
+    return 0;
+  }
+}
+
+int
+simd_set_path(SimdPath p)
+{
+  if (simd_supported(p) == 0)
+  {
+    ERROR_RETURN(0, "SIMD path %s isn't supported", simd_path_name(p));
+  }
+
+  switch (p)
+  {
+#ifdef SIMD_X86
+  case SimdPath_Sse:
+    madd = simd_madd_sse;
+    break;
+  case SimdPath_Avx2:
+    madd = simd_madd_avx2;
+    break;
+#endif
+  default:
+    madd = simd_madd_scalar;
+    break;
+  }
+  path = p;
+  return 1;
+}
+
+SimdPath
+simd_get_path(void)
+{
+  return path;
+}
+
+const char *
+simd_path_name(SimdPath p)
+{
+  switch (p)
+  {
+  case SimdPath_Scalar:
+    return "scalar";
+  case SimdPath_Sse:
+    return "sse";
+  case SimdPath_Avx2:
+    return "avx2";
+  default:
+    return "unknown";
+  }
+}
+
+void
+simd_madd(float *dst, const float *src, size_t n, float k)
+{
+  madd(dst, src, n, k);
+}
+
+static void
+simd_madd_scalar(float *dst, const float *src, size_t n, float k)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    dst[i] += src[i] * k;
+  }
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2") static void
+simd_madd_sse(float *dst, const float *src, size_t n, float k)
+{
+  __m128 vk = _mm_set1_ps(k);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128 d0 = _mm_loadu_ps(dst + i), d1 = _mm_loadu_ps(dst + i + 4);
+    __m128 s0 = _mm_loadu_ps(src + i), s1 = _mm_loadu_ps(src + i + 4);
+    _mm_storeu_ps(dst + i,     _mm_add_ps(d0, _mm_mul_ps(s0, vk)));
+    _mm_storeu_ps(dst + i + 4, _mm_add_ps(d1, _mm_mul_ps(s1, vk)));
+  }
+  for (; i < n; i++)
+  {
+    dst[i] += src[i] * k;
+  }
+}
+
+SIMD_TARGET("avx2") static void
+simd_madd_avx2(float *dst, const float *src, size_t n, float k)
+{
+  __m256 vk = _mm256_set1_ps(k);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m256 d0 = _mm256_loadu_ps(dst + i), d1 = _mm256_loadu_ps(dst + i + 8);
+    __m256 s0 = _mm256_loadu_ps(src + i), s1 = _mm256_loadu_ps(src + i + 8);
+    _mm256_storeu_ps(dst + i,     _mm256_add_ps(d0, _mm256_mul_ps(s0, vk)));
+    _mm256_storeu_ps(dst + i + 8, _mm256_add_ps(d1, _mm256_mul_ps(s1, vk)));
+  }
+  for (; i < n; i++)
+  {
+    dst[i] += src[i] * k;
+  }
+}
+
+#endif
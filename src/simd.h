@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+// Vector kernels over packed float columns. Components made only of floats,
+// like C_Pos and C_Vel, are one flat float array per archetype, so x and y
+// are processed together without splitting them into separate columns.
+// Every path gives bit identical results, there's no fused multiply-add.
+typedef enum {
+  SimdPath_Scalar,
+  SimdPath_Sse,
+  SimdPath_Avx2,
+  SimdPath_Count
+}
+SimdPath;
+
+// Picks the widest path the CPU supports, until then everything runs scalar
+void simd_init(void);
+
+int        simd_supported(SimdPath p);
+// Returns 0 and keeps the current path if p isn't supported
+int        simd_set_path(SimdPath p);
+SimdPath   simd_get_path(void);
+const char *simd_path_name(SimdPath p);
+
+// dst[i] += src[i] * k for n floats, dst and src must not overlap
+void simd_madd(float *dst, const float *src, size_t n, float k);
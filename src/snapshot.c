@@ -0,0 +1,108 @@
+#include "snapshot.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void *snapshot_grow(void *ptr, size_t *max, size_t need, size_t size);
+
+void
+snapshot_clear(RenderSnapshot *s)
+{
+  s->num_sprites = 0;
+  s->num_texts = 0;
+  s->num_chars = 0;
+}
+
+void
+snapshot_sprite(RenderSnapshot *s, SpriteId spr, float prev_x, float prev_y, float x, float y,
+                float sx, float sy, float rot)
+{
+  if (s->num_sprites >= s->max_sprites)
+  {
+    s->sprites = snapshot_grow(s->sprites, &s->max_sprites, s->num_sprites + 1, sizeof(RenderSprite));
+  }
+  s->sprites[s->num_sprites++] = (RenderSprite){spr, prev_x, prev_y, x, y, sx, sy, rot};
+}
+
+void
+snapshot_text(RenderSnapshot *s, FontId font, const char *text, float x, float y,
+              float sx, float sy, float ox, float oy)
+{
+  size_t len = strlen(text) + 1;
+  if (s->num_chars + len > s->max_chars)
+  {
+    s->chars = snapshot_grow(s->chars, &s->max_chars, s->num_chars + len, sizeof(char));
+  }
+  if (s->num_texts >= s->max_texts)
+  {
+    s->texts = snapshot_grow(s->texts, &s->max_texts, s->num_texts + 1, sizeof(RenderText));
+  }
+
+  memcpy(s->chars + s->num_chars, text, len);
+  s->texts[s->num_texts++] = (RenderText){font, s->num_chars, x, y, sx, sy, ox, oy};
+  s->num_chars += len;
+}
+
+void
+snapshot_buffer_init(SnapshotBuffer *b)
+{
+  memset(b, 0, sizeof(SnapshotBuffer));
+  b->write = 0;
+  b->read = 1;
+  SDL_AtomicSet(&b->latest, 2);
+}
+
+void
+snapshot_buffer_free(SnapshotBuffer *b)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    free(b->snapshots[i].sprites);
+    free(b->snapshots[i].texts);
+    free(b->snapshots[i].chars);
+  }
+}
+
+RenderSnapshot *
+snapshot_begin_write(SnapshotBuffer *b)
+{
+  RenderSnapshot *s = &b->snapshots[b->write];
+  snapshot_clear(s);
+  return s;
+}
+
+void
+snapshot_publish(SnapshotBuffer *b)
+{
+  // The written snapshot becomes the latest, the old latest is written next.
+  // SDL_AtomicSet is a full barrier, the snapshot contents are visible first.
+  b->write = SDL_AtomicSet(&b->latest, b->write | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+const RenderSnapshot *
+snapshot_read(SnapshotBuffer *b)
+{
+  if (SDL_AtomicGet(&b->latest) & SNAPSHOT_FRESH)
+  {
+    // Only this side clears the flag, so the swap always takes a fresh one
+    b->read = SDL_AtomicSet(&b->latest, b->read) & ~SNAPSHOT_FRESH;
+    b->has_read = 1;
+  }
+  return b->has_read ? &b->snapshots[b->read] : NULL;
+}
+
+static void *
+snapshot_grow(void *ptr, size_t *max, size_t need, size_t size)
+{
+  size_t capacity = *max ? *max : 64;
+  while (capacity < need)
+  {
+    capacity *= 2;
+  }
+
+  void *new_ptr = realloc(ptr, capacity * size);
+  DEBUG_ASSERT(new_ptr, "Can't reallocate space for render snapshot");
+  *max = capacity;
+  return new_ptr;
+}
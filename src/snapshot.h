@@ -0,0 +1,79 @@
+#pragma once
+
+#include "camera.h"
+#include "game.h"
+
+#include <SDL2/SDL.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sprites keep the position before and after the last tick, the renderer
+// blends between the two
+typedef struct {
+  SpriteId spr;
+  float prev_x, prev_y, x, y;
+  float sx, sy, rot;
+}
+RenderSprite;
+
+// Overlay text in view coordinates, text is an offset into the snapshot chars
+typedef struct {
+  FontId font;
+  size_t text;
+  float x, y, sx, sy, ox, oy;
+}
+RenderText;
+
+// Everything the renderer needs from one simulation tick. The simulation
+// fills a snapshot and publishes it, after that it's read only until the
+// renderer is done with it. Arrays keep their capacity between uses.
+typedef struct {
+  uint64_t tick;
+  // Performance counter value the tick is due at, alpha is measured from it
+  uint64_t stamp;
+  Camera   camera;
+
+  // Stats for the performance overlay: ticks run since the previous snapshot,
+  // performance counter time they spent in scene_update, and live entities
+  uint32_t ticks;
+  uint64_t update_time;
+  size_t   entities;
+
+  size_t       num_sprites, max_sprites;
+  RenderSprite *sprites;
+  size_t       num_texts, max_texts;
+  RenderText   *texts;
+  size_t       num_chars, max_chars;
+  char         *chars;
+}
+RenderSnapshot;
+
+// Three snapshots: the one being written, the newest published one and the one
+// being drawn. Writer and reader never wait for each other, the reader always
+// gets the newest finished snapshot and the writer never touches it.
+typedef struct {
+  RenderSnapshot snapshots[3];
+  int write, read, has_read;
+  // Index of the newest published snapshot, SNAPSHOT_FRESH is set until read
+  SDL_atomic_t latest;
+}
+SnapshotBuffer;
+
+#define SNAPSHOT_FRESH 4
+
+void snapshot_clear(RenderSnapshot *s);
+void snapshot_sprite(RenderSnapshot *s, SpriteId spr, float prev_x, float prev_y, float x, float y,
+                     float sx, float sy, float rot);
+void snapshot_text(RenderSnapshot *s, FontId font, const char *text, float x, float y,
+                   float sx, float sy, float ox, float oy);
+
+void snapshot_buffer_init(SnapshotBuffer *b);
+void snapshot_buffer_free(SnapshotBuffer *b);
+
+// Writer side, the returned snapshot is cleared and stays the writer's until published
+RenderSnapshot *snapshot_begin_write(SnapshotBuffer *b);
+void           snapshot_publish(SnapshotBuffer *b);
+// Reader side, the newest published snapshot, or the last one read when
+// nothing new was published. NULL before the first publish.
+const RenderSnapshot *snapshot_read(SnapshotBuffer *b);
@@ -0,0 +1,249 @@
+#include "spatial.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t init_cells   = 64;
+static const size_t init_items   = 8;
+static const size_t init_results = 256;
+
+static uint64_t    spatial_key(int cx, int cy);
+static SpatialCell *spatial_find(SpatialHash *sh, uint64_t key, int create);
+static void        spatial_grow_cells(SpatialHash *sh);
+static void        spatial_grow_index(SpatialHash *sh, size_t index);
+static void        spatial_cell_remove(SpatialHash *sh, SpatialCell *c, uint32_t slot);
+
+SpatialHash *
+spatial_init(float cell_size)
+{
+  SpatialHash *sh = calloc(1, sizeof(SpatialHash));
+  DEBUG_ASSERT(sh, "Can't allocate space for spatial hash");
+
+  sh->cell_size = cell_size;
+  sh->max_cells = init_cells;
+  sh->cells = calloc(sh->max_cells, sizeof(SpatialCell));
+  sh->max_results = init_results;
+  sh->results = malloc(sh->max_results * sizeof(EntityId));
+  DEBUG_ASSERT(sh->cells && sh->results, "Can't allocate space for spatial cells");
+
+  return sh;
+}
+
+void
+spatial_free(SpatialHash *sh)
+{
+  for (size_t i = 0; i < sh->max_cells; i++)
+  {
+    free(sh->cells[i].items);
+  }
+  free(sh->cells);
+  free(sh->present);
+  free(sh->cell_of);
+  free(sh->slot_of);
+  free(sh->results);
+  free(sh);
+}
+
+void
+spatial_update(SpatialHash *sh, EntityId e, float x, float y)
+{
+  uint32_t i = ECS_INDEX(e);
+  uint64_t key = spatial_key((int)floorf(x / sh->cell_size), (int)floorf(y / sh->cell_size));
+
+  if (i >= sh->max_index)
+  {
+    spatial_grow_index(sh, i);
+  }
+
+  if (sh->present[i])
+  {
+    SpatialCell *old = spatial_find(sh, sh->cell_of[i], 0);
+    if (sh->cell_of[i] == key && old->items[sh->slot_of[i]] == e)
+    {
+      return;
+    }
+    spatial_cell_remove(sh, old, sh->slot_of[i]);
+  }
+
+  SpatialCell *c = spatial_find(sh, key, 1);
+  if (c->count >= c->capacity)
+  {
+    size_t capacity = c->capacity ? c->capacity * 2 : init_items;
+    EntityId *new_items = realloc(c->items, capacity * sizeof(EntityId));
+    DEBUG_ASSERT(new_items, "Can't reallocate space for spatial cell");
+    c->items = new_items;
+    c->capacity = capacity;
+  }
+
+  sh->present[i] = 1;
+  sh->cell_of[i] = key;
+  sh->slot_of[i] = (uint32_t)c->count;
+  c->items[c->count++] = e;
+}
+
+void
+spatial_remove(SpatialHash *sh, EntityId e)
+{
+  uint32_t i = ECS_INDEX(e);
+  if (i >= sh->max_index || sh->present[i] == 0)
+  {
+    return;
+  }
+
+  spatial_cell_remove(sh, spatial_find(sh, sh->cell_of[i], 0), sh->slot_of[i]);
+  sh->present[i] = 0;
+}
+
+size_t
+spatial_query(SpatialHash *sh, float x0, float y0, float x1, float y1, EntityId **out)
+{
+  int cx0 = (int)floorf(x0 / sh->cell_size), cy0 = (int)floorf(y0 / sh->cell_size);
+  int cx1 = (int)floorf(x1 / sh->cell_size), cy1 = (int)floorf(y1 / sh->cell_size);
+
+  sh->num_results = 0;
+  for (int cy = cy0; cy <= cy1; cy++)
+  {
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+      SpatialCell *c = spatial_find(sh, spatial_key(cx, cy), 0);
+      if (c == NULL || c->count == 0)
+      {
+        continue;
+      }
+
+      if (sh->num_results + c->count > sh->max_results)
+      {
+        size_t capacity = sh->max_results * 2;
+        while (sh->num_results + c->count > capacity)
+        {
+          capacity *= 2;
+        }
+        EntityId *new_results = realloc(sh->results, capacity * sizeof(EntityId));
+        DEBUG_ASSERT(new_results, "Can't reallocate space for spatial results");
+        sh->results = new_results;
+        sh->max_results = capacity;
+      }
+      memcpy(sh->results + sh->num_results, c->items, c->count * sizeof(EntityId));
+      sh->num_results += c->count;
+    }
+  }
+
+  *out = sh->results;
+  return sh->num_results;
+}
+
+static uint64_t
+spatial_key(int cx, int cy)
+{
+  return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+}
+
+static SpatialCell *
+spatial_find(SpatialHash *sh, uint64_t key, int create)
+{
+  if (create && (sh->num_cells + 1) * 2 > sh->max_cells)
+  {
+    spatial_grow_cells(sh);
+  }
+
+  size_t mask = sh->max_cells - 1;
+  for (size_t i = (key * 0x9e3779b97f4a7c15ull) >> 32 & mask; ; i = (i + 1) & mask)
+  {
+    SpatialCell *c = &sh->cells[i];
+    if (c->used == 0)
+    {
+      if (create == 0)
+      {
+        return NULL;
+      }
+      c->used = 1;
+      c->key = key;
+      sh->num_cells++;
+      return c;
+    }
+    if (c->key == key)
+    {
+      return c;
+    }
+  }
+}
+
+static void
+spatial_grow_cells(SpatialHash *sh)
+{
+  SpatialCell *old = sh->cells;
+  size_t old_max = sh->max_cells;
+
+  // Cells left empty by bodies moving on are dropped here, emptying them can't
+  // without breaking probe chains. The table keeps its size only when empty
+  // cells are most of the used ones, so a quarter of it is free again and the
+  // next rebuild is that many new cells away.
+  size_t live = 0;
+  for (size_t j = 0; j < old_max; j++)
+  {
+    live += old[j].used && old[j].count > 0;
+  }
+  if ((live + 1) * 4 > sh->max_cells)
+  {
+    sh->max_cells *= 2;
+  }
+  sh->cells = calloc(sh->max_cells, sizeof(SpatialCell));
+  DEBUG_ASSERT(sh->cells, "Can't reallocate space for spatial cells");
+  sh->num_cells = live;
+
+  // Cells are moved as a whole, items keep their slots
+  size_t mask = sh->max_cells - 1;
+  for (size_t j = 0; j < old_max; j++)
+  {
+    if (old[j].used == 0)
+    {
+      continue;
+    }
+    if (old[j].count == 0)
+    {
+      free(old[j].items);
+      continue;
+    }
+    size_t i = (old[j].key * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+    while (sh->cells[i].used)
+    {
+      i = (i + 1) & mask;
+    }
+    sh->cells[i] = old[j];
+  }
+  free(old);
+}
+
+static void
+spatial_grow_index(SpatialHash *sh, size_t index)
+{
+  size_t max_index = sh->max_index ? sh->max_index : 64;
+  while (max_index <= index)
+  {
+    max_index *= 2;
+  }
+
+  uint8_t *new_present = realloc(sh->present, max_index * sizeof(uint8_t));
+  uint64_t *new_cell_of = realloc(sh->cell_of, max_index * sizeof(uint64_t));
+  uint32_t *new_slot_of = realloc(sh->slot_of, max_index * sizeof(uint32_t));
+  DEBUG_ASSERT(new_present && new_cell_of && new_slot_of, "Can't reallocate space for spatial index");
+
+  memset(new_present + sh->max_index, 0, max_index - sh->max_index);
+  sh->present = new_present;
+  sh->cell_of = new_cell_of;
+  sh->slot_of = new_slot_of;
+  sh->max_index = max_index;
+}
+
+static void
+spatial_cell_remove(SpatialHash *sh, SpatialCell *c, uint32_t slot)
+{
+  EntityId moved = c->items[--c->count];
+  if (slot != c->count)
+  {
+    c->items[slot] = moved;
+    sh->slot_of[ECS_INDEX(moved)] = slot;
+  }
+}
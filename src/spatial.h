@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ecs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Uniform grid over world positions, cells are created on first use in an
+// open addressing table and the ones left empty are dropped when it would
+// grow, so very wide levels cost nothing for empty space.
+// Entities are tracked by slot index, moving within a cell is free and moving
+// across cells is a swap-remove plus an append.
+typedef struct {
+  uint64_t key;
+  int      used;
+  size_t   count, capacity;
+  EntityId *items;
+}
+SpatialCell;
+
+typedef struct {
+  float cell_size;
+
+  size_t      num_cells, max_cells;
+  SpatialCell *cells;
+
+  // Per ECS slot index: the cell holding the entity and its position there
+  size_t   max_index;
+  uint8_t  *present;
+  uint64_t *cell_of;
+  uint32_t *slot_of;
+
+  size_t   num_results, max_results;
+  EntityId *results;
+}
+SpatialHash;
+
+SpatialHash *spatial_init(float cell_size);
+void spatial_free(SpatialHash *sh);
+
+void spatial_update(SpatialHash *sh, EntityId e, float x, float y);
+void spatial_remove(SpatialHash *sh, EntityId e);
+
+// Entities in cells overlapping the rectangle, the array is owned by the hash
+// and valid until the next query. Results can be stale handles or lie slightly
+// outside the rectangle, callers check what they need.
+size_t spatial_query(SpatialHash *sh, float x0, float y0, float x1, float y1, EntityId **out);
@@ -0,0 +1,132 @@
+#include "stream.h"
+#include "prof.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+static int stream_worker(void *data);
+
+LevelStream *
+stream_init(const Level *level)
+{
+  DEBUG_TRACE("Stream init");
+
+  LevelStream *s = calloc(1, sizeof(LevelStream));
+  DEBUG_ASSERT(s, "Can't allocate space for level stream");
+
+  s->level = level;
+  s->wake = SDL_CreateSemaphore(0);
+  s->done = SDL_CreateSemaphore(0);
+  s->thread = SDL_CreateThread(stream_worker, "stream_worker", s);
+  if (s->thread == NULL)
+  {
+    DEBUG_ERROR("Can't create stream thread! SDL_Error:\n%s", SDL_GetError());
+  }
+
+  return s;
+}
+
+void
+stream_free(LevelStream *s)
+{
+  DEBUG_TRACE("Stream free");
+
+  SDL_AtomicSet(&s->quit, 1);
+  SDL_SemPost(s->wake);
+  if (s->thread != NULL)
+  {
+    SDL_WaitThread(s->thread, NULL);
+  }
+
+  // Results nobody picked up still own their tiles
+  StreamResult r;
+  while (stream_poll(s, &r, 0))
+  {
+    free(r.tiles);
+  }
+
+  SDL_DestroySemaphore(s->wake);
+  SDL_DestroySemaphore(s->done);
+  free(s);
+}
+
+int
+stream_request(LevelStream *s, uint32_t chunk)
+{
+  // Results can never overflow either, there are as many slots as requests
+  if (s->in_flight >= STREAM_QUEUE_SIZE || s->thread == NULL)
+  {
+    return 0;
+  }
+
+  int tail = SDL_AtomicGet(&s->requests_ring.tail);
+  s->requests[tail & (STREAM_QUEUE_SIZE - 1)] = chunk;
+  SDL_AtomicSet(&s->requests_ring.tail, tail + 1);
+  s->in_flight++;
+
+  SDL_SemPost(s->wake);
+  return 1;
+}
+
+int
+stream_poll(LevelStream *s, StreamResult *r, int wait)
+{
+  int head = SDL_AtomicGet(&s->results_ring.head);
+  while (head == SDL_AtomicGet(&s->results_ring.tail))
+  {
+    if (wait == 0 || s->in_flight == 0)
+    {
+      return 0;
+    }
+    SDL_SemWait(s->done);
+  }
+
+  *r = s->results[head & (STREAM_QUEUE_SIZE - 1)];
+  SDL_AtomicSet(&s->results_ring.head, head + 1);
+  s->in_flight--;
+  return 1;
+}
+
+static int
+stream_worker(void *data)
+{
+  LevelStream *s = data;
+  const Level *l = s->level;
+  PROF_THREAD("stream_worker");
+
+  while (1)
+  {
+    SDL_SemWait(s->wake);
+    if (SDL_AtomicGet(&s->quit))
+    {
+      break;
+    }
+
+    int head = SDL_AtomicGet(&s->requests_ring.head);
+    if (head == SDL_AtomicGet(&s->requests_ring.tail))
+    {
+      continue;
+    }
+    uint32_t chunk = s->requests[head & (STREAM_QUEUE_SIZE - 1)];
+    SDL_AtomicSet(&s->requests_ring.head, head + 1);
+
+    // Page faults on the mapped file and decoding both happen here
+    PROF_BEGIN("level_read_chunk");
+    uint8_t *tiles = malloc(LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES);
+    if (tiles == NULL || level_read_chunk(l, chunk % l->chunks_w, chunk / l->chunks_w, tiles) != 0)
+    {
+      DEBUG_ERROR("Can't load chunk %u", chunk);
+      free(tiles);
+      tiles = calloc(1, LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES);
+    }
+    PROF_END();
+
+    int tail = SDL_AtomicGet(&s->results_ring.tail);
+    s->results[tail & (STREAM_QUEUE_SIZE - 1)].chunk = chunk;
+    s->results[tail & (STREAM_QUEUE_SIZE - 1)].tiles = tiles;
+    SDL_AtomicSet(&s->results_ring.tail, tail + 1);
+    SDL_SemPost(s->done);
+  }
+
+  return 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "level.h"
+
+#include <SDL2/SDL.h>
+
+#include <stdint.h>
+
+#define STREAM_QUEUE_SIZE 1024
+
+typedef struct {
+  uint32_t chunk;
+  uint8_t  *tiles;
+}
+StreamResult;
+
+// Single producer, single consumer ring, head and tail sit on their own cache
+// lines so the two threads don't fight over them
+typedef struct {
+  SDL_atomic_t head;
+  char         pad0[64 - sizeof(SDL_atomic_t)];
+  SDL_atomic_t tail;
+  char         pad1[64 - sizeof(SDL_atomic_t)];
+}
+StreamRing;
+
+// Loads level chunks on a worker thread. The main thread requests chunks by
+// index (cy * chunks_w + cx) and polls for results, each result owns a
+// malloc'd LEVEL_CHUNK_TILES^2 tile buffer. Chunks that fail to read come
+// back empty. The level has to outlive the stream.
+typedef struct {
+  const Level *level;
+  SDL_Thread  *thread;
+  SDL_sem     *wake, *done;
+  SDL_atomic_t quit;
+
+  StreamRing   requests_ring;
+  uint32_t     requests[STREAM_QUEUE_SIZE];
+  StreamRing   results_ring;
+  StreamResult results[STREAM_QUEUE_SIZE];
+
+  // Requested and not polled yet, main thread only
+  size_t in_flight;
+}
+LevelStream;
+
+LevelStream *stream_init(const Level *level);
+void stream_free(LevelStream *s);
+
+// Returns 0 when too many requests are in flight, try again next frame
+int stream_request(LevelStream *s, uint32_t chunk);
+// Returns 1 and fills r when a chunk is ready, wait blocks until one is
+int stream_poll(LevelStream *s, StreamResult *r, int wait);
@@ -0,0 +1,400 @@
+#include "tilemap.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void   tilemap_mark_dirty(Tilemap *t, int x, int y);
+static void   tilemap_chunk_rect(Tilemap *t, float vx, float vy, float vw, float vh, int margin,
+                                 int *cx0, int *cy0, int *cx1, int *cy1);
+static size_t tilemap_request(Tilemap *t, int cx0, int cy0, int cx1, int cy1);
+static void   tilemap_install(Tilemap *t, uint32_t c, uint8_t *tiles);
+static void   tilemap_evict(Tilemap *t, int cx0, int cy0, int cx1, int cy1);
+static void   tilemap_bake(Tilemap *t, size_t cx, size_t cy);
+
+Tilemap *
+tilemap_init(const Level *level, Arena *arena)
+{
+  DEBUG_TRACE("Tilemap init begin");
+
+  Tilemap *t = arena_calloc(arena, 1, sizeof(Tilemap));
+  DEBUG_ASSERT(t, "Can't allocate space for tilemap");
+
+  t->w = level->w;
+  t->h = level->h;
+  t->level = level;
+
+  // Per chunk bookkeeping only, tiles arrive through the stream
+  t->chunks_w = level->chunks_w;
+  t->chunks_h = level->chunks_h;
+  size_t n = t->chunks_w * t->chunks_h;
+  t->tiles       = arena_calloc(arena, n, sizeof(uint8_t *));
+  t->state       = arena_calloc(arena, n, sizeof(uint8_t));
+  t->chunks      = arena_calloc(arena, n, sizeof(SDL_Texture *));
+  t->chunk_dirty = arena_calloc(arena, n, sizeof(uint8_t));
+  t->chunk_tiles = arena_calloc(arena, n, sizeof(uint16_t));
+  t->chunk_known = arena_calloc(arena, n, sizeof(uint8_t));
+  t->released    = arena_calloc(arena, n, sizeof(uint32_t));
+  t->chunk_released = arena_calloc(arena, n, sizeof(uint8_t));
+  DEBUG_ASSERT(t->tiles && t->state && t->chunks && t->chunk_dirty && t->chunk_tiles && t->chunk_known &&
+               t->released && t->chunk_released, "Can't allocate space for tilemap chunks");
+
+  t->lock = SDL_CreateMutex();
+  DEBUG_ASSERT(t->lock, "Can't create tilemap lock! SDL_Error:\n%s", SDL_GetError());
+
+  t->solid = solid_init(t->w, t->h, TILE_SIZE);
+
+  t->stream = stream_init(level);
+
+  t->brick_c = game_sprite_id("brick_c");
+  t->brick_l = game_sprite_id("brick_l");
+  t->brick_r = game_sprite_id("brick_r");
+
+  DEBUG_TRACE("Tilemap init end");
+
+  return t;
+}
+
+void
+tilemap_free(Tilemap *t)
+{
+  DEBUG_TRACE("Tilemap free");
+
+  stream_free(t->stream);
+
+  for (size_t i = 0; i < t->chunks_w * t->chunks_h; i++)
+  {
+    if (t->chunks[i] != NULL)
+    {
+      SDL_DestroyTexture(t->chunks[i]);
+    }
+    free(t->tiles[i]);
+  }
+  SDL_DestroyMutex(t->lock);
+  free(t->resident);
+  solid_free(t->solid);
+}
+
+uint8_t
+tilemap_get(Tilemap *t, int x, int y)
+{
+  if (x < 0 || y < 0 || (size_t)x >= t->w || (size_t)y >= t->h)
+  {
+    return 0;
+  }
+
+  uint8_t *tiles = t->tiles[(y / TILEMAP_CHUNK_TILES) * t->chunks_w + x / TILEMAP_CHUNK_TILES];
+  if (tiles == NULL)
+  {
+    return 0;
+  }
+  return tiles[(y % TILEMAP_CHUNK_TILES) * TILEMAP_CHUNK_TILES + x % TILEMAP_CHUNK_TILES];
+}
+
+void
+tilemap_set(Tilemap *t, int x, int y, uint8_t v)
+{
+  if (x < 0 || y < 0 || (size_t)x >= t->w || (size_t)y >= t->h)
+  {
+    ERROR_RETURN(, "Tile %d, %d outside of map", x, y);
+  }
+
+  size_t c = (y / TILEMAP_CHUNK_TILES) * t->chunks_w + x / TILEMAP_CHUNK_TILES;
+  if (t->tiles[c] == NULL)
+  {
+    ERROR_RETURN(, "Tile %d, %d isn't loaded", x, y);
+  }
+
+  SDL_LockMutex(t->lock);
+  uint8_t *tile = &t->tiles[c][(y % TILEMAP_CHUNK_TILES) * TILEMAP_CHUNK_TILES + x % TILEMAP_CHUNK_TILES];
+  t->chunk_tiles[c] += ((v & LevelElement_Brick) != 0) - ((*tile & LevelElement_Brick) != 0);
+  t->state[c] = TilemapChunk_Modified;
+  *tile = v;
+  solid_set(t->solid, x, y, v & LevelElement_Brick);
+
+  // Neighbours pick their brick sprite based on this tile
+  tilemap_mark_dirty(t, x - 1, y);
+  tilemap_mark_dirty(t, x, y);
+  tilemap_mark_dirty(t, x + 1, y);
+  SDL_UnlockMutex(t->lock);
+}
+
+int
+tilemap_known(const Tilemap *t, float x0, float y0, float x1, float y1)
+{
+  float w = (float)(t->chunks_w * TILEMAP_CHUNK_PX), h = (float)(t->chunks_h * TILEMAP_CHUNK_PX);
+  if (x1 < 0 || y1 < 0 || x0 >= w || y0 >= h)
+  {
+    return 1;
+  }
+
+  int cx0 = x0 < 0 ? 0 : (int)(x0 / TILEMAP_CHUNK_PX);
+  int cy0 = y0 < 0 ? 0 : (int)(y0 / TILEMAP_CHUNK_PX);
+  int cx1 = x1 < w ? (int)(x1 / TILEMAP_CHUNK_PX) : (int)t->chunks_w - 1;
+  int cy1 = y1 < h ? (int)(y1 / TILEMAP_CHUNK_PX) : (int)t->chunks_h - 1;
+  for (int cy = cy0; cy <= cy1; cy++)
+  {
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+      if (t->chunk_known[cy * t->chunks_w + cx] == 0)
+      {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+void
+tilemap_stream(Tilemap *t, float vx, float vy, float vw, float vh, int wait)
+{
+  int cx0, cy0, cx1, cy1;
+  tilemap_chunk_rect(t, vx, vy, vw, vh, TILEMAP_LOAD_MARGIN, &cx0, &cy0, &cx1, &cy1);
+
+  size_t missing = tilemap_request(t, cx0, cy0, cx1, cy1);
+
+  StreamResult r;
+  while (stream_poll(t->stream, &r, 0))
+  {
+    tilemap_install(t, r.chunk, r.tiles);
+  }
+
+  // Only for the first frame of a level, everything else happens in the background
+  // Polling blocks while requests are in flight. With none in flight and
+  // chunks still missing, nothing is coming that would load them.
+  while (wait && missing > 0)
+  {
+    if (stream_poll(t->stream, &r, 1) == 0)
+    {
+      DEBUG_ERROR("%zu chunks around the view can't be loaded", missing);
+      break;
+    }
+    tilemap_install(t, r.chunk, r.tiles);
+    missing = tilemap_request(t, cx0, cy0, cx1, cy1);
+  }
+
+  tilemap_chunk_rect(t, vx, vy, vw, vh, TILEMAP_EVICT_MARGIN, &cx0, &cy0, &cx1, &cy1);
+  tilemap_evict(t, cx0, cy0, cx1, cy1);
+}
+
+void
+tilemap_render(Tilemap *t, float vx, float vy, float vw, float vh)
+{
+  int cx0, cy0, cx1, cy1;
+  tilemap_chunk_rect(t, vx, vy, vw, vh, 0, &cx0, &cy0, &cx1, &cy1);
+
+  SDL_LockMutex(t->lock);
+
+  // Evicted chunks that weren't loaded again since
+  for (size_t i = 0; i < t->num_released; i++)
+  {
+    uint32_t c = t->released[i];
+    if (t->tiles[c] == NULL && t->chunks[c] != NULL)
+    {
+      SDL_DestroyTexture(t->chunks[c]);
+      t->chunks[c] = NULL;
+    }
+    t->chunk_released[c] = 0;
+  }
+  t->num_released = 0;
+
+  for (int cy = cy0; cy <= cy1; cy++)
+  {
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+      size_t c = cy * t->chunks_w + cx;
+      if (t->tiles[c] == NULL || t->chunk_tiles[c] == 0)
+      {
+        continue;
+      }
+      if (t->chunks[c] == NULL || t->chunk_dirty[c])
+      {
+        tilemap_bake(t, cx, cy);
+      }
+      game_draw_texture(t->chunks[c], cx * TILEMAP_CHUNK_PX, cy * TILEMAP_CHUNK_PX);
+    }
+  }
+
+  SDL_UnlockMutex(t->lock);
+}
+
+static void
+tilemap_mark_dirty(Tilemap *t, int x, int y)
+{
+  if (x < 0 || y < 0 || (size_t)x >= t->w || (size_t)y >= t->h)
+  {
+    return;
+  }
+  t->chunk_dirty[(y / TILEMAP_CHUNK_TILES) * t->chunks_w + x / TILEMAP_CHUNK_TILES] = 1;
+}
+
+static void
+tilemap_chunk_rect(Tilemap *t, float vx, float vy, float vw, float vh, int margin,
+                   int *cx0, int *cy0, int *cx1, int *cy1)
+{
+  *cx0 = (int)(vx / TILEMAP_CHUNK_PX) - margin;
+  *cy0 = (int)(vy / TILEMAP_CHUNK_PX) - margin;
+  *cx1 = (int)((vx + vw) / TILEMAP_CHUNK_PX) + margin;
+  *cy1 = (int)((vy + vh) / TILEMAP_CHUNK_PX) + margin;
+
+  *cx0 = *cx0 < 0 ? 0 : *cx0;
+  *cy0 = *cy0 < 0 ? 0 : *cy0;
+  *cx1 = *cx1 >= (int)t->chunks_w ? (int)t->chunks_w - 1 : *cx1;
+  *cy1 = *cy1 >= (int)t->chunks_h ? (int)t->chunks_h - 1 : *cy1;
+}
+
+static size_t
+tilemap_request(Tilemap *t, int cx0, int cy0, int cx1, int cy1)
+{
+  size_t missing = 0;
+  for (int cy = cy0; cy <= cy1; cy++)
+  {
+    for (int cx = cx0; cx <= cx1; cx++)
+    {
+      size_t c = cy * t->chunks_w + cx;
+      if (t->state[c] == TilemapChunk_Unloaded)
+      {
+        if (t->stream->thread == NULL)
+        {
+          // No loader thread, read in place rather than never
+          uint8_t *tiles = calloc(1, TILEMAP_CHUNK_TILES * TILEMAP_CHUNK_TILES);
+          DEBUG_ASSERT(tiles, "Can't allocate space for chunk");
+          level_read_chunk(t->level, cx, cy, tiles);
+          tilemap_install(t, c, tiles);
+          continue;
+        }
+        if (stream_request(t->stream, c))
+        {
+          t->state[c] = TilemapChunk_Requested;
+        }
+      }
+      missing += t->state[c] < TilemapChunk_Resident;
+    }
+  }
+  return missing;
+}
+
+static void
+tilemap_install(Tilemap *t, uint32_t c, uint8_t *tiles)
+{
+  if (t->num_resident >= t->max_resident)
+  {
+    size_t max_resident = t->max_resident ? t->max_resident * 2 : 64;
+    uint32_t *new_resident = realloc(t->resident, max_resident * sizeof(uint32_t));
+    DEBUG_ASSERT(new_resident, "Can't reallocate space for resident chunks");
+    t->resident = new_resident;
+    t->max_resident = max_resident;
+  }
+  t->resident[t->num_resident++] = c;
+
+  SDL_LockMutex(t->lock);
+
+  uint16_t n = 0;
+  size_t x0 = (c % t->chunks_w) * TILEMAP_CHUNK_TILES, y0 = (c / t->chunks_w) * TILEMAP_CHUNK_TILES;
+  for (size_t i = 0; i < TILEMAP_CHUNK_TILES * TILEMAP_CHUNK_TILES; i++)
+  {
+    int brick = (tiles[i] & LevelElement_Brick) != 0;
+    n += brick;
+    if (t->chunk_known[c] == 0)
+    {
+      solid_set(t->solid, x0 + i % TILEMAP_CHUNK_TILES, y0 + i / TILEMAP_CHUNK_TILES, brick);
+    }
+  }
+  t->chunk_known[c] = 1;
+
+  t->tiles[c] = tiles;
+  t->state[c] = TilemapChunk_Resident;
+  t->chunk_tiles[c] = n;
+  t->chunk_dirty[c] = 1;
+
+  // Bricks at the edge of the neighbours were baked without this chunk
+  size_t cx = c % t->chunks_w;
+  if (cx > 0)
+  {
+    t->chunk_dirty[c - 1] = 1;
+  }
+  if (cx + 1 < t->chunks_w)
+  {
+    t->chunk_dirty[c + 1] = 1;
+  }
+  SDL_UnlockMutex(t->lock);
+}
+
+static void
+tilemap_evict(Tilemap *t, int cx0, int cy0, int cx1, int cy1)
+{
+  SDL_LockMutex(t->lock);
+  for (size_t i = 0; i < t->num_resident; )
+  {
+    uint32_t c = t->resident[i];
+    int cx = c % t->chunks_w, cy = c / t->chunks_w;
+    if (t->state[c] == TilemapChunk_Modified || (cx >= cx0 && cx <= cx1 && cy >= cy0 && cy <= cy1))
+    {
+      i++;
+      continue;
+    }
+
+    // The texture goes on the next render, this thread can't touch it
+    if (t->chunk_released[c] == 0)
+    {
+      t->chunk_released[c] = 1;
+      t->released[t->num_released++] = c;
+    }
+    free(t->tiles[c]);
+    t->tiles[c] = NULL;
+    t->state[c] = TilemapChunk_Unloaded;
+    t->resident[i] = t->resident[--t->num_resident];
+  }
+  SDL_UnlockMutex(t->lock);
+}
+
+static void
+tilemap_bake(Tilemap *t, size_t cx, size_t cy)
+{
+  size_t c = cy * t->chunks_w + cx;
+  if (t->chunks[c] == NULL)
+  {
+    t->chunks[c] = game_create_target(TILEMAP_CHUNK_PX, TILEMAP_CHUNK_PX);
+  }
+  t->chunk_dirty[c] = 0;
+
+  game_begin_target(t->chunks[c]);
+
+  const uint8_t *tiles = t->tiles[c];
+  size_t x0 = cx * TILEMAP_CHUNK_TILES, y0 = cy * TILEMAP_CHUNK_TILES;
+  for (size_t y = 0; y < TILEMAP_CHUNK_TILES && y0 + y < t->h; y++)
+  {
+    for (size_t x = 0; x < TILEMAP_CHUNK_TILES && x0 + x < t->w; x++)
+    {
+      if ((tiles[y * TILEMAP_CHUNK_TILES + x] & LevelElement_Brick) == 0)
+      {
+        continue;
+      }
+
+      // Map edges count as bricks so walls don't get rounded ends there
+      size_t tx = x0 + x, ty = y0 + y;
+      int left_n = (tx == 0) || (tilemap_get(t, tx - 1, ty) & LevelElement_Brick);
+      int right_n = (tx == t->w - 1) || (tilemap_get(t, tx + 1, ty) & LevelElement_Brick);
+
+      SpriteId spr;
+      switch ((left_n * 1) | (right_n * 2))
+      {
+      case 1:
+        spr = t->brick_r;
+        break;
+      case 2:
+        spr = t->brick_l;
+        break;
+      default:
+        spr = t->brick_c;
+        break;
+      }
+
+      float px = x * TILE_SIZE + TILE_SIZE / 2;
+      float py = y * TILE_SIZE + TILE_SIZE / 2;
+      game_draw_sprite(spr, px, py, 1, 1, 0);
+    }
+  }
+
+  game_end_target();
+}
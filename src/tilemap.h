@@ -0,0 +1,94 @@
+#pragma once
+
+#include "collide.h"
+#include "game.h"
+#include "level.h"
+#include "mem.h"
+#include "stream.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_SIZE           16
+#define TILEMAP_CHUNK_TILES LEVEL_CHUNK_TILES
+#define TILEMAP_CHUNK_PX    (TILEMAP_CHUNK_TILES * TILE_SIZE)
+
+// Chunks around the view that get loaded, and the distance past which they're
+// dropped again, both in chunks. The gap keeps chunks at the edge from being
+// loaded and evicted over and over.
+#define TILEMAP_LOAD_MARGIN  1
+#define TILEMAP_EVICT_MARGIN 2
+
+typedef enum {
+  LevelElement_Brick = 1 << 0,
+}
+LevelElement;
+
+typedef enum {
+  TilemapChunk_Unloaded,
+  TilemapChunk_Requested,
+  TilemapChunk_Resident,
+  TilemapChunk_Modified,
+}
+TilemapChunkState;
+
+// Static level geometry kept as a grid of LevelElement flags, streamed in
+// chunks of TILEMAP_CHUNK_TILES^2 tiles by a loader thread. Only chunks near
+// the view are in memory, edited chunks stay until the tilemap is freed.
+// Chunks are baked into render target textures the first time they're visible
+// and again only after one of their tiles changes. Bricks are mirrored into a
+// solid bit grid for collision, which keeps chunks that were evicted.
+//
+// The simulation thread owns the tiles and the render thread owns the
+// textures. lock guards what both touch: tiles, chunk_dirty, chunk_tiles and
+// the released list of evicted chunks whose textures the renderer destroys.
+typedef struct {
+  size_t w, h;
+  const Level *level;
+  LevelStream *stream;
+
+  size_t      chunks_w, chunks_h;
+  uint8_t     **tiles;
+  uint8_t     *state;
+  SDL_Texture **chunks;
+  uint8_t     *chunk_dirty;
+  uint16_t    *chunk_tiles;
+
+  SolidGrid *solid;
+  uint8_t   *chunk_known;
+
+  // Indices of chunks holding tiles, eviction only looks at these
+  size_t   num_resident, max_resident;
+  uint32_t *resident;
+
+  SDL_mutex *lock;
+  size_t    num_released;
+  uint32_t  *released;
+  uint8_t   *chunk_released;
+
+  SpriteId brick_c, brick_l, brick_r;
+}
+Tilemap;
+
+// The level has to outlive the tilemap. The tilemap and its per chunk tables
+// are allocated from arena and released with it, after tilemap_free.
+Tilemap *tilemap_init(const Level *level, Arena *arena);
+void tilemap_free(Tilemap *t);
+
+// Simulation thread only. Cells outside the map or in chunks that aren't
+// loaded read as empty.
+uint8_t tilemap_get(Tilemap *t, int x, int y);
+void    tilemap_set(Tilemap *t, int x, int y, uint8_t v);
+
+// Whether every chunk overlapping the world pixel rectangle was ever loaded,
+// the solid grid is empty until then. Outside the map counts as loaded.
+int tilemap_known(const Tilemap *t, float x0, float y0, float x1, float y1);
+
+// Requests chunks around the view rectangle, takes in finished loads and
+// evicts chunks far from the view. Doesn't block unless wait is set, then it
+// returns once every chunk around the view is loaded.
+void tilemap_stream(Tilemap *t, float vx, float vy, float vw, float vh, int wait);
+
+// Render thread only. Draws the chunks overlapping the view rectangle, in world
+// pixels.
+void tilemap_render(Tilemap *t, float vx, float vy, float vw, float vh);
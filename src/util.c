@@ -4,29 +4,131 @@
 #include <string.h>
 #include <sys/stat.h>
 
+uint32_t
+hash_string(const char *s)
+{
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (; *s; s++)
+  {
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  }
+  return h;
+}
+
+static uint64_t
+hash_read64(const uint8_t *p)
+{
+  return (uint64_t)p[0]       | (uint64_t)p[1] << 8  | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+         (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint64_t
+hash_round(uint64_t h, uint64_t w)
+{
+  h ^= w * 0xff51afd7ed558ccdull;
+  return (h << 31 | h >> 33) * 0xc4ceb9fe1a85ec53ull;
+}
+
+uint64_t
+hash_bytes(const void *data, size_t size)
+{
+  const uint8_t *p = data;
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+
+  // Four independent lanes over 32 byte blocks keep the multipliers busy
+  if (size >= 32)
+  {
+    uint64_t v[4] = {h, h + 1, h + 2, h + 3};
+    for (; size >= 32; size -= 32, p += 32)
+    {
+      v[0] = hash_round(v[0], hash_read64(p));
+      v[1] = hash_round(v[1], hash_read64(p + 8));
+      v[2] = hash_round(v[2], hash_read64(p + 16));
+      v[3] = hash_round(v[3], hash_read64(p + 24));
+    }
+    h = hash_round(hash_round(hash_round(hash_round(h, v[0]), v[1]), v[2]), v[3]);
+  }
+
+  for (; size >= 8; size -= 8, p += 8)
+  {
+    h = hash_round(h, hash_read64(p));
+  }
+  for (; size > 0; size--, p++)
+  {
+    h = (h ^ *p) * 0x100000001b3ull;
+  }
+
+  // Final avalanche so every input bit affects every output bit
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+void
+hash_map_init(HashMap *m, size_t n)
+{
+  // Power of two at least twice the key count keeps probe runs short
+  m->capacity = 8;
+  while (m->capacity < n * 2)
+  {
+    m->capacity *= 2;
+  }
+
+  m->keys = calloc(m->capacity, sizeof(char *));
+  m->values = calloc(m->capacity, sizeof(int));
+  DEBUG_ASSERT(m->keys && m->values, "Can't allocate space for hash map");
+}
+
+void
+hash_map_free(HashMap *m)
+{
+  free(m->keys);
+  free(m->values);
+  m->keys = NULL;
+  m->values = NULL;
+  m->capacity = 0;
+}
+
 int
-binary_search(const char **arr, size_t n, const char *target)
+hash_map_put(HashMap *m, const char *key, int value)
 {
-  size_t low = 0;
-  size_t high = n;
-  while (low < high)
+  size_t mask = m->capacity - 1;
+  for (size_t i = hash_string(key) & mask; ; i = (i + 1) & mask)
   {
-    size_t mid = (low + high) / 2;
-    int comp = strcmp(arr[mid], target);
-    if (comp == 0)
+    if (m->keys[i] == NULL)
     {
-      return mid;
+      m->keys[i] = key;
+      m->values[i] = value;
+      return 0;
     }
-    if (comp > 0)
+    if (strcmp(m->keys[i], key) == 0)
     {
-      high = mid; // Look in 1st half
+      ERROR_RETURN(-1, "Duplicate key %s", key);
     }
-    else
+  }
+}
+
+int
+hash_map_get(const HashMap *m, const char *key)
+{
+  if (m->capacity == 0)
+  {
+    return -1;
+  }
+
+  size_t mask = m->capacity - 1;
+  for (size_t i = hash_string(key) & mask; m->keys[i] != NULL; i = (i + 1) & mask)
+  {
+    if (strcmp(m->keys[i], key) == 0)
     {
-      low = mid + 1; // Look in 2nd half
+      return m->values[i];
     }
   }
-  ERROR_RETURN(-1, "Failed to find target %s", target);
+  return -1;
 }
 
 float
@@ -5,6 +5,7 @@
 #ifdef _NO_DEBUG // Debug disabled
 
 #define DEBUG_TRACE(...)
+#define DEBUG_WARNING(...)
 #define DEBUG_ERROR(...)
 #define DEBUG_ASSERT(x, ...)
 
@@ -61,7 +62,30 @@
 
 #endif // Debug
 
+// Hashing
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open addressing map from string keys to ints, keys aren't copied and must
+// outlive the map
+typedef struct {
+  size_t capacity;
+  const char **keys;
+  int *values;
+}
+HashMap;
+
+uint32_t hash_string(const char *s);
+void hash_map_init(HashMap *m, size_t n);
+void hash_map_free(HashMap *m);
+int  hash_map_put(HashMap *m, const char *key, int value);
+int  hash_map_get(const HashMap *m, const char *key);
+
+// Fast non-cryptographic 64 bit hash of a byte range, for checksums. The result
+// doesn't depend on the host byte order.
+uint64_t hash_bytes(const void *data, size_t size);
+
 // Math
 
-int binary_search(const char **arr, size_t n, const char *target);
 float lerp(float start, float dest, float step);
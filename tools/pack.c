@@ -0,0 +1,246 @@
+#include "../src/game.h"
+#include "../src/pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bundles asset files into one pack for the game to map at startup. Images are
+// decoded to RGBA and sounds converted to the mixer's output format here, so
+// the game only uploads and plays them. Anything else, fonts included, is
+// stored as it is. Run from the directory the game runs in, entries are named
+// after the paths given:
+//
+//   cd bin && ./pack assets.pak gfx/ingame.png font/noto_serif.ttf sfx/explosion.wav
+
+static uint8_t *pack_read_file(const char *file, size_t *size);
+static uint8_t *pack_image(const char *file, size_t *size);
+static uint8_t *pack_sound(const char *file, size_t *size);
+static int      pack_has_ext(const char *file, const char *ext);
+static void     pack_le16(uint8_t *p, uint16_t v);
+static void     pack_le32(uint8_t *p, uint32_t v);
+
+int
+main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    printf("usage: %s <pack> <files...>\n", argv[0]);
+    return 1;
+  }
+
+  size_t num_entries = (size_t)argc - 2;
+  PackEntry *entries = calloc(num_entries, sizeof(PackEntry));
+  if (entries == NULL)
+  {
+    printf("can't allocate space for %zu entries\n", num_entries);
+    return 1;
+  }
+
+  int result = 0;
+  size_t in_size = 0, out_size = 0;
+  for (size_t i = 0; i < num_entries && result == 0; i++)
+  {
+    const char *file = argv[i + 2];
+    PackEntry *e = &entries[i];
+    e->name = file;
+
+    uint8_t *data = NULL;
+    if (pack_has_ext(file, ".png") || pack_has_ext(file, ".bmp") || pack_has_ext(file, ".jpg"))
+    {
+      e->type = PackType_Rgba;
+      data = pack_image(file, &e->size);
+    }
+    else if (pack_has_ext(file, ".wav"))
+    {
+      e->type = PackType_Pcm;
+      data = pack_sound(file, &e->size);
+    }
+    else
+    {
+      e->type = PackType_Raw;
+      data = pack_read_file(file, &e->size);
+    }
+    if (data == NULL)
+    {
+      result = 1;
+      break;
+    }
+    e->data = data;
+
+    // Decoded sizes against the files they came from
+    size_t file_size = 0;
+    free(pack_read_file(file, &file_size));
+    printf("%-32s %-4s %10zu -> %10zu bytes\n", file, e->type == PackType_Rgba ? "rgba" :
+           e->type == PackType_Pcm ? "pcm" : "raw", file_size, e->size);
+    in_size += file_size;
+    out_size += e->size;
+  }
+
+  if (result == 0 && pack_write(argv[1], entries, num_entries) != 0)
+  {
+    printf("can't write %s\n", argv[1]);
+    result = 1;
+  }
+  if (result == 0)
+  {
+    printf("%s: %zu entries, %zu bytes from %zu\n", argv[1], num_entries, out_size, in_size);
+  }
+
+  for (size_t i = 0; i < num_entries; i++)
+  {
+    free((void *)entries[i].data);
+  }
+  free(entries);
+  IMG_Quit();
+  SDL_Quit();
+  return result;
+}
+
+static uint8_t *
+pack_read_file(const char *file, size_t *size)
+{
+  SDL_RWops *rw = SDL_RWFromFile(file, "rb");
+  if (rw == NULL)
+  {
+    printf("can't open %s: %s\n", file, SDL_GetError());
+    return NULL;
+  }
+
+  Sint64 n = SDL_RWsize(rw);
+  uint8_t *data = n >= 0 ? malloc((size_t)n + 1) : NULL;
+  if (data == NULL || SDL_RWread(rw, data, 1, (size_t)n) != (size_t)n)
+  {
+    printf("can't read %s\n", file);
+    free(data);
+    SDL_RWclose(rw);
+    return NULL;
+  }
+  SDL_RWclose(rw);
+
+  *size = (size_t)n;
+  return data;
+}
+
+static uint8_t *
+pack_image(const char *file, size_t *size)
+{
+  SDL_Surface *loaded = IMG_Load(file);
+  if (loaded == NULL)
+  {
+    printf("can't load %s: %s\n", file, IMG_GetError());
+    return NULL;
+  }
+  SDL_Surface *s = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+  SDL_FreeSurface(loaded);
+  if (s == NULL)
+  {
+    printf("can't convert %s: %s\n", file, SDL_GetError());
+    return NULL;
+  }
+
+  // Rows are stored tightly, whatever the surface's pitch
+  size_t pitch = (size_t)s->w * 4;
+  *size = PACK_RGBA_HEADER + pitch * (size_t)s->h;
+  uint8_t *data = calloc(1, *size);
+  if (data != NULL)
+  {
+    pack_le32(data, (uint32_t)s->w);
+    pack_le32(data + 4, (uint32_t)s->h);
+    pack_le32(data + 8, (uint32_t)pitch);
+    SDL_LockSurface(s);
+    for (int y = 0; y < s->h; y++)
+    {
+      memcpy(data + PACK_RGBA_HEADER + y * pitch, (uint8_t *)s->pixels + y * s->pitch, pitch);
+    }
+    SDL_UnlockSurface(s);
+  }
+  SDL_FreeSurface(s);
+  return data;
+}
+
+static uint8_t *
+pack_sound(const char *file, size_t *size)
+{
+  SDL_AudioSpec spec;
+  Uint8 *samples;
+  Uint32 len;
+  if (SDL_LoadWAV(file, &spec, &samples, &len) == NULL)
+  {
+    printf("can't load %s: %s\n", file, SDL_GetError());
+    return NULL;
+  }
+
+  // The mixer's output format, Mix_OpenAudio in game_init_system
+  SDL_AudioCVT cvt;
+  if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+                        AUDIO_S16LSB, GAME_AUDIO_CHANNELS, GAME_AUDIO_FREQ) < 0)
+  {
+    printf("can't convert %s: %s\n", file, SDL_GetError());
+    SDL_FreeWAV(samples);
+    return NULL;
+  }
+  cvt.len = (int)len;
+  cvt.buf = malloc((size_t)len * (size_t)(cvt.len_mult > 0 ? cvt.len_mult : 1));
+  if (cvt.buf == NULL)
+  {
+    SDL_FreeWAV(samples);
+    return NULL;
+  }
+  memcpy(cvt.buf, samples, len);
+  SDL_FreeWAV(samples);
+  if (cvt.needed && SDL_ConvertAudio(&cvt) != 0)
+  {
+    printf("can't convert %s: %s\n", file, SDL_GetError());
+    free(cvt.buf);
+    return NULL;
+  }
+  size_t pcm = cvt.needed ? (size_t)cvt.len_cvt : len;
+
+  // Canonical WAV header, so the entry is still a valid file for loaders that
+  // convert it when the device runs in another format
+  *size = PACK_PCM_HEADER + pcm;
+  uint8_t *data = malloc(*size);
+  if (data != NULL)
+  {
+    uint16_t block = GAME_AUDIO_CHANNELS * 2;
+    memcpy(data, "RIFF", 4);
+    pack_le32(data + 4, (uint32_t)(*size - 8));
+    memcpy(data + 8, "WAVEfmt ", 8);
+    pack_le32(data + 16, 16);
+    pack_le16(data + 20, 1);
+    pack_le16(data + 22, GAME_AUDIO_CHANNELS);
+    pack_le32(data + 24, GAME_AUDIO_FREQ);
+    pack_le32(data + 28, GAME_AUDIO_FREQ * block);
+    pack_le16(data + 32, block);
+    pack_le16(data + 34, 16);
+    memcpy(data + 36, "data", 4);
+    pack_le32(data + 40, (uint32_t)pcm);
+    memcpy(data + PACK_PCM_HEADER, cvt.buf, pcm);
+  }
+  free(cvt.buf);
+  return data;
+}
+
+static int
+pack_has_ext(const char *file, const char *ext)
+{
+  size_t n = strlen(file), e = strlen(ext);
+  return n >= e && SDL_strcasecmp(file + n - e, ext) == 0;
+}
+
+static void
+pack_le16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void
+pack_le32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    p[i] = (uint8_t)(v >> (i * 8));
+  }
+}